@@ -0,0 +1,383 @@
+/*
+ * Written by Vadim Guchenko <yhw@rambler-co.ru>
+ *
+ * 	$Id$
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "conf.h"
+#include "stats.h"
+#include "output.h"
+#include "cache.h"
+
+
+/* Structure for shared counters of cached command */
+struct cache_stats {
+	/* requests which got snapshot younger than TTL */
+	u_long	hits;
+	/* requests which waited for collection already in flight and got
+	   its result */
+	u_long	coalesced;
+	/* collections really done */
+	u_long	collections;
+};
+
+
+/* Counters indexed by CMD_* constants shared by all processes or NULL */
+struct cache_stats *cache_stats = NULL;
+/* Non-zero if private directory of snapshots is usable */
+static int cache_dir_ok = 0;
+
+
+static ino_t cache_ino(const char *);
+static int cache_read(const char *, struct outbuf *, struct stat *);
+static void cache_write(const char *, const struct outbuf *);
+static int cache_collect(int, struct outbuf *);
+static void cache_emit(int, struct outbuf *, time_t);
+
+
+/*****************************************************************************
+ * Allocates counters shared by the main process and all its children. Must
+ * be called before any fork(2).
+ *****************************************************************************/
+void cache_init() {
+	void *p;
+
+	p = mmap(NULL, sizeof(*cache_stats) * CMD_MAXN, PROT_READ | PROT_WRITE,
+	    MAP_ANON | MAP_SHARED, -1, 0);
+	if (p == MAP_FAILED) {
+		msg_syswarn("%s: mmap", __FUNCTION__);
+		return;
+	}
+	cache_stats = p;
+}
+
+/*****************************************************************************
+ * Creates private directory of snapshots in working directory. Snapshots
+ * are trusted by the daemon, so the directory must be owned by effective
+ * user and be inaccessible to others. Otherwise caching is disabled. Must
+ * be called after chdir(2) to working directory.
+ *****************************************************************************/
+void cache_dir_init() {
+	struct stat st;
+
+	if (mkdir(CACHE_DIR, 0700) < 0 && errno != EEXIST) {
+		msg_syswarn("%s: mkdir(%s)", __FUNCTION__, CACHE_DIR);
+		return;
+	}
+	if (lstat(CACHE_DIR, &st) < 0) {
+		msg_syswarn("%s: lstat(%s)", __FUNCTION__, CACHE_DIR);
+		return;
+	}
+	if (!S_ISDIR(st.st_mode) || st.st_uid != geteuid() ||
+	    (st.st_mode & (S_IRWXG | S_IRWXO))) {
+		msg_warn("%s: %s isn't private directory, caching is disabled",
+		    __FUNCTION__, CACHE_DIR);
+		return;
+	}
+	cache_dir_ok = 1;
+}
+
+/*****************************************************************************
+ * Looks for 'cache' directive of command %cmd%. If found, stores TTL of
+ * snapshot into %ttl% and returns non-zero. Otherwise returns zero.
+ *****************************************************************************/
+int cache_lookup(int cmd, u_int *ttl) {
+	int i;
+
+	if (!cache_dir_ok)
+		return(0);
+	for (i = 0; i < conf.cache_count; i++)
+		if (conf.cache_conf[i].cmd == cmd) {
+			*ttl = conf.cache_conf[i].ttl;
+			return(1);
+		}
+	return(0);
+}
+
+/*****************************************************************************
+ * Processes command %cmd% using its snapshot. %args% is hash of command
+ * arguments, so different arguments have different snapshots. Snapshot
+ * which is older than %ttl% seconds is collected again. Only one process
+ * collects the same snapshot at a time, others wait for it and share the
+ * result.
+ *****************************************************************************/
+void cache_run(int cmd, u_int args, u_int ttl) {
+	char filename[FILENAME_MAXLEN + 1], lockname[FILENAME_MAXLEN + 1];
+	struct outbuf snap;
+	struct stat st;
+	time_t tm;
+	ino_t ino;
+	int fd;
+
+	snprintf(filename, sizeof(filename), "%s/%s.%08x", CACHE_DIR,
+	    commands[cmd].name, args);
+	snprintf(lockname, sizeof(lockname), "%s.lock", filename);
+	bzero(&snap, sizeof(snap));
+
+	tm = time(NULL);
+	if (ttl && cache_read(filename, &snap, &st) && st.st_mtime <= tm &&
+	    tm - st.st_mtime < (time_t)ttl) {
+		msg_debug(1, "Snapshot of %s command is used, age %lu",
+		    commands[cmd].name, (u_long)(tm - st.st_mtime));
+		if (cache_stats)
+			__sync_fetch_and_add(&cache_stats[cmd].hits, 1);
+		cache_emit(cmd, &snap, tm - st.st_mtime);
+		outbuf_free(&snap);
+		return;
+	}
+
+	/* snapshot which appears while waiting for the lock is collected by
+	   the process which held the lock */
+	ino = cache_ino(filename);
+	if ((fd = open(lockname, O_RDWR | O_CREAT | O_NOFOLLOW, 0600)) < 0)
+		msg_syswarn("%s: open(%s)", __FUNCTION__, lockname);
+	else {
+		if (flock(fd, LOCK_EX | LOCK_NB) < 0) {
+			msg_debug(1, "Collection of %s command is in flight, "
+			    "waiting", commands[cmd].name);
+			if (flock(fd, LOCK_EX) < 0)
+				msg_syswarn("%s: flock(%s)", __FUNCTION__,
+				    lockname);
+		}
+		/* the lock may be released by another collection just after
+		   the snapshot was checked, so check it again */
+		snap.len = 0;
+		tm = time(NULL);
+		if (cache_read(filename, &snap, &st) && (st.st_ino != ino ||
+		    (ttl && st.st_mtime <= tm &&
+		    tm - st.st_mtime < (time_t)ttl))) {
+			if (cache_stats)
+				__sync_fetch_and_add(
+				    &cache_stats[cmd].coalesced, 1);
+			cache_emit(cmd, &snap,
+			    st.st_mtime <= tm ? tm - st.st_mtime : 0);
+			outbuf_free(&snap);
+			close(fd);
+			return;
+		}
+		/* no snapshot or collection failed, collect it */
+	}
+
+	snap.len = 0;
+	if (cache_stats)
+		__sync_fetch_and_add(&cache_stats[cmd].collections, 1);
+	if (cache_collect(cmd, &snap))
+		cache_write(filename, &snap);
+	/* release the lock */
+	if (fd >= 0)
+		close(fd);
+	cache_emit(cmd, &snap, 0);
+	outbuf_free(&snap);
+}
+
+/*****************************************************************************
+ * Processes CACHE command.
+ *****************************************************************************/
+void do_cache() {
+	char name[CMD_NAME_MAXLEN + 1];
+	time_t tm;
+	int i;
+
+	msg_debug(1, "Processing of CACHE command started");
+
+	if (cache_stats == NULL) {
+		msg_debug(1, "Processing of CACHE command finished");
+		return;
+	}
+	tm = get_remote_tm();
+	for (i = 0; i < conf.cache_count; i++) {
+		command_name(conf.cache_conf[i].cmd, name, sizeof(name));
+		out_u64(tm, out_key("cache_hits", name),
+		    cache_stats[conf.cache_conf[i].cmd].hits);
+		out_u64(tm, out_key("cache_coalesced", name),
+		    cache_stats[conf.cache_conf[i].cmd].coalesced);
+		out_u64(tm, out_key("cache_collections", name),
+		    cache_stats[conf.cache_conf[i].cmd].collections);
+		out_u64(tm, out_key("cache_saved", name),
+		    cache_stats[conf.cache_conf[i].cmd].hits +
+		    cache_stats[conf.cache_conf[i].cmd].coalesced);
+	}
+
+	msg_debug(1, "Processing of CACHE command finished");
+}
+
+/*****************************************************************************
+ * Returns inode number of snapshot file %filename% or 0 if it doesn't exist.
+ *****************************************************************************/
+static ino_t cache_ino(const char *filename) {
+	struct stat st;
+
+	if (lstat(filename, &st) < 0)
+		return(0);
+	return(st.st_ino);
+}
+
+/*****************************************************************************
+ * Reads snapshot file %filename% into %snap% and its status into %st%.
+ * Snapshot must be regular file owned by effective user. If successful,
+ * returns non-zero. Otherwise returns zero.
+ *****************************************************************************/
+static int cache_read(const char *filename, struct outbuf *snap,
+    struct stat *st) {
+	char buf[BUFSIZ];
+	ssize_t n;
+	int fd;
+
+	if ((fd = open(filename, O_RDONLY | O_NOFOLLOW)) < 0) {
+		if (errno != ENOENT)
+			msg_syswarn("%s: open(%s)", __FUNCTION__, filename);
+		return(0);
+	}
+	if (fstat(fd, st) < 0) {
+		msg_syswarn("%s: fstat(%s)", __FUNCTION__, filename);
+		close(fd);
+		return(0);
+	}
+	if (!S_ISREG(st->st_mode) || st->st_uid != geteuid()) {
+		msg_warn("%s: %s isn't regular file owned by ussd, ignored",
+		    __FUNCTION__, filename);
+		close(fd);
+		return(0);
+	}
+	while ((n = read(fd, buf, sizeof(buf))) > 0)
+		if (!outbuf_append(snap, buf, n))
+			break;
+	close(fd);
+	if (n != 0) {
+		if (n < 0)
+			msg_syswarn("%s: read(%s)", __FUNCTION__, filename);
+		return(0);
+	}
+	return(1);
+}
+
+/*****************************************************************************
+ * Atomically replaces snapshot file %filename% with %snap%.
+ *****************************************************************************/
+static void cache_write(const char *filename, const struct outbuf *snap) {
+	char tmpname[FILENAME_MAXLEN + 1];
+	size_t off;
+	ssize_t n;
+	int fd;
+
+	snprintf(tmpname, sizeof(tmpname), "%s.XXXXXX", filename);
+	if ((fd = mkstemp(tmpname)) < 0) {
+		msg_syswarn("%s: mkstemp(%s)", __FUNCTION__, tmpname);
+		return;
+	}
+	for (off = 0; off < snap->len; off += n)
+		if ((n = write(fd, snap->buf + off, snap->len - off)) < 0) {
+			msg_syswarn("%s: write(%s)", __FUNCTION__, tmpname);
+			close(fd);
+			unlink(tmpname);
+			return;
+		}
+	close(fd);
+	if (rename(tmpname, filename) < 0) {
+		msg_syswarn("%s: rename(%s, %s)", __FUNCTION__, tmpname, filename);
+		unlink(tmpname);
+	}
+}
+
+/*****************************************************************************
+ * Collects output of command %cmd% into %snap%. Command is processed by
+ * child, so output of its own children is collected too. Output lines have
+ * local time. Returns non-zero if command completed successfully and its
+ * snapshot can be saved.
+ *****************************************************************************/
+static int cache_collect(int cmd, struct outbuf *snap) {
+	char buf[BUFSIZ];
+	int pfd[2], status;
+	ssize_t n;
+	pid_t pid;
+
+	if (pipe(pfd) < 0) {
+		msg_syserr(0, "%s: pipe", __FUNCTION__);
+		return(0);
+	}
+	if ((pid = fork()) == 0) { /* child */
+		close(pfd[0]);
+		out_open(pfd[1], NULL, 0);
+		alarm(CHILD_TIMEOUT);
+		init_remote_tm(time(NULL));
+		commands[cmd].func();
+		out_flush();
+		wait_for_children();
+		exit(EXIT_SUCCESS);
+	} else if (pid < 0) {
+		msg_syserr(0, "%s: can't fork", __FUNCTION__);
+		close(pfd[0]);
+		close(pfd[1]);
+		return(0);
+	}
+
+	/* parent */
+	close(pfd[1]);
+	for (;;) {
+		n = read(pfd[0], buf, sizeof(buf));
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		outbuf_append(snap, buf, n);
+	}
+	close(pfd[0]);
+
+	while (waitpid(pid, &status, 0) < 0)
+		if (errno != EINTR) {
+			msg_syswarn("%s: waitpid", __FUNCTION__);
+			return(0);
+		}
+	return(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS);
+}
+
+/*****************************************************************************
+ * Writes snapshot %snap% of command %cmd% which is %age% seconds old. Local
+ * time of every line is converted to remote time of the client, and
+ * cache_age variable is added.
+ *****************************************************************************/
+static void cache_emit(int cmd, struct outbuf *snap, time_t age) {
+	char name[CMD_NAME_MAXLEN + 1], *line, *end, *p;
+	time_t tm;
+	long shift;
+	u_long line_tm;
+
+	tm = get_remote_tm();
+	shift = (long)(tm - time(NULL));
+
+	/* terminate snapshot for safe parsing */
+	if (!outbuf_append(snap, "", 1))
+		return;
+	snap->len--;
+
+	command_name(cmd, name, sizeof(name));
+	out_u64(tm, out_key("cache_age", name), age);
+
+	for (line = snap->buf; line < snap->buf + snap->len; line = end) {
+		if ((end = memchr(line, '\n', snap->buf + snap->len - line)))
+			end++;
+		else
+			end = snap->buf + snap->len;
+
+		line_tm = strtoul(line, &p, 10);
+		if (p == line || *p != ' ') {
+			out_printf("%.*s", (int)(end - line), line);
+			continue;
+		}
+		out_printf("%lu%.*s", line_tm + shift, (int)(end - p), p);
+	}
+}
@@ -0,0 +1,15 @@
+/*
+ * Written by Vadim Guchenko <yhw@rambler-co.ru>
+ *
+ * 	$Id$
+ */
+
+/* Private directory of snapshot files in working directory */
+#define CACHE_DIR		"ussd.cache"
+
+
+void cache_init(void);
+void cache_dir_init(void);
+int cache_lookup(int, u_int *);
+void cache_run(int, u_int, u_int);
+void do_cache(void);
@@ -12,10 +12,13 @@
 
 #include <unistd.h>
 #include <string.h>
+#include <strings.h>
 #include <stdlib.h>
 #include <stdio.h>
 
 #include "conf.h"
+#include "stats.h"
+#include "pool.h"
 
 
 /* Ussd configuration */
@@ -39,6 +42,8 @@ void parse_command_line(int argc, char **argv) {
 	/* set default values */
 	conf.f_hosts_access = 0;
 	conf.f_enable_smart = 0;
+	conf.f_event_loop = 0;
+	conf.workers = 0;
 	snprintf(conf.configfile, sizeof(conf.configfile), DFL_CONFIGFILE);
 	conf.listen_port = DFL_LISTEN_PORT;
 	snprintf(conf.pidfile, sizeof(conf.pidfile), DFL_PIDFILE);
@@ -47,11 +52,14 @@ void parse_command_line(int argc, char **argv) {
 	*conf.group = 0;
 
 	/* process command line arguments */
-	while ((op = getopt(argc, argv, "ac:d:g:hp:r:su:vw:L")) != -1)
+	while ((op = getopt(argc, argv, "ac:d:eg:hn:p:r:su:vw:L")) != -1)
 		switch(op) {
 		case 'a': /* use hosts access control files */
 			conf.f_hosts_access = 1;
 			break;
+		case 'e': /* serve clients from the event loop */
+			conf.f_event_loop = 1;
+			break;
 		case 's': /* enable SMART on all HDDs */
 			conf.f_enable_smart = 1;
 			break;
@@ -66,6 +74,12 @@ void parse_command_line(int argc, char **argv) {
 				msg_err(1, "%s: wrong debug level: %s", __FUNCTION__, optarg);
 			msg_debug_level = debug_level_tmp;
 			break;
+		case 'n': /* number of worker processes */
+			if (!(parse_get_int(optarg, &p, &conf.workers) && !*p &&
+			    conf.workers >= 0 && conf.workers <= WORKER_MAXN))
+				msg_err(1, "%s: wrong number of workers: %s (maximum %d allowed)",
+				    __FUNCTION__, optarg, WORKER_MAXN);
+			break;
 		case 'p': /* listen port */
 			if (!(parse_get_uint16(optarg, &p, &conf.listen_port) && !*p))
 				msg_err(1, "%s: wrong port: %s", __FUNCTION__, optarg);
@@ -97,11 +111,13 @@ void parse_command_line(int argc, char **argv) {
  *****************************************************************************/
 static void usage() {
 	fprintf(stderr,
-	    "usage: ussd [-ahsv] [-c configfile] [-d level] [-p port] [-r pidfile]\n"
-	    "            [-w workdir] [-u user] [-g group]\n\n"
+	    "usage: ussd [-aehsv] [-c configfile] [-d level] [-n workers] [-p port]\n"
+	    "            [-r pidfile] [-w workdir] [-u user] [-g group]\n\n"
 	    "options:\n"
 	    "  -a             Use hosts access control files when accepting incoming\n"
 	    "                 connections. See hosts_access(5).\n"
+	    "  -e             Serve clients inside the main process from the event\n"
+	    "                 loop. Fork is used only for commands which can hang.\n"
 	    "  -h             Print this help.\n"
 	    "  -s             Enable SMART capabilities on all HDDs while processing\n"
 	    "  -L             Disable HDD load calculating on all HDDs\n"
@@ -110,6 +126,9 @@ static void usage() {
 	    "  -c configfile  Specify configuration file\n"
 	    "                 (default: %s).\n"
 	    "  -d level       Specify debug level 0-2 (default: %d).\n"
+	    "  -n workers     Specify number of worker processes, each accepting\n"
+	    "                 connections on its own SO_REUSEPORT socket (default: 0,\n"
+	    "                 main process accepts connections itself).\n"
 	    "  -p port        Specify listen port (default: %d).\n"
 	    "  -r pidfile     Specify file where to write the process ID\n"
 	    "                 (default: %s).\n"
@@ -135,16 +154,19 @@ static void version() {
  * Reads configuration file.
  *****************************************************************************/
 void read_config_file() {
-	char line[INPUT_LINE_MAXLEN + 1], *p, *q, *r;
-	int f_line_too_long, f_used, line_number, i;
+	char line[INPUT_LINE_MAXLEN + 1], *p, *q, *r, *w;
+	int f_line_too_long, f_used, line_number, i, j;
+	u_int ttl, timeout, window;
 	char var[VAR_MAXLEN + 1], *var_b, *var_e;
 	char command[SHELL_COMMAND_MAXLEN + 1];
 	uint32_t ip;
 	struct in_addr in_addr;
-	uint16_t port;
+	uint16_t port, port_max;
 	uint8_t f_unixsock;
+	struct socket_discover_conf *sd;
 	FILE *f;
 	char ipv6_any[] = "::";
+	struct socket_conf *sc;
 
 	/* set default values */
 	conf.apache_count = 0;
@@ -152,7 +174,14 @@ void read_config_file() {
 	conf.memcache_count = 0;
 	conf.socket_count = 0;
 	conf.socket_interval = 0;
+	conf.socket_burst = 0;
+	conf.socket_burst_interval = DFL_SOCKET_BURST_INTERVAL;
+	conf.socket_discover_count = 0;
+	conf.socket_discover_max = DFL_SOCKET_DISCOVER_MAX;
 	conf.exec_count = 0;
+	conf.cache_count = 0;
+	conf.timeout_count = 0;
+	conf.concurrency = DFL_CONCURRENCY;
 
 	/* open config file */
 	if ((f = fopen(conf.configfile, "r")) == NULL) {
@@ -314,9 +343,9 @@ void read_config_file() {
 			} else
 				msg_err(0, "%s: line %d: can't parse 'memcache' directive", __FUNCTION__, line_number);
 		} else if (parse_get_str(line, &p, "socket")) {
-			/* format 1: socket tcp|udp <variable> <ip> <port> */
-			/* format 2: socket (tcp|udp)6 <variable> <ip6> <port> */
-			/* format 3: socket unix <variable> <path> */
+			/* format 1: socket <variable> tcp|udp <ip> <port> [<window>] */
+			/* format 2: socket <variable> (tcp|udp)6 <ip6> <port> [<window>] */
+			/* format 3: socket <variable> unix <path> [<window>] */
 			if (parse_get_wspace(p, &var_b) &&
 			parse_get_chset(var_b, &var_e, VAR_CHSET, -(int)(sizeof(var) - 1)) &&
 			parse_get_wspace(var_e, &p) && (
@@ -336,7 +365,10 @@ void read_config_file() {
 			(parse_get_str(p, &r, "unix") && (f_unixsock = 4, 1) &&
 			 parse_get_wspace(r, &r) &&
 			 parse_get_chset(r, &q, "^ \t", -SOCKNAME_MAXLEN))) &&
-			!*q) {
+			(window = DFL_SOCKET_WINDOW, 1) &&
+			(!*q || (parse_get_wspace(q, &w) &&
+			 parse_get_uint(w, &w, &window) && !*w &&
+			 window >= 2 && window <= SOCKET_WINDOW_MAX))) {
 				strncpy(var, var_b, var_e - var_b);
 				var[var_e - var_b] = 0;
 				parse_tolower(var);
@@ -353,21 +385,27 @@ void read_config_file() {
 					continue;
 				}
 
-				/* check if too many socket directives */
-				if (conf.socket_count == SOCKET_MAXN) {
-					msg_err(0, "%s: line %d: too many 'socket' directives (maximum %d allowed)", __FUNCTION__, line_number, SOCKET_MAXN);
-					continue;
+				/* make room for one more socket */
+				if (conf.socket_count == conf.socket_size) {
+					j = conf.socket_size ? conf.socket_size * 2 : 16;
+					if ((sc = realloc(conf.socket_conf, j * sizeof(*sc))) == NULL) {
+						msg_syserr(0, "%s: realloc", __FUNCTION__);
+						continue;
+					}
+					conf.socket_conf = sc;
+					conf.socket_size = j;
 				}
 
 				/* add line to socket configuration */
 				strcpy(conf.socket_conf[conf.socket_count].var, var);
 				conf.socket_conf[conf.socket_count].type = f_unixsock;
+				conf.socket_conf[conf.socket_count].window = window;
 				bzero(&conf.socket_conf[conf.socket_count].sockaddr, sizeof(conf.socket_conf[conf.socket_count].sockaddr));
 				if (f_unixsock == 4) {
 					conf.socket_conf[conf.socket_count].sockaddr.sun.sun_family = AF_LOCAL;
 					strncpy(conf.socket_conf[conf.socket_count].sockaddr.sun.sun_path,
 					r, q - r);
-					conf.socket_conf[conf.socket_count].sockaddr.sun.sun_path[q - p] = 0;
+					conf.socket_conf[conf.socket_count].sockaddr.sun.sun_path[q - r] = 0;
 				} else if (f_unixsock == 0 || f_unixsock == 1) {
 					conf.socket_conf[conf.socket_count].sockaddr.sin.sin_family = AF_INET;
 					conf.socket_conf[conf.socket_count].sockaddr.sin.sin_port = htons(port);
@@ -401,12 +439,191 @@ void read_config_file() {
 				conf.exec_count++;
 			} else
 				msg_err(0, "%s: line %d: can't parse 'exec' directive", __FUNCTION__, line_number);
+		} else if (parse_get_str(line, &p, "cache")) {
+			/* format: cache <command> <ttl> */
+			if (parse_get_wspace(p, &var_b) &&
+			    parse_get_chset(var_b, &var_e, CHSET_ALPHA_ENG "_", -CMD_NAME_MAXLEN) &&
+			    parse_get_wspace(var_e, &p) &&
+			    parse_get_uint(p, &p, &ttl) && !*p &&
+			    ttl <= CACHE_TTL_MAX) {
+				*var_e = 0;
+
+				/* find command, only commands processed by
+				   child are worth caching */
+				for (i = 0; i < CMD_MAXN; i++)
+					if (strcasecmp(commands[i].name, var_b) == 0)
+						break;
+				if (i == CMD_MAXN || (commands[i].flags & CMD_F_INLINE)) {
+					msg_err(0, "%s: line %d: command '%s' can't be cached", __FUNCTION__, line_number, var_b);
+					continue;
+				}
+
+				/* check if command is already cached */
+				f_used = 0;
+				for (j = 0; j < conf.cache_count; j++)
+					if (conf.cache_conf[j].cmd == i) {
+						f_used = 1;
+						break;
+					}
+				if (f_used) {
+					msg_err(0, "%s: line %d: dublicated command '%s'", __FUNCTION__, line_number, var_b);
+					continue;
+				}
+
+				/* check if too many cache directives */
+				if (conf.cache_count == CACHE_MAXN) {
+					msg_err(0, "%s: line %d: too many 'cache' directives (maximum %d allowed)", __FUNCTION__, line_number, CACHE_MAXN);
+					continue;
+				}
+
+				/* add line to cache configuration */
+				conf.cache_conf[conf.cache_count].cmd = i;
+				conf.cache_conf[conf.cache_count].ttl = ttl;
+				conf.cache_count++;
+			} else
+				msg_err(0, "%s: line %d: can't parse 'cache' directive", __FUNCTION__, line_number);
+		} else if (parse_get_str(line, &p, "timeout")) {
+			/* format: timeout <command> <seconds> */
+			if (parse_get_wspace(p, &var_b) &&
+			    parse_get_chset(var_b, &var_e, CHSET_ALPHA_ENG "_", -CMD_NAME_MAXLEN) &&
+			    parse_get_wspace(var_e, &p) &&
+			    parse_get_uint(p, &p, &timeout) && !*p &&
+			    timeout > 0 && timeout <= CLIENT_TIMEOUT - POOL_DEADLINE_MARGIN) {
+				*var_e = 0;
+
+				/* find command, commands processed inside the
+				   client process are never killed */
+				for (i = 0; i < CMD_MAXN; i++)
+					if (strcasecmp(commands[i].name, var_b) == 0)
+						break;
+				if (i == CMD_MAXN || (commands[i].flags & CMD_F_INLINE)) {
+					msg_err(0, "%s: line %d: command '%s' can't have timeout", __FUNCTION__, line_number, var_b);
+					continue;
+				}
+
+				/* check if command already has timeout */
+				f_used = 0;
+				for (j = 0; j < conf.timeout_count; j++)
+					if (conf.timeout_conf[j].cmd == i) {
+						f_used = 1;
+						break;
+					}
+				if (f_used) {
+					msg_err(0, "%s: line %d: dublicated command '%s'", __FUNCTION__, line_number, var_b);
+					continue;
+				}
+
+				/* check if too many timeout directives */
+				if (conf.timeout_count == TIMEOUT_MAXN) {
+					msg_err(0, "%s: line %d: too many 'timeout' directives (maximum %d allowed)", __FUNCTION__, line_number, TIMEOUT_MAXN);
+					continue;
+				}
+
+				/* add line to timeout configuration */
+				conf.timeout_conf[conf.timeout_count].cmd = i;
+				conf.timeout_conf[conf.timeout_count].timeout = timeout;
+				conf.timeout_count++;
+			} else
+				msg_err(0, "%s: line %d: can't parse 'timeout' directive", __FUNCTION__, line_number);
+		} else if (parse_get_str(line, &p, "concurrency")) {
+			/* format: concurrency <number> */
+			if (!parse_get_wspace(p, &p) ||
+			    !parse_get_int(p, &p, &conf.concurrency) ||
+			    (*p) || conf.concurrency < 1 ||
+			    conf.concurrency > CONCURRENCY_MAX) {
+				msg_err(0, "%s: line %d: can't parse 'concurrency' directive", __FUNCTION__, line_number);
+				conf.concurrency = DFL_CONCURRENCY;
+			}
 		} else if (parse_get_str(line, &p, "sock_la_interval")) {
 			/* format: sock_la_interval <seconds> */
 			if (!parse_get_wspace(p, &p) ||
 			    !parse_get_int(p, &p, &conf.socket_interval) ||
 			    (*p))
 				msg_err(0, "%s: line %d: can't parse 'sock_la_interval' directive", __FUNCTION__, line_number);
+		} else if (parse_get_str(line, &p, "sock_la_burst")) {
+			/* format: sock_la_burst <percent> [<milliseconds>] */
+			conf.socket_burst_interval = DFL_SOCKET_BURST_INTERVAL;
+			if (!parse_get_wspace(p, &p) ||
+			    !parse_get_int(p, &p, &conf.socket_burst) ||
+			    (*p && (!parse_get_wspace(p, &p) ||
+			    !parse_get_int(p, &p, &conf.socket_burst_interval) ||
+			    *p)) ||
+			    conf.socket_burst < 1 || conf.socket_burst > 100 ||
+			    conf.socket_burst_interval < SOCKET_BURST_INTERVAL_MIN ||
+			    conf.socket_burst_interval > SOCKET_BURST_INTERVAL_MAX) {
+				msg_err(0, "%s: line %d: can't parse 'sock_la_burst' directive", __FUNCTION__, line_number);
+				conf.socket_burst = 0;
+				conf.socket_burst_interval = DFL_SOCKET_BURST_INTERVAL;
+			}
+		} else if (parse_get_str(line, &p, "sock_discover_max")) {
+			/* format: sock_discover_max <number> */
+			if (!parse_get_wspace(p, &p) ||
+			    !parse_get_int(p, &p, &conf.socket_discover_max) ||
+			    (*p) || conf.socket_discover_max < 1 ||
+			    conf.socket_discover_max > SOCKET_DISCOVER_MAX) {
+				msg_err(0, "%s: line %d: can't parse 'sock_discover_max' directive", __FUNCTION__, line_number);
+				conf.socket_discover_max = DFL_SOCKET_DISCOVER_MAX;
+			}
+		} else if (parse_get_str(line, &p, "sock_discover")) {
+			/* format: sock_discover tcp|udp|tcp6|udp6 [<port>[-<port>]] [<process>] */
+			/* format: sock_discover unix [<process>] */
+			port = 0;
+			port_max = 65535;
+			q = r = NULL;
+			if (!parse_get_wspace(p, &p) ||
+			    !((parse_get_str(p, &p, "tcp6") && (f_unixsock = 2, 1)) ||
+			     (parse_get_str(p, &p, "udp6") && (f_unixsock = 3, 1)) ||
+			     (parse_get_str(p, &p, "tcp") && (f_unixsock = 0, 1)) ||
+			     (parse_get_str(p, &p, "udp") && (f_unixsock = 1, 1)) ||
+			     (parse_get_str(p, &p, "unix") && (f_unixsock = 4, 1))) ||
+			    (*p && !parse_get_wspace(p, &p))) {
+				msg_err(0, "%s: line %d: can't parse 'sock_discover' directive", __FUNCTION__, line_number);
+				continue;
+			}
+			/* optional range of ports */
+			if (f_unixsock != 4 && parse_get_uint16(p, &w, &port)) {
+				port_max = port;
+				if ((parse_get_ch(w, &w, '-') &&
+				    !parse_get_uint16(w, &w, &port_max)) ||
+				    (*w && !parse_get_wspace(w, &w)) ||
+				    port > port_max) {
+					msg_err(0, "%s: line %d: can't parse 'sock_discover' directive", __FUNCTION__, line_number);
+					continue;
+				}
+				p = w;
+			}
+			/* optional process name */
+			if (*p) {
+				if (!parse_get_chset(p, &r, "^ \t",
+				    -PROCESS_NAME_MAXLEN) || *r) {
+					msg_err(0, "%s: line %d: can't parse 'sock_discover' directive", __FUNCTION__, line_number);
+					continue;
+				}
+				q = p;
+			}
+			/* check if too many sock_discover directives */
+			if (conf.socket_discover_count == SOCKET_DISCOVER_MAXN) {
+				msg_err(0, "%s: line %d: too many 'sock_discover' directives (maximum %d allowed)", __FUNCTION__, line_number, SOCKET_DISCOVER_MAXN);
+				continue;
+			}
+#ifndef __linux__
+			if (q) {
+				msg_err(0, "%s: line %d: process name in 'sock_discover' directive is supported only on Linux", __FUNCTION__, line_number);
+				continue;
+			}
+#endif
+
+			/* add line to socket discovery configuration */
+			sd = &conf.socket_discover[conf.socket_discover_count];
+			sd->type = f_unixsock;
+			sd->port_min = port;
+			sd->port_max = port_max;
+			sd->process[0] = 0;
+			if (q) {
+				strncpy(sd->process, q, r - q);
+				sd->process[r - q] = 0;
+			}
+			conf.socket_discover_count++;
 		} else if (parse_get_str(line, &p, "no_smart_enable")) {
 			if (!*p) {
 				conf.f_enable_smart = 0;
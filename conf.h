@@ -32,6 +32,18 @@
 /* Default working directory */
 #define DFL_WORKDIR		_PATH_VARTMP
 
+/* Default number of commands processed concurrently by one client process */
+#define DFL_CONCURRENCY		4
+
+/* Default number of samples in window of socket load average */
+#define DFL_SOCKET_WINDOW	300
+
+/* Default interval in milliseconds between samples of socket in burst */
+#define DFL_SOCKET_BURST_INTERVAL	50
+
+/* Default maximum number of discovered sockets */
+#define DFL_SOCKET_DISCOVER_MAX	256
+
 
 /* Structure for apache configuration */
 struct apache_conf {
@@ -85,6 +97,19 @@ struct socket_conf {
 		struct sockaddr_un sun;
 		struct sockaddr sa;
 	} sockaddr;
+	/* number of samples in window of load average and peak */
+	u_int window;
+};
+
+/* Structure for socket discovery configuration */
+struct socket_discover_conf {
+	/* type of discovered sockets, see socket_conf structure */
+	uint8_t type;
+	/* range of local ports in host byte order */
+	uint16_t port_min;
+	uint16_t port_max;
+	/* name of process owning sockets or empty string for any process */
+	char process[PROCESS_NAME_MAXLEN + 1];
 };
 
 /* Structure for exec configuration */
@@ -93,12 +118,37 @@ struct exec_conf {
 	char command[SHELL_COMMAND_MAXLEN + 1];
 };
 
+/* Structure for cache configuration */
+struct cache_conf {
+	/* cached command, see CMD_* constants in stats.h */
+	int cmd;
+	/* time in seconds during which snapshot of the command is used.
+	   Zero means that only concurrent collections are coalesced */
+	u_int ttl;
+};
+
+/* Structure for timeout configuration */
+struct timeout_conf {
+	/* command, see CMD_* constants in stats.h */
+	int cmd;
+	/* time in seconds available for processing of the command */
+	u_int timeout;
+};
+
 /* Structure for ussd configuration */
 struct conf {
 	/* This flag shows whether ussd will use hosts access control files
 	   when accepting incoming connections or not */
 	int f_hosts_access;
 
+	/* This flag shows whether ussd will serve clients inside the main
+	   process from the event loop (1) or fork for every connection (0) */
+	int f_event_loop;
+
+	/* Number of worker processes, each with its own listening socket.
+	   Zero means that main process accepts connections itself */
+	int workers;
+
 	/* This flag shows whether ussd will enable SMART capabilities
 	   on all HDDs while processing SMART command or not */
 	int f_enable_smart;
@@ -142,11 +192,35 @@ struct conf {
 	int exec_count;
 
 	/* Sockets configuration */
-	struct socket_conf socket_conf[SOCKET_MAXN];
-	/* Number of elements in %socket_conf% array */
+	struct socket_conf *socket_conf;
+	/* Number of used and allocated elements in %socket_conf% array */
 	int socket_count;
+	int socket_size;
 	/* Interval for socket LA polling (default to 1) */
 	int socket_interval;
+	/* Percents of queue limit which start burst of socket or 0 if bursts
+	   aren't watched, and interval in milliseconds between samples of
+	   sockets in burst */
+	int socket_burst;
+	int socket_burst_interval;
+	/* Socket discovery configuration and maximum number of discovered
+	   sockets */
+	struct socket_discover_conf socket_discover[SOCKET_DISCOVER_MAXN];
+	int socket_discover_count;
+	int socket_discover_max;
+
+	/* Cache configuration */
+	struct cache_conf cache_conf[CACHE_MAXN];
+	/* Number of elements in %cache_conf% array */
+	int cache_count;
+
+	/* Timeout configuration */
+	struct timeout_conf timeout_conf[TIMEOUT_MAXN];
+	/* Number of elements in %timeout_conf% array */
+	int timeout_count;
+
+	/* Number of commands processed concurrently by one client process */
+	int concurrency;
 
 	/* This flag shows whether ussd will calculate HDD's load averages */
 	int f_disable_hdds_la;
@@ -0,0 +1,174 @@
+/*
+ * Written by Vadim Guchenko <yhw@rambler-co.ru>
+ *
+ * 	$Id$
+ */
+
+#ifdef __linux__
+#include <sys/types.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "conf.h"
+#include "diskstats.h"
+
+
+/* Path of file with statistics of block devices */
+#define DISKSTATS_PATH		"/proc/diskstats"
+
+/* Initial size of buffer for /proc/diskstats */
+#define DISKSTATS_BUFSIZE	16384
+
+
+/* Descriptor of /proc/diskstats kept open between samples or -1 */
+int diskstats_fd = -1;
+
+/* Buffer for contents of /proc/diskstats */
+char *diskstats_buf = NULL;
+/* Size of allocated %diskstats_buf% */
+size_t diskstats_size = 0;
+
+/* The last disk found by diskstats_next() or NULL */
+const char *diskstats_disk = NULL;
+
+
+static int diskstats_is_partition(const char *, const char *);
+
+
+/*****************************************************************************
+ * Reads /proc/diskstats which is kept open between calls. If successful,
+ * returns pointer to the first line, the contents are null-terminated and
+ * valid until the next call. Otherwise returns NULL.
+ *****************************************************************************/
+char *diskstats_read() {
+	char *p;
+	size_t len;
+	ssize_t r;
+
+	if (diskstats_fd < 0 &&
+	    (diskstats_fd = open(DISKSTATS_PATH, O_RDONLY | O_CLOEXEC)) < 0) {
+		msg_syswarn("%s: open(%s)", __FUNCTION__, DISKSTATS_PATH);
+		return(NULL);
+	}
+
+	/* the whole file is usually read by one pread() */
+	len = 0;
+	for (;;) {
+		if (diskstats_size - len < 2) {
+			if ((p = realloc(diskstats_buf, diskstats_size ?
+			    diskstats_size * 2 : DISKSTATS_BUFSIZE)) == NULL) {
+				msg_syserr(0, "%s: realloc", __FUNCTION__);
+				return(NULL);
+			}
+			diskstats_buf = p;
+			diskstats_size = diskstats_size ? diskstats_size * 2 :
+			    DISKSTATS_BUFSIZE;
+		}
+		r = pread(diskstats_fd, diskstats_buf + len,
+		    diskstats_size - len - 1, len);
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			msg_syswarn("%s: pread(%s)", __FUNCTION__,
+			    DISKSTATS_PATH);
+			close(diskstats_fd);
+			diskstats_fd = -1;
+			return(NULL);
+		}
+		if (r == 0)
+			break;
+		len += r;
+	}
+	diskstats_buf[len] = 0;
+	diskstats_disk = NULL;
+	return(diskstats_buf);
+}
+
+/*****************************************************************************
+ * Parses the next line of contents of /proc/diskstats starting at *%p% and
+ * describes block device in %d%. Device name is null-terminated in place.
+ * If successful, moves *%p% to the next line and returns non-zero.
+ * Otherwise returns zero.
+ *
+ * Line format: "major minor name reads reads_merged read_sectors ...".
+ *****************************************************************************/
+int diskstats_next(char **p, struct diskstats_dev *d) {
+	char *s, *name, *name_end;
+	u_llong v;
+	int i;
+
+	for (s = *p; *s; ) {
+		/* skip major and minor numbers */
+		for (i = 0; i < 2; i++) {
+			while (*s == ' ')
+				s++;
+			while (*s >= '0' && *s <= '9')
+				s++;
+		}
+		while (*s == ' ')
+			s++;
+		name = s;
+		while (*s && *s != ' ' && *s != '\n')
+			s++;
+		name_end = s;
+
+		bzero(d->val, sizeof(d->val));
+		for (i = 0; *s == ' '; i++) {
+			while (*s == ' ')
+				s++;
+			for (v = 0; *s >= '0' && *s <= '9'; s++)
+				v = v * 10 + (*s - '0');
+			if (i < DISKSTATS_MAXN)
+				d->val[i] = v;
+		}
+		if (*s == '\n')
+			*s++ = 0;
+		else if (*s) {
+			/* unknown format, skip line */
+			s += strcspn(s, "\n");
+			continue;
+		}
+		if (i < DISKSTATS_MINN || name == name_end)
+			continue;
+
+		*name_end = 0;
+		d->name = name;
+		d->f_partition = diskstats_is_partition(diskstats_disk, name);
+		if (!d->f_partition)
+			diskstats_disk = name;
+		*p = s;
+		return(1);
+	}
+	*p = s;
+	return(0);
+}
+
+/*****************************************************************************
+ * Checks whether device %name% is partition of disk %disk%: partitions
+ * follow their disks and are named by disk name and number, with 'p'
+ * between them if disk name ends with digit. If so, returns non-zero.
+ * Otherwise returns zero.
+ *****************************************************************************/
+static int diskstats_is_partition(const char *disk, const char *name) {
+	size_t len;
+
+	if (disk == NULL)
+		return(0);
+	len = strlen(disk);
+	if (len == 0 || strncmp(disk, name, len))
+		return(0);
+	name += len;
+	if (disk[len - 1] >= '0' && disk[len - 1] <= '9' && *name++ != 'p')
+		return(0);
+	if (*name == 0)
+		return(0);
+	while (*name >= '0' && *name <= '9')
+		name++;
+	return(*name == 0);
+}
+#endif
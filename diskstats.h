@@ -0,0 +1,46 @@
+/*
+ * Written by Vadim Guchenko <yhw@rambler-co.ru>
+ *
+ * 	$Id$
+ */
+
+#ifdef __linux__
+/* Indexes of counters in /proc/diskstats line after device name */
+#define DISKSTATS_READS		0
+#define DISKSTATS_READS_MERGED	1
+#define DISKSTATS_READ_SECTORS	2
+#define DISKSTATS_READ_TICKS	3
+#define DISKSTATS_WRITES	4
+#define DISKSTATS_WRITES_MERGED	5
+#define DISKSTATS_WRITE_SECTORS	6
+#define DISKSTATS_WRITE_TICKS	7
+#define DISKSTATS_IN_FLIGHT	8
+#define DISKSTATS_IO_TICKS	9
+#define DISKSTATS_QUEUE_TICKS	10
+#define DISKSTATS_DISCARDS	11
+#define DISKSTATS_DISCARDS_MERGED	12
+#define DISKSTATS_DISCARD_SECTORS	13
+#define DISKSTATS_DISCARD_TICKS	14
+#define DISKSTATS_FLUSHES	15
+#define DISKSTATS_FLUSH_TICKS	16
+
+/* Number of counters which every kernel reports */
+#define DISKSTATS_MINN		11
+/* Maximum number of counters taken from line */
+#define DISKSTATS_MAXN		17
+
+
+/* Structure for block device found in /proc/diskstats */
+struct diskstats_dev {
+	/* device name, points into buffer of diskstats_read() */
+	char	*name;
+	/* this flag shows that device is partition of the previous disk */
+	int	f_partition;
+	/* counters, see DISKSTATS_* constants, missing ones are zero */
+	u_llong	val[DISKSTATS_MAXN];
+};
+
+
+char *diskstats_read(void);
+int diskstats_next(char **, struct diskstats_dev *);
+#endif
@@ -0,0 +1,151 @@
+/*
+ * Written by Vadim Guchenko <yhw@rambler-co.ru>
+ *
+ * 	$Id$
+ */
+
+#include <sys/types.h>
+#include <sys/time.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#else
+#include <sys/event.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "conf.h"
+#include "event.h"
+
+
+/* Descriptor of epoll(7) or kqueue(2) instance */
+static int event_fd = -1;
+
+
+/*****************************************************************************
+ * Creates event notification instance. Terminates the process on failure.
+ *****************************************************************************/
+void event_init() {
+	if (event_fd >= 0)
+		return;
+#ifdef __linux__
+	if ((event_fd = epoll_create(EVENT_MAXN)) < 0)
+		msg_syserr(1, "%s: epoll_create", __FUNCTION__);
+#else
+	if ((event_fd = kqueue()) < 0)
+		msg_syserr(1, "%s: kqueue", __FUNCTION__);
+#endif
+}
+
+/*****************************************************************************
+ * Closes event notification instance. Should be called by children which
+ * don't need parent's events.
+ *****************************************************************************/
+void event_close() {
+	if (event_fd < 0)
+		return;
+	close(event_fd);
+	event_fd = -1;
+}
+
+/*****************************************************************************
+ * Sets types of watched events of descriptor %fd% to %events%. %old_events%
+ * is the set of events watched before the call (zero for new descriptor).
+ * %data% is returned with every event of the descriptor. If successful,
+ * returns non-zero. Otherwise returns zero.
+ *****************************************************************************/
+int event_set(int fd, int old_events, int events, void *data) {
+#ifdef __linux__
+	struct epoll_event ev;
+	int op;
+
+	bzero(&ev, sizeof(ev));
+	ev.events = ((events & EVENT_READ) ? EPOLLIN : 0) |
+	    ((events & EVENT_WRITE) ? EPOLLOUT : 0);
+	ev.data.ptr = data;
+	op = old_events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+	if (epoll_ctl(event_fd, op, fd, &ev) < 0) {
+		msg_syserr(0, "%s: epoll_ctl(%d)", __FUNCTION__, fd);
+		return(0);
+	}
+#else
+	struct kevent kev[2];
+	int n;
+
+	n = 0;
+	if ((events & EVENT_READ) || (old_events & EVENT_READ))
+		EV_SET(&kev[n++], fd, EVFILT_READ,
+		    (events & EVENT_READ) ? EV_ADD : EV_DELETE, 0, 0, data);
+	if ((events & EVENT_WRITE) || (old_events & EVENT_WRITE))
+		EV_SET(&kev[n++], fd, EVFILT_WRITE,
+		    (events & EVENT_WRITE) ? EV_ADD : EV_DELETE, 0, 0, data);
+	if (n && kevent(event_fd, kev, n, NULL, 0, NULL) < 0) {
+		msg_syserr(0, "%s: kevent(%d)", __FUNCTION__, fd);
+		return(0);
+	}
+#endif
+	return(1);
+}
+
+/*****************************************************************************
+ * Stops watching descriptor %fd%. %old_events% is the set of events watched
+ * before the call. Must be called before the descriptor is closed.
+ *****************************************************************************/
+void event_del(int fd, int old_events) {
+#ifdef __linux__
+	struct epoll_event ev;
+
+	/* suppress compiler warning */
+	old_events = old_events;
+
+	epoll_ctl(event_fd, EPOLL_CTL_DEL, fd, &ev);
+#else
+	event_set(fd, old_events, 0, NULL);
+#endif
+}
+
+/*****************************************************************************
+ * Waits at most %timeout% milliseconds for events and stores at most %n%
+ * of them to array %evs%. Returns number of stored events, zero on timeout
+ * or -1 on error (errno is set).
+ *****************************************************************************/
+int event_wait(struct event *evs, int n, int timeout) {
+	int i, nready;
+#ifdef __linux__
+	struct epoll_event ev[EVENT_MAXN];
+
+	if (n > EVENT_MAXN)
+		n = EVENT_MAXN;
+	if ((nready = epoll_wait(event_fd, ev, n, timeout)) <= 0)
+		return(nready);
+	for (i = 0; i < nready; i++) {
+		evs[i].data = ev[i].data.ptr;
+		evs[i].events = 0;
+		/* errors and hang-ups are reported as readable descriptor, so
+		   consequent read(2) will discover them */
+		if (ev[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+			evs[i].events |= EVENT_READ;
+		if (ev[i].events & EPOLLOUT)
+			evs[i].events |= EVENT_WRITE;
+	}
+#else
+	struct kevent kev[EVENT_MAXN];
+	struct timespec ts;
+
+	if (n > EVENT_MAXN)
+		n = EVENT_MAXN;
+	ts.tv_sec = timeout / 1000;
+	ts.tv_nsec = (timeout % 1000) * 1000000;
+	if ((nready = kevent(event_fd, NULL, 0, kev, n, &ts)) <= 0)
+		return(nready);
+	for (i = 0; i < nready; i++) {
+		evs[i].data = kev[i].udata;
+		evs[i].events = (kev[i].filter == EVFILT_WRITE) ?
+		    EVENT_WRITE : EVENT_READ;
+	}
+#endif
+	return(nready);
+}
@@ -0,0 +1,28 @@
+/*
+ * Written by Vadim Guchenko <yhw@rambler-co.ru>
+ *
+ * 	$Id$
+ */
+
+/* Event types */
+#define EVENT_READ		0x01
+#define EVENT_WRITE		0x02
+
+/* Maximum number of events returned by one event_wait() call */
+#define EVENT_MAXN		64
+
+
+/* Structure for ready descriptor */
+struct event {
+	/* types of happened events */
+	int	events;
+	/* user data given to event_set() */
+	void	*data;
+};
+
+
+void event_init(void);
+void event_close(void);
+int event_set(int, int, int, void *);
+void event_del(int, int);
+int event_wait(struct event *, int, int);
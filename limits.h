@@ -32,8 +32,14 @@
 /* Maximum length of shell command not including null */
 #define SHELL_COMMAND_MAXLEN	511
 
-/* Maximum number of interfaces */
-#define IFACE_MAXN		32
+/* Maximum length of command name not including null */
+#define CMD_NAME_MAXLEN		31
+
+/* Maximum interval in seconds of SUBSCRIBE command */
+#define SUBSCRIBE_INTERVAL_MAX	3600
+
+/* Maximum number of worker processes */
+#define WORKER_MAXN		64
 
 /* Maximum number of ACPI thermal zones */
 #define ACPI_TZ_MAXN		8
@@ -59,6 +65,36 @@
 /* Maximum number of 'exec' directives in config file */
 #define EXEC_MAXN		16
 
-/* Maximum number of 'socket' directives in config file */
-#define SOCKET_MAXN		64
+/* Maximum number of 'cache' directives in config file */
+#define CACHE_MAXN		32
+
+/* Maximum TTL in seconds of 'cache' directive */
+#define CACHE_TTL_MAX		86400
+
+/* Maximum number of 'timeout' directives in config file */
+#define TIMEOUT_MAXN		32
+
+/* Maximum number of commands processed concurrently by one client process */
+#define CONCURRENCY_MAX		16
+
+/* Maximum number of samples in window of socket load average */
+#define SOCKET_WINDOW_MAX	86400
+
+/* Minimum and maximum interval in milliseconds between samples of socket
+   in burst */
+#define SOCKET_BURST_INTERVAL_MIN	10
+#define SOCKET_BURST_INTERVAL_MAX	1000
+
+/* Maximum number of socket discovery definitions */
+#define SOCKET_DISCOVER_MAXN	16
+
+/* Maximum number of discovered sockets */
+#define SOCKET_DISCOVER_MAX	65536
+
+/* Size in bytes of memory for counters passed by sampler process to
+   workers, pages are allocated only when used */
+#define STATS_SHARED_SIZE	(16 * 1024 * 1024)
+
+/* Maximum length of process name not including null */
+#define PROCESS_NAME_MAXLEN	15
 
@@ -0,0 +1,560 @@
+/*
+ * Written by Vadim Guchenko <yhw@rambler-co.ru>
+ *
+ * 	$Id$
+ */
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "conf.h"
+#include "output.h"
+
+
+/* Minimum size of allocated output buffer */
+#define OUTBUF_MINSIZE		4096
+
+/* Length of buffered response which is written without waiting for the end
+   of command */
+#define OUT_WATERMARK		65536
+
+/* Initial number of hash chains of interned keys, the table is doubled
+   whenever keys outnumber chains */
+#define OUT_KEY_HASH_MINSIZE	256
+
+/* Maximum number of interned keys, further keys are rendered every time */
+#define OUT_KEY_MAXN		65536
+
+/* Interned key which isn't used for this number of seconds is freed */
+#define OUT_KEY_IDLE		3600
+
+/* Maximum precision of out_double() */
+#define OUT_DOUBLE_PREC_MAX	9
+
+
+/* Current output buffer */
+struct outbuf *out_buf = NULL;
+
+/* Response of client process written to %out_fd% by out_flush() */
+struct outbuf out_resp;
+
+/* Descriptor the response is written to or -1 */
+int out_fd = -1;
+
+/* Data which should be written before the response */
+const char *out_prefix = NULL;
+size_t out_prefix_len = 0;
+
+/* Number of bytes and system calls used to write the response */
+u_long out_bytes = 0;
+u_long out_syscalls = 0;
+
+/* This flag shows whether out_flush() is registered by atexit(3) */
+int f_out_atexit = 0;
+
+/* Hash table of interned keys, its size (power of 2) and number of keys */
+struct out_key **out_keys = NULL;
+u_int out_keys_size = 0;
+int out_keys_count = 0;
+
+/* Generation of expiry of interned keys and time when it started */
+u_long out_keys_gen = 0;
+time_t out_keys_gen_tm = 0;
+
+/* Key which isn't interned, valid until the next call of out_key() */
+struct out_key *out_key_tmp = NULL;
+size_t out_key_tmp_size = 0;
+
+/* Time of the last output line and its rendering followed by space */
+time_t out_last_tm = -1;
+char out_last_tm_str[24];
+size_t out_last_tm_len = 0;
+
+/* Pairs of decimal digits for fast conversion of integers */
+static const char out_digits[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+/* Powers of 10 used by out_double() */
+static const u_llong out_pow10[OUT_DOUBLE_PREC_MAX + 1] = {
+	1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL,
+	10000000ULL, 100000000ULL, 1000000000ULL
+};
+
+
+static void out_write(const char *, size_t);
+static char *out_fmt_u64(char *, u_llong);
+static void out_line(time_t, const struct out_key *, const char *, size_t);
+static int out_key_grow(void);
+
+
+/*****************************************************************************
+ * Appends %len% bytes from %data% to output buffer %ob%. If successful,
+ * returns non-zero. Otherwise returns zero.
+ *****************************************************************************/
+int outbuf_append(struct outbuf *ob, const char *data, size_t len) {
+	size_t size;
+	char *buf;
+
+	if (ob->len + len > ob->size) {
+		size = ob->size ? ob->size : OUTBUF_MINSIZE;
+		while (size < ob->len + len)
+			size *= 2;
+		if ((buf = realloc(ob->buf, size)) == NULL) {
+			msg_syserr(0, "%s: realloc(%lu)", __FUNCTION__, (u_long)size);
+			return(0);
+		}
+		ob->buf = buf;
+		ob->size = size;
+	}
+	memcpy(ob->buf + ob->len, data, len);
+	ob->len += len;
+	return(1);
+}
+
+/*****************************************************************************
+ * Frees memory allocated for output buffer %ob%.
+ *****************************************************************************/
+void outbuf_free(struct outbuf *ob) {
+	free(ob->buf);
+	ob->buf = NULL;
+	ob->len = 0;
+	ob->size = 0;
+}
+
+/*****************************************************************************
+ * Makes all further output of client process to be collected in the response
+ * buffer and written to descriptor %fd% by out_flush(). %prefix% of length
+ * %prefix_len% is written before the response.
+ *****************************************************************************/
+void out_open(int fd, const char *prefix, size_t prefix_len) {
+	out_fd = fd;
+	out_prefix = prefix;
+	out_prefix_len = prefix_len;
+	out_resp.len = 0;
+	out_bytes = out_syscalls = 0;
+	out_buf = &out_resp;
+
+	/* the rest of response is written when process exits */
+	if (!f_out_atexit && atexit(out_flush) == 0)
+		f_out_atexit = 1;
+}
+
+/*****************************************************************************
+ * Writes buffered response together with its prefix by writev(2). Nothing
+ * is done if the current output buffer isn't the response buffer.
+ *****************************************************************************/
+void out_flush() {
+	struct iovec iov[2], *v;
+	int iovcnt;
+	ssize_t n;
+
+	if (out_fd < 0 || out_buf != &out_resp)
+		return;
+
+	iovcnt = 0;
+	if (out_prefix_len) {
+		iov[iovcnt].iov_base = (void *)out_prefix;
+		iov[iovcnt++].iov_len = out_prefix_len;
+	}
+	if (out_resp.len) {
+		iov[iovcnt].iov_base = out_resp.buf;
+		iov[iovcnt++].iov_len = out_resp.len;
+	}
+
+	v = iov;
+	while (iovcnt) {
+		n = writev(out_fd, v, iovcnt);
+		out_syscalls++;
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			/* client is gone, so there is nobody to report to */
+			break;
+		}
+		out_bytes += n;
+		/* skip written data */
+		while (iovcnt && (size_t)n >= v->iov_len) {
+			n -= v->iov_len;
+			v++;
+			iovcnt--;
+		}
+		if (iovcnt) {
+			v->iov_base = (char *)v->iov_base + n;
+			v->iov_len -= n;
+		}
+	}
+
+	out_prefix_len = 0;
+	out_resp.len = 0;
+}
+
+/*****************************************************************************
+ * Prepares response buffer for just forked child of client process: the
+ * response collected by the parent mustn't be written twice.
+ *****************************************************************************/
+void out_child() {
+	out_prefix_len = 0;
+	out_resp.len = 0;
+	out_bytes = out_syscalls = 0;
+}
+
+/*****************************************************************************
+ * Reports on debug level 1 how many bytes and system calls were used to
+ * write the response since the last report.
+ *****************************************************************************/
+void out_report() {
+	if (out_fd < 0 || out_buf != &out_resp)
+		return;
+	msg_debug(1, "Response written: %lu bytes, %lu system calls",
+	    out_bytes, out_syscalls);
+	out_bytes = out_syscalls = 0;
+}
+
+/*****************************************************************************
+ * Writes %len% bytes from %data% to the current output buffer %out_buf% or
+ * to stdout if there is no current output buffer.
+ *****************************************************************************/
+static void out_write(const char *data, size_t len) {
+	if (out_buf == NULL)
+		fwrite(data, 1, len, stdout);
+	else
+		outbuf_append(out_buf, data, len);
+}
+
+/*****************************************************************************
+ * Renders %n% in decimal so that the last digit is placed just before %end%.
+ * Returns pointer to the first digit.
+ *****************************************************************************/
+static char *out_fmt_u64(char *end, u_llong n) {
+	const char *d;
+
+	while (n >= 100) {
+		d = out_digits + (n % 100) * 2;
+		n /= 100;
+		*--end = d[1];
+		*--end = d[0];
+	}
+	if (n >= 10) {
+		d = out_digits + n * 2;
+		*--end = d[1];
+		*--end = d[0];
+	} else {
+		*--end = '0' + n;
+	}
+	return(end);
+}
+
+/*****************************************************************************
+ * Writes %len% bytes of already rendered output lines from %data%.
+ *****************************************************************************/
+void out_data(const char *data, size_t len) {
+	out_write(data, len);
+	if (out_buf && out_buf->len >= OUT_WATERMARK)
+		out_flush();
+}
+
+/*****************************************************************************
+ * Writes output line "<tm> <key> <value>" where %value% of length %len% is
+ * already rendered.
+ *****************************************************************************/
+static void out_line(time_t tm, const struct out_key *key, const char *value,
+    size_t len) {
+	char *p;
+
+	/* all lines of a command usually have the same time */
+	if (tm != out_last_tm) {
+		out_last_tm_str[sizeof(out_last_tm_str) - 1] = ' ';
+		p = out_fmt_u64(out_last_tm_str + sizeof(out_last_tm_str) - 1,
+		    (u_long)tm);
+		out_last_tm_len = out_last_tm_str + sizeof(out_last_tm_str) - p;
+		memmove(out_last_tm_str, p, out_last_tm_len);
+		out_last_tm = tm;
+	}
+	out_write(out_last_tm_str, out_last_tm_len);
+	out_write(key->str, key->len);
+	out_write(value, len);
+	if (out_buf && out_buf->len >= OUT_WATERMARK)
+		out_flush();
+}
+
+/*****************************************************************************
+ * Returns interned key "<name>:<instance>" of output line. The key is
+ * rendered only once and the same pointer is returned for the same %name%
+ * and %inst% later. If %inst% is NULL, the key consists of %name% only.
+ * Instances come and go (e.g. discovered sockets), so keys unused for a long
+ * time are freed by out_key_expire(), and after %OUT_KEY_MAXN% keys new ones
+ * aren't interned and stay valid only until the next call. If memory can't
+ * be allocated, returns NULL.
+ *****************************************************************************/
+const struct out_key *out_key(const char *name, const char *inst) {
+	struct out_key *key;
+	size_t name_len, inst_len, len;
+	const char *p;
+	u_int h;
+
+	/* FNV-1a hash of name and instance */
+	h = 2166136261U;
+	for (p = name; *p; p++)
+		h = (h ^ (u_char)*p) * 16777619U;
+	name_len = p - name;
+	inst_len = 0;
+	if (inst) {
+		for (p = inst; *p; p++)
+			h = (h ^ (u_char)*p) * 16777619U;
+		inst_len = p - inst;
+	}
+	len = name_len + (inst ? 1 + inst_len : 0) + 1;
+
+	if (out_keys_size)
+		for (key = out_keys[h & (out_keys_size - 1)]; key;
+		    key = key->next)
+			if (key->hash == h && key->len == len &&
+			    !memcmp(key->str, name, name_len) &&
+			    (!inst || (key->str[name_len] == ':' &&
+			    !memcmp(key->str + name_len + 1, inst, inst_len)))) {
+				key->gen = out_keys_gen;
+				return(key);
+			}
+
+	if (out_keys_count == OUT_KEY_MAXN || !out_key_grow()) {
+		if (len > out_key_tmp_size) {
+			if ((key = realloc(out_key_tmp, sizeof(*key) + len)) ==
+			    NULL) {
+				msg_syserr(0, "%s: realloc", __FUNCTION__);
+				return(NULL);
+			}
+			out_key_tmp = key;
+			out_key_tmp_size = len;
+		}
+		key = out_key_tmp;
+	} else if ((key = malloc(sizeof(*key) + len)) == NULL) {
+		msg_syserr(0, "%s: malloc", __FUNCTION__);
+		return(NULL);
+	}
+	key->str = (char *)(key + 1);
+	key->len = len;
+	key->hash = h;
+	key->gen = out_keys_gen;
+	memcpy(key->str, name, name_len);
+	if (inst) {
+		key->str[name_len] = ':';
+		memcpy(key->str + name_len + 1, inst, inst_len);
+	}
+	key->str[len - 1] = ' ';
+	if (key == out_key_tmp)
+		return(key);
+	key->next = out_keys[h & (out_keys_size - 1)];
+	out_keys[h & (out_keys_size - 1)] = key;
+	out_keys_count++;
+	return(key);
+}
+
+/*****************************************************************************
+ * Makes hash table of interned keys big enough for one more key. If
+ * successful, returns non-zero. Otherwise returns zero.
+ *****************************************************************************/
+static int out_key_grow() {
+	struct out_key **keys, *key, *next;
+	u_int size, i;
+
+	if ((u_int)out_keys_count < out_keys_size)
+		return(1);
+	size = out_keys_size ? out_keys_size * 2 : OUT_KEY_HASH_MINSIZE;
+	if ((keys = calloc(size, sizeof(*keys))) == NULL) {
+		msg_syserr(0, "%s: calloc", __FUNCTION__);
+		return(0);
+	}
+	for (i = 0; i < out_keys_size; i++)
+		for (key = out_keys[i]; key; key = next) {
+			next = key->next;
+			key->next = keys[key->hash & (size - 1)];
+			keys[key->hash & (size - 1)] = key;
+		}
+	free(out_keys);
+	out_keys = keys;
+	out_keys_size = size;
+	return(1);
+}
+
+/*****************************************************************************
+ * Frees interned keys which weren't used for %OUT_KEY_IDLE% seconds or more,
+ * e.g. keys of sockets and disks which are gone. Called by the main process
+ * between rounds of the event loop, when nobody holds a key.
+ *****************************************************************************/
+void out_key_expire() {
+	struct out_key **pp, *key;
+	time_t tm;
+	u_int i;
+
+	tm = time(NULL);
+	if (tm >= out_keys_gen_tm && tm - out_keys_gen_tm < OUT_KEY_IDLE)
+		return;
+	for (i = 0; i < out_keys_size; i++)
+		for (pp = &out_keys[i]; (key = *pp); ) {
+			if (key->gen != out_keys_gen) {
+				*pp = key->next;
+				free(key);
+				out_keys_count--;
+			} else
+				pp = &key->next;
+		}
+	out_keys_gen++;
+	out_keys_gen_tm = tm;
+}
+
+/*****************************************************************************
+ * Writes output line with key %key% and unsigned integer value %n% for time
+ * %tm%.
+ *****************************************************************************/
+void out_u64(time_t tm, const struct out_key *key, u_llong n) {
+	char buf[24], *p;
+
+	if (key == NULL)
+		return;
+	buf[sizeof(buf) - 1] = '\n';
+	p = out_fmt_u64(buf + sizeof(buf) - 1, n);
+	out_line(tm, key, p, buf + sizeof(buf) - p);
+}
+
+/*****************************************************************************
+ * Writes output line with key %key% and signed integer value %n% for time
+ * %tm%.
+ *****************************************************************************/
+void out_i64(time_t tm, const struct out_key *key, llong n) {
+	char buf[24], *p;
+
+	if (key == NULL)
+		return;
+	buf[sizeof(buf) - 1] = '\n';
+	p = out_fmt_u64(buf + sizeof(buf) - 1,
+	    n < 0 ? -(u_llong)n : (u_llong)n);
+	if (n < 0)
+		*--p = '-';
+	out_line(tm, key, p, buf + sizeof(buf) - p);
+}
+
+/*****************************************************************************
+ * Writes output line with key %key% and value %d% rendered with %prec%
+ * digits after the decimal point like "%.*f" format of printf(3) does.
+ *****************************************************************************/
+void out_double(time_t tm, const struct out_key *key, double d, u_int prec) {
+	char buf[32], *p;
+	u_llong n, frac;
+	double x, r;
+	int f_neg, f_fast;
+
+	if (key == NULL)
+		return;
+
+	/* values which don't fit into 64-bit integer after scaling, NaN and
+	   infinity are rendered by printf(3). Scaling isn't exact, so values
+	   which are close to the middle between two rendered ones are left to
+	   printf(3) too */
+	f_fast = prec <= OUT_DOUBLE_PREC_MAX && d > -1e18 && d < 1e18;
+	if (f_fast) {
+		x = (d < 0 ? -d : d) * out_pow10[prec];
+		f_fast = x < 1.8e19;
+	}
+	if (f_fast) {
+		n = (u_llong)x;
+		r = x - n - 0.5;
+		f_fast = (r < 0 ? -r : r) >= 1e-6 + x * 1e-15;
+	}
+	if (!f_fast) {
+		out_printf("%lu %.*s%.*f\n", (u_long)tm, (int)key->len, key->str,
+		    (int)prec, d);
+		return;
+	}
+
+	/* round to nearest */
+	if (r > 0)
+		n++;
+	f_neg = d < 0;
+
+	buf[sizeof(buf) - 1] = '\n';
+	p = buf + sizeof(buf) - 1;
+	if (prec) {
+		frac = n % out_pow10[prec];
+		n /= out_pow10[prec];
+		/* leading zeros of fractional part */
+		p = out_fmt_u64(p, frac);
+		while (p > buf + sizeof(buf) - 1 - prec)
+			*--p = '0';
+		*--p = '.';
+	}
+	p = out_fmt_u64(p, n);
+	if (f_neg)
+		*--p = '-';
+	out_line(tm, key, p, buf + sizeof(buf) - p);
+}
+
+/*****************************************************************************
+ * Formats output line like printf(3) does and appends it to the current
+ * output buffer %out_buf%. If there is no current output buffer, line is
+ * written to stdout.
+ *****************************************************************************/
+void out_printf(const char *fmt, ...) {
+	va_list ap;
+	char line[INPUT_LINE_MAXLEN + 1], *p;
+	int len;
+
+	va_start(ap, fmt);
+	if (out_buf == NULL) {
+		vprintf(fmt, ap);
+		va_end(ap);
+		return;
+	}
+	len = vsnprintf(line, sizeof(line), fmt, ap);
+	va_end(ap);
+	if (len < 0)
+		return;
+	if ((size_t)len < sizeof(line)) {
+		outbuf_append(out_buf, line, len);
+		if (out_buf->len >= OUT_WATERMARK)
+			out_flush();
+		return;
+	}
+
+	/* line doesn't fit into the stack buffer */
+	if ((p = malloc(len + 1)) == NULL) {
+		msg_syserr(0, "%s: malloc(%d)", __FUNCTION__, len + 1);
+		return;
+	}
+	va_start(ap, fmt);
+	vsnprintf(p, len + 1, fmt, ap);
+	va_end(ap);
+	outbuf_append(out_buf, p, len);
+	free(p);
+	if (out_buf->len >= OUT_WATERMARK)
+		out_flush();
+}
+
+/*****************************************************************************
+ * Reports error to the client. If there is current output buffer, error
+ * message is appended to it and written to syslog on debug level 1.
+ * Otherwise the message is issued by msg_err().
+ *****************************************************************************/
+void out_error(const char *fmt, ...) {
+	va_list ap;
+	char line[INPUT_LINE_MAXLEN + 1];
+
+	va_start(ap, fmt);
+	vsnprintf(line, sizeof(line), fmt, ap);
+	va_end(ap);
+
+	if (out_buf == NULL) {
+		msg_err(0, "%s", line);
+		return;
+	}
+	out_printf("%s: %s\n", msg_err_prefix, line);
+	msg_debug(1, "%s", line);
+}
@@ -0,0 +1,56 @@
+/*
+ * Written by Vadim Guchenko <yhw@rambler-co.ru>
+ *
+ * 	$Id$
+ */
+
+#include <sys/types.h>
+#include <time.h>
+
+#include "vg_lib/vg_types.h"
+
+
+/* Structure for output buffer of client connection or response */
+struct outbuf {
+	/* buffered data */
+	char	*buf;
+	/* length of buffered data */
+	size_t	len;
+	/* size of allocated buffer */
+	size_t	size;
+};
+
+
+/* Structure for interned key "<name>:<instance>" of output line */
+struct out_key {
+	/* rendered key followed by space */
+	char	*str;
+	/* length of rendered key */
+	size_t	len;
+	/* hash of name and instance */
+	u_int	hash;
+	/* generation of expiry when key was used last time */
+	u_long	gen;
+	/* next key in hash chain */
+	struct out_key *next;
+};
+
+
+/* Current output buffer. Value NULL means that output goes to stdout */
+extern struct outbuf *out_buf;
+
+
+int outbuf_append(struct outbuf *, const char *, size_t);
+void outbuf_free(struct outbuf *);
+void out_open(int, const char *, size_t);
+void out_flush(void);
+void out_child(void);
+void out_report(void);
+void out_data(const char *, size_t);
+const struct out_key *out_key(const char *, const char *);
+void out_key_expire(void);
+void out_u64(time_t, const struct out_key *, u_llong);
+void out_i64(time_t, const struct out_key *, llong);
+void out_double(time_t, const struct out_key *, double, u_int);
+void out_printf(const char *, ...) __attribute__ ((format (printf, 1, 2)));
+void out_error(const char *, ...) __attribute__ ((format (printf, 1, 2)));
@@ -0,0 +1,278 @@
+/*
+ * Written by Vadim Guchenko <yhw@rambler-co.ru>
+ *
+ * 	$Id$
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <paths.h>
+#include <poll.h>
+#include <errno.h>
+
+#include "conf.h"
+#include "stats.h"
+#include "output.h"
+#include "pool.h"
+
+
+/* Structure for command processed by worker of the pool */
+struct pool_job {
+	/* command, see CMD_* constants in stats.h */
+	int	cmd;
+	/* process ID of worker */
+	pid_t	pid;
+	/* read end of pipe connected to stdout of worker */
+	int	fd;
+	/* time when worker was started */
+	time_t	start_tm;
+	/* time when worker is killed if it doesn't complete */
+	time_t	deadline;
+	/* output of worker */
+	struct outbuf out;
+};
+
+
+static int pool_start(struct pool_job *, struct request *, int,
+    const struct pool_job *, int, time_t);
+static int pool_read(struct pool_job *);
+static void pool_finish(struct pool_job *, int);
+static void pool_report_timeout(int, time_t);
+
+
+/*****************************************************************************
+ * Returns time in seconds available for command %cmd% processed by worker.
+ *****************************************************************************/
+u_int pool_timeout(int cmd) {
+	int i;
+
+	for (i = 0; i < conf.timeout_count; i++)
+		if (conf.timeout_conf[i].cmd == cmd)
+			return(conf.timeout_conf[i].timeout);
+	return(CHILD_TIMEOUT);
+}
+
+/*****************************************************************************
+ * Processes commands of client request %req% which can't be processed inside
+ * the main process. Commands are processed concurrently by up to
+ * %conf.concurrency% workers, each command by its own worker. Output of every
+ * command is written as soon as the command completes. Command which doesn't
+ * complete in time is killed and timeout marker is written instead of the
+ * rest of its output.
+ *****************************************************************************/
+void pool_run(struct request *req) {
+	struct pool_job jobs[CONCURRENCY_MAX];
+	struct pollfd pfds[CONCURRENCY_MAX];
+	int queue[CMD_MAXN], qhead, qlen, njobs, i, timeout;
+	time_t tm, deadline, batch_deadline;
+
+	/* commands are started in order of their processing, so commands
+	   which sometimes hang are started last */
+	qlen = 0;
+	for (i = 0; i < CMD_MAXN; i++)
+		if (req->f_cmd[i] && !(commands[i].flags & CMD_F_INLINE))
+			queue[qlen++] = i;
+	if (qlen == 0)
+		return;
+
+	/* nothing may be left running when the client process is killed */
+	batch_deadline = time(NULL) + CLIENT_TIMEOUT - POOL_DEADLINE_MARGIN;
+
+	njobs = 0;
+	qhead = 0;
+	for (;;) {
+		/* start queued commands while there are free workers */
+		tm = time(NULL);
+		while (njobs < conf.concurrency && qhead < qlen &&
+		    tm < batch_deadline) {
+			if (pool_start(&jobs[njobs], req, queue[qhead], jobs,
+			    njobs, batch_deadline))
+				njobs++;
+			qhead++;
+		}
+		if (njobs == 0)
+			break;
+
+		deadline = jobs[0].deadline;
+		for (i = 0; i < njobs; i++) {
+			if (jobs[i].deadline < deadline)
+				deadline = jobs[i].deadline;
+			pfds[i].fd = jobs[i].fd;
+			pfds[i].events = POLLIN;
+			pfds[i].revents = 0;
+		}
+		timeout = (deadline > tm) ? (deadline - tm) * 1000 : 0;
+		if (poll(pfds, njobs, timeout) < 0 && errno != EINTR)
+			msg_syserr(1, "%s: poll", __FUNCTION__);
+
+		tm = time(NULL);
+		for (i = 0; i < njobs; ) {
+			if (pfds[i].revents && !pool_read(&jobs[i]))
+				pool_finish(&jobs[i], 0);
+			else if (tm >= jobs[i].deadline)
+				pool_finish(&jobs[i], 1);
+			else {
+				i++;
+				continue;
+			}
+			/* keep running jobs and their descriptors together */
+			njobs--;
+			jobs[i] = jobs[njobs];
+			pfds[i] = pfds[njobs];
+		}
+	}
+
+	/* commands which couldn't be started before the deadline */
+	for (; qhead < qlen; qhead++) {
+		msg_debug(1, "Processing of %s command skipped: no time left",
+		    commands[queue[qhead]].name);
+		pool_report_timeout(queue[qhead], 0);
+	}
+}
+
+/*****************************************************************************
+ * Starts worker processing command %cmd% of client request %req% and
+ * describes it in %job%. %jobs% are %njobs% already running workers.
+ * Worker is killed at %batch_deadline% at the latest. If successful,
+ * returns non-zero. Otherwise returns zero.
+ *****************************************************************************/
+static int pool_start(struct pool_job *job, struct request *req, int cmd,
+    const struct pool_job *jobs, int njobs, time_t batch_deadline) {
+	time_t tm;
+	u_int timeout;
+	int pfd[2], fd, i;
+	pid_t pid;
+
+	timeout = pool_timeout(cmd);
+	tm = get_remote_tm();
+
+	if (pipe(pfd) < 0) {
+		msg_syserr(0, "%s: pipe", __FUNCTION__);
+		pool_report_timeout(cmd, 0);
+		return(0);
+	}
+	if ((pid = fork()) == 0) { /* child */
+		close(pfd[0]);
+		for (i = 0; i < njobs; i++)
+			close(jobs[i].fd);
+		/* own process group, so worker is killed with its children */
+		setpgid(0, getpid());
+		/* neither worker nor its children may hold the client
+		   connection, messages are sent together with the output */
+		if ((fd = open(_PATH_DEVNULL, O_RDONLY)) >= 0) {
+			dup2(fd, 0);
+			close(fd);
+		}
+		dup2(pfd[1], 1);
+		dup2(pfd[1], 2);
+		close(pfd[1]);
+		out_open(1, NULL, 0);
+		alarm(timeout);
+		init_remote_tm(tm);
+		req_run_cmd(req, cmd);
+		out_flush();
+		wait_for_children();
+		exit(EXIT_SUCCESS);
+	} else if (pid < 0) {
+		msg_syserr(0, "%s: can't fork", __FUNCTION__);
+		close(pfd[0]);
+		close(pfd[1]);
+		pool_report_timeout(cmd, 0);
+		return(0);
+	}
+
+	/* parent */
+	setpgid(pid, pid);
+	close(pfd[1]);
+	bzero(job, sizeof(*job));
+	job->cmd = cmd;
+	job->pid = pid;
+	job->fd = pfd[0];
+	job->start_tm = time(NULL);
+	job->deadline = job->start_tm + timeout;
+	if (job->deadline > batch_deadline)
+		job->deadline = batch_deadline;
+	msg_debug(1, "Processing of %s command started by worker %d",
+	    commands[cmd].name, (int)pid);
+	return(1);
+}
+
+/*****************************************************************************
+ * Reads available output of worker %job%. Returns zero if worker closed its
+ * output, so the command is completed. Otherwise returns non-zero.
+ *****************************************************************************/
+static int pool_read(struct pool_job *job) {
+	char buf[16384];
+	ssize_t n;
+
+	n = read(job->fd, buf, sizeof(buf));
+	if (n < 0) {
+		if (errno == EINTR || errno == EAGAIN)
+			return(1);
+		msg_syswarn("%s: read", __FUNCTION__);
+		return(0);
+	}
+	if (n == 0)
+		return(0);
+	return(outbuf_append(&job->out, buf, n));
+}
+
+/*****************************************************************************
+ * Writes output of worker %job% to the response and waits for the worker to
+ * terminate. If %f_timeout% is non-zero, the worker is killed first. Output
+ * of worker which was killed is cut to complete lines and followed by
+ * timeout marker.
+ *****************************************************************************/
+static void pool_finish(struct pool_job *job, int f_timeout) {
+	char *p;
+	int status;
+
+	close(job->fd);
+	if (f_timeout) {
+		kill(-job->pid, SIGKILL);
+		kill(job->pid, SIGKILL);
+	}
+	status = 0;
+	while (waitpid(job->pid, &status, 0) < 0)
+		if (errno != EINTR) {
+			msg_syswarn("%s: waitpid", __FUNCTION__);
+			break;
+		}
+	/* worker could be killed by its own alarm */
+	if (WIFSIGNALED(status))
+		f_timeout = 1;
+
+	if (f_timeout) {
+		for (p = job->out.buf + job->out.len;
+		    p > job->out.buf && p[-1] != '\n'; p--)
+			;
+		job->out.len = p - job->out.buf;
+	}
+	out_data(job->out.buf, job->out.len);
+	if (f_timeout) {
+		msg_debug(1, "Processing of %s command timed out",
+		    commands[job->cmd].name);
+		pool_report_timeout(job->cmd, time(NULL) - job->start_tm);
+	}
+	out_flush();
+	outbuf_free(&job->out);
+}
+
+/*****************************************************************************
+ * Writes timeout marker of command %cmd% which was processed for %elapsed%
+ * seconds.
+ *****************************************************************************/
+static void pool_report_timeout(int cmd, time_t elapsed) {
+	char name[CMD_NAME_MAXLEN + 1];
+
+	command_name(cmd, name, sizeof(name));
+	out_u64(get_remote_tm(), out_key("timeout", name), elapsed);
+}
@@ -0,0 +1,13 @@
+/*
+ * Written by Vadim Guchenko <yhw@rambler-co.ru>
+ *
+ * 	$Id$
+ */
+
+/* Time in seconds reserved at the end of CLIENT_TIMEOUT for reporting of
+   commands which didn't complete */
+#define POOL_DEADLINE_MARGIN	2
+
+
+u_int pool_timeout(int);
+void pool_run(struct request *);
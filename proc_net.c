@@ -0,0 +1,343 @@
+/*
+ * Written by Vadim Guchenko <yhw@rambler-co.ru>
+ *
+ * 	$Id$
+ */
+
+#ifdef __linux__
+#include <sys/types.h>
+
+#include <dirent.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "conf.h"
+#include "proc_net.h"
+
+
+/* Initial size of buffer for /proc/net file */
+#define PROC_NET_BUFSIZE	65536
+
+/* State of listening TCP socket and of bound UDP socket */
+#define PROC_NET_TCP_LISTEN	10
+#define PROC_NET_UDP_CLOSE	7
+
+/* Flag of listening unix domain socket (__SO_ACCEPTCON) */
+#define PROC_NET_UNIX_ACCEPTCON	0x10000
+
+
+/* Descriptors of /proc/net files kept open between samples or -1 */
+int proc_net_fd[PROC_NET_MAXN] = { -1, -1, -1, -1, -1 };
+
+/* Buffer for contents of the last read /proc/net file */
+char *proc_net_buf = NULL;
+/* Size of allocated %proc_net_buf% */
+size_t proc_net_size = 0;
+
+/* Values of hex digits plus one, zero for other characters */
+const u_char proc_net_hexval[256] = {
+	['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5,
+	['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+	['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16,
+	['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16,
+};
+
+
+static int proc_net_inet(char *, int, struct proc_net_sock *);
+static int proc_net_unix(char *, char *, struct proc_net_sock *);
+static int proc_net_hex(char **, u_int *);
+static int proc_net_dec(char **, u_int *);
+static int proc_net_owner_cmp(const void *, const void *);
+static char *proc_net_skip(char *);
+
+
+/*****************************************************************************
+ * Reads /proc/net file %path% which is kept open in slot %n% between calls.
+ * If successful, returns pointer to the first line after the header, the
+ * contents are null-terminated and valid until the next call. Otherwise
+ * returns NULL.
+ *****************************************************************************/
+char *proc_net_read(int n, const char *path) {
+	char *p;
+	size_t len;
+	ssize_t r;
+
+	if (proc_net_fd[n] < 0 &&
+	    (proc_net_fd[n] = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+		msg_syswarn("%s: open(%s)", __FUNCTION__, path);
+		return(NULL);
+	}
+
+	/* pread() at offset 0 makes the kernel generate contents again */
+	len = 0;
+	for (;;) {
+		if (proc_net_size - len < 2) {
+			if ((p = realloc(proc_net_buf, proc_net_size ?
+			    proc_net_size * 2 : PROC_NET_BUFSIZE)) == NULL) {
+				msg_syserr(0, "%s: realloc", __FUNCTION__);
+				return(NULL);
+			}
+			proc_net_buf = p;
+			proc_net_size = proc_net_size ? proc_net_size * 2 :
+			    PROC_NET_BUFSIZE;
+		}
+		r = pread(proc_net_fd[n], proc_net_buf + len,
+		    proc_net_size - len - 1, len);
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			msg_syswarn("%s: pread(%s)", __FUNCTION__, path);
+			close(proc_net_fd[n]);
+			proc_net_fd[n] = -1;
+			return(NULL);
+		}
+		if (r == 0)
+			break;
+		len += r;
+	}
+	proc_net_buf[len] = 0;
+
+	if ((p = strchr(proc_net_buf, '\n')) == NULL)
+		return(proc_net_buf + len);
+	return(p + 1);
+}
+
+/*****************************************************************************
+ * Finds the next listening socket of type %type% (see socket_conf structure)
+ * in contents of /proc/net file starting at *%p% and describes it in %s%.
+ * Lines of sockets in other states are skipped before their addresses are
+ * decoded. If successful, moves *%p% to the next line and returns non-zero.
+ * Otherwise returns zero.
+ *****************************************************************************/
+int proc_net_next(char **p, int type, struct proc_net_sock *s) {
+	char *line, *eol;
+	int f_found;
+
+	for (line = *p; *line; line = eol) {
+		if ((eol = strchr(line, '\n')) == NULL)
+			eol = line + strlen(line);
+		else
+			eol++;
+		if (type == 4)
+			f_found = proc_net_unix(line, eol, s);
+		else
+			f_found = proc_net_inet(line, type, s);
+		if (f_found) {
+			*p = eol;
+			return(1);
+		}
+	}
+	*p = line;
+	return(0);
+}
+
+/*****************************************************************************
+ * Finds names of processes owning %n% sockets %owners% by inode numbers.
+ * Descriptors of all processes are walked through once, so it should be
+ * called for all sockets of interest together. %owners% is sorted by inode
+ * number.
+ *****************************************************************************/
+void proc_net_owners(struct proc_net_owner *owners, int n) {
+	char path[64], link[64], name[PROCESS_NAME_MAXLEN + 2];
+	struct proc_net_owner key, *o;
+	struct dirent *pe, *fe;
+	DIR *pd, *fd;
+	ssize_t len;
+	int i, f, left;
+
+	for (i = 0; i < n; i++)
+		owners[i].name[0] = 0;
+	if (n == 0)
+		return;
+	qsort(owners, n, sizeof(*owners), proc_net_owner_cmp);
+
+	if ((pd = opendir("/proc")) == NULL) {
+		msg_syswarn("%s: opendir(/proc)", __FUNCTION__);
+		return;
+	}
+	left = n;
+	while (left && (pe = readdir(pd))) {
+		if (pe->d_name[0] < '0' || pe->d_name[0] > '9')
+			continue;
+		snprintf(path, sizeof(path), "/proc/%s/fd", pe->d_name);
+		/* process has gone or belongs to other user */
+		if ((fd = opendir(path)) == NULL)
+			continue;
+		name[0] = 0;
+		while (left && (fe = readdir(fd))) {
+			snprintf(path, sizeof(path), "/proc/%s/fd/%s",
+			    pe->d_name, fe->d_name);
+			if ((len = readlink(path, link, sizeof(link) - 1)) < 0)
+				continue;
+			link[len] = 0;
+			if (strncmp(link, "socket:[", 8))
+				continue;
+			key.inode = strtoul(link + 8, NULL, 10);
+			if ((o = bsearch(&key, owners, n, sizeof(*owners),
+			    proc_net_owner_cmp)) == NULL || o->name[0])
+				continue;
+			/* name of process is read at the first owned socket */
+			if (name[0] == 0) {
+				snprintf(path, sizeof(path), "/proc/%s/comm",
+				    pe->d_name);
+				if ((f = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+					break;
+				len = read(f, name, sizeof(name) - 1);
+				close(f);
+				if (len <= 0)
+					break;
+				name[len] = 0;
+				parse_chomp(name);
+			}
+			strcpy(o->name, name);
+			left--;
+		}
+		closedir(fd);
+	}
+	closedir(pd);
+}
+
+/*****************************************************************************
+ * Compares owners of sockets %a% and %b% by inode number for qsort().
+ *****************************************************************************/
+static int proc_net_owner_cmp(const void *a, const void *b) {
+	u_int ia = ((const struct proc_net_owner *)a)->inode;
+	u_int ib = ((const struct proc_net_owner *)b)->inode;
+
+	return((ia > ib) - (ia < ib));
+}
+
+/*****************************************************************************
+ * Parses line %p% of /proc/net/{tcp,udp}[6] with socket of type %type%.
+ * If the socket is in requested state, describes it in %s% and returns
+ * non-zero. Otherwise returns zero.
+ *
+ * Line format: "  sl: local_address rem_address st tx_queue:rx_queue
+ * tr:tm->when retrnsmt uid timeout inode ...", addresses are hex words in
+ * host byte order followed by ':' and hex port.
+ *****************************************************************************/
+static int proc_net_inet(char *p, int type, struct proc_net_sock *s) {
+	char *local;
+	u_int port;
+	int i;
+
+	/* skip "sl:", local and remote addresses */
+	local = proc_net_skip(p);
+	p = proc_net_skip(proc_net_skip(local));
+
+	if (!proc_net_hex(&p, &s->state))
+		return(0);
+	if (s->state != ((type & 1) ? PROC_NET_UDP_CLOSE : PROC_NET_TCP_LISTEN))
+		return(0);
+	if (*p++ != ' ' || !proc_net_hex(&p, &s->tx_queue) || *p++ != ':' ||
+	    !proc_net_hex(&p, &s->rx_queue))
+		return(0);
+	/* skip "tr:tm->when", retrnsmt, uid and timeout */
+	p = proc_net_skip(proc_net_skip(proc_net_skip(proc_net_skip(p))));
+	if (!proc_net_dec(&p, &s->inode))
+		return(0);
+
+	p = local;
+	if (type < 2) {
+		bzero(&s->sin, sizeof(s->sin));
+		if (!proc_net_hex(&p, &s->sin.sin_addr.s_addr))
+			return(0);
+	} else {
+		bzero(&s->sin6, sizeof(s->sin6));
+		for (i = 0; i < 4; i++)
+			if (!proc_net_hex(&p, &s->sin6.sin6_addr.s6_addr32[i]))
+				return(0);
+	}
+	if (*p++ != ':' || !proc_net_hex(&p, &port))
+		return(0);
+	if (type < 2)
+		s->sin.sin_port = htons(port);
+	else
+		s->sin6.sin6_port = htons(port);
+	return(1);
+}
+
+/*****************************************************************************
+ * Parses line %p% ending at %eol% of /proc/net/unix. If the socket is
+ * listening and has path, describes it in %s% and returns non-zero.
+ * Otherwise returns zero. Path is null-terminated in place.
+ *
+ * Line format: "Num: RefCount Protocol Flags Type St Inode [Path]".
+ *****************************************************************************/
+static int proc_net_unix(char *p, char *eol, struct proc_net_sock *s) {
+	u_int flags;
+
+	/* skip "Num:", RefCount and Protocol */
+	p = proc_net_skip(proc_net_skip(proc_net_skip(p)));
+	if (!proc_net_hex(&p, &flags) || !(flags & PROC_NET_UNIX_ACCEPTCON))
+		return(0);
+	/* skip Type and St */
+	p = proc_net_skip(proc_net_skip(p));
+	if (!proc_net_dec(&p, &s->inode))
+		return(0);
+	while (*p == ' ')
+		p++;
+	if (p >= eol || *p == '\n' || *p == 0)
+		return(0);
+
+	s->path = p;
+	if (eol[-1] == '\n')
+		eol[-1] = 0;
+	s->state = PROC_NET_TCP_LISTEN;
+	s->tx_queue = 0;
+	s->rx_queue = 0;
+	return(1);
+}
+
+/*****************************************************************************
+ * Reads up to 8 hex digits at *%p% into %v% and moves *%p% past them. If
+ * there is at least one digit, returns non-zero. Otherwise returns zero.
+ *****************************************************************************/
+static int proc_net_hex(char **p, u_int *v) {
+	u_char *s = (u_char *)*p, d;
+	u_int val;
+	int i;
+
+	val = 0;
+	for (i = 0; i < 8 && (d = proc_net_hexval[s[i]]); i++)
+		val = (val << 4) | (d - 1);
+	*p += i;
+	*v = val;
+	return(i);
+}
+
+/*****************************************************************************
+ * Reads decimal number at *%p% into %v% and moves *%p% past it. If there is
+ * at least one digit, returns non-zero. Otherwise returns zero.
+ *****************************************************************************/
+static int proc_net_dec(char **p, u_int *v) {
+	char *s = *p;
+	u_int val;
+
+	val = 0;
+	for (; *s >= '0' && *s <= '9'; s++)
+		val = val * 10 + (*s - '0');
+	*v = val;
+	if (s == *p)
+		return(0);
+	*p = s;
+	return(1);
+}
+
+/*****************************************************************************
+ * Skips field at %p% and spaces around it. Returns pointer to the next field.
+ *****************************************************************************/
+static char *proc_net_skip(char *p) {
+	while (*p == ' ')
+		p++;
+	while (*p && *p != ' ' && *p != '\n')
+		p++;
+	while (*p == ' ')
+		p++;
+	return(p);
+}
+#endif
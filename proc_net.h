@@ -0,0 +1,43 @@
+/*
+ * Written by Vadim Guchenko <yhw@rambler-co.ru>
+ *
+ * 	$Id$
+ */
+
+#ifdef __linux__
+/* Maximum number of /proc/net files kept open */
+#define PROC_NET_MAXN		5
+
+
+/* Structure for socket found in /proc/net file */
+struct proc_net_sock {
+	/* local address of IPv4 socket */
+	struct sockaddr_in	sin;
+	/* local address of IPv6 socket */
+	struct sockaddr_in6	sin6;
+	/* path of unix domain socket */
+	char			*path;
+	/* state, see TCP_* constants */
+	u_int			state;
+	/* send and receive queue lengths */
+	u_int			tx_queue;
+	u_int			rx_queue;
+	/* inode number */
+	u_int			inode;
+};
+
+/* Structure for owner of socket */
+struct proc_net_owner {
+	/* inode number of socket */
+	u_int	inode;
+	/* any value for the caller */
+	int	tag;
+	/* name of process owning socket or empty string if it isn't found */
+	char	name[PROCESS_NAME_MAXLEN + 1];
+};
+
+
+char *proc_net_read(int, const char *);
+int proc_net_next(char **, int, struct proc_net_sock *);
+void proc_net_owners(struct proc_net_owner *, int);
+#endif
@@ -0,0 +1,115 @@
+/*
+ * Written by Vadim Guchenko <yhw@rambler-co.ru>
+ *
+ * 	$Id$
+ */
+
+#include <sys/types.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "conf.h"
+#include "rollup.h"
+
+
+/* Tiers of rollup store from the finest to the coarsest one. Periods up to
+   15 minutes are taken from the first tier, so they are rounded up to
+   10 seconds */
+const struct {
+	/* duration of bucket in seconds */
+	u_int	step;
+	/* number of buckets */
+	u_int	len;
+	/* index of the first bucket in arrays of rollup structure */
+	u_int	base;
+} rollup_tiers[ROLLUP_TIERS] = {
+	{ 10,	90,	0 },
+	{ 60,	60,	90 },
+};
+
+
+/*****************************************************************************
+ * Adds sample %value% taken at time %tm% to rollup store %r%. Negative sample
+ * means that value is unknown, it only moves time forward. If time goes
+ * backward, sample is added to the current buckets.
+ *****************************************************************************/
+void rollup_push(struct rollup *r, time_t tm, int value) {
+	u_long cur, n;
+	u_int i, k;
+
+	if (tm < r->last_tm)
+		tm = r->last_tm;
+	for (k = 0; k < ROLLUP_TIERS; k++) {
+		cur = r->last_tm / rollup_tiers[k].step;
+		n = tm / rollup_tiers[k].step;
+		/* clear buckets passed since the last sample */
+		if (r->last_tm == 0 || n - cur > rollup_tiers[k].len)
+			cur = n - rollup_tiers[k].len;
+		while (cur < n) {
+			i = rollup_tiers[k].base + ++cur % rollup_tiers[k].len;
+			r->sum[i] = 0;
+			r->count[i] = 0;
+		}
+		if (value < 0)
+			continue;
+
+		i = rollup_tiers[k].base + n % rollup_tiers[k].len;
+		if (r->count[i] == 0)
+			r->max[i] = value;
+		else if (r->count[i] == USHRT_MAX)
+			continue;
+		else if (value > r->max[i])
+			r->max[i] = value;
+		r->sum[i] += value;
+		r->count[i]++;
+	}
+	r->last_tm = tm;
+}
+
+/*****************************************************************************
+ * Aggregates known samples of rollup store %r% taken during %period% seconds
+ * up to the last sample into %s%. The period is rounded up to buckets of the
+ * finest tier covering it, the tier is chosen the coarsest one if period is
+ * too long. Returns number of samples aggregated.
+ *****************************************************************************/
+u_int rollup_get(const struct rollup *r, u_int period, struct rollup_stats *s) {
+	u_long cur;
+	u_int i, j, k, n;
+
+	bzero(s, sizeof(*s));
+	if (r->last_tm == 0)
+		return(0);
+	for (k = 0; k < ROLLUP_TIERS - 1; k++)
+		if (rollup_tiers[k].step * rollup_tiers[k].len >= period)
+			break;
+	n = (period + rollup_tiers[k].step - 1) / rollup_tiers[k].step;
+	if (n > rollup_tiers[k].len)
+		n = rollup_tiers[k].len;
+
+	cur = r->last_tm / rollup_tiers[k].step;
+	for (j = 0; j < n; j++) {
+		i = rollup_tiers[k].base + (cur - j) % rollup_tiers[k].len;
+		if (r->count[i] == 0)
+			continue;
+		if (s->count == 0 || r->max[i] > s->max)
+			s->max = r->max[i];
+		s->sum += r->sum[i];
+		s->count += r->count[i];
+	}
+	return(s->count);
+}
+
+/*****************************************************************************
+ * Returns average of known samples of rollup store %r% taken during %period%
+ * seconds up to the last sample or 0 if there are no such samples.
+ *****************************************************************************/
+double rollup_avg(const struct rollup *r, u_int period) {
+	struct rollup_stats s;
+
+	if (rollup_get(r, period, &s) == 0)
+		return(0);
+	return((double)s.sum / s.count);
+}
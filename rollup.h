@@ -0,0 +1,36 @@
+/*
+ * Written by Vadim Guchenko <yhw@rambler-co.ru>
+ *
+ * 	$Id$
+ */
+
+/* Number of tiers of rollup store */
+#define ROLLUP_TIERS		2
+/* Total number of buckets in all tiers, see %rollup_tiers% */
+#define ROLLUP_BUCKETS		(90 + 60)
+
+
+/* Structure for aggregate of samples */
+struct rollup_stats {
+	int	max;
+	llong	sum;
+	u_int	count;
+};
+
+/* Structure for history of samples aggregated into tiers of buckets of
+   increasing duration, e.g. the last 15 minutes by 10 seconds and the last
+   hour by minutes. Buckets of every tier form ring indexed by time divided by
+   duration of bucket. Structure has no pointers, so it can be copied */
+struct rollup {
+	/* time of the last sample or 0 if there were no samples */
+	time_t	last_tm;
+	/* buckets of all tiers, tier after tier */
+	llong	sum[ROLLUP_BUCKETS];
+	int	max[ROLLUP_BUCKETS];
+	u_short	count[ROLLUP_BUCKETS];
+};
+
+
+void rollup_push(struct rollup *, time_t, int);
+u_int rollup_get(const struct rollup *, u_int, struct rollup_stats *);
+double rollup_avg(const struct rollup *, u_int);
@@ -0,0 +1,214 @@
+/*
+ * Written by Vadim Guchenko <yhw@rambler-co.ru>
+ *
+ * 	$Id$
+ */
+
+#ifdef __linux__
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/socket.h>
+
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "conf.h"
+#include "rtnl.h"
+
+
+/* Size of buffer for netlink messages, every interface takes up to few
+   kilobytes */
+#define RTNL_BUFSIZE		65536
+
+/* Size of the part of statistics structure %type% with used counters. The
+   kernel may send structure longer or shorter than ours depending on its
+   version */
+#define RTNL_STATS_USED(type)	(offsetof(type, tx_fifo_errors) + \
+				    sizeof(((type *)0)->tx_fifo_errors))
+
+
+/* Structure for RTM_GETLINK request */
+struct rtnl_link_req {
+	struct nlmsghdr		nlh;
+	struct ifinfomsg	ifi;
+};
+
+
+/* Netlink socket kept open between samples or -1 */
+int rtnl_fd = -1;
+
+/* Sequence number of the last request */
+uint32_t rtnl_seq = 0;
+
+
+static int rtnl_open(void);
+static void rtnl_link_msg(const struct nlmsghdr *,
+    void (*)(u_int, const char *, u_int, const struct rtnl_link_stats64 *,
+    void *), void *);
+
+
+/*****************************************************************************
+ * Asks the kernel for all network interfaces and their counters in one
+ * dump. %func% is called with %arg%, index and name of interface, its IFF_*
+ * flags and 64-bit counters for every interface. If successful, returns
+ * non-zero. Otherwise returns zero.
+ *****************************************************************************/
+int rtnl_links(void (*func)(u_int, const char *, u_int,
+    const struct rtnl_link_stats64 *, void *), void *arg) {
+	struct rtnl_link_req r;
+	struct sockaddr_nl sa;
+	struct nlmsghdr *nlh;
+	struct nlmsgerr *err;
+	char buf[RTNL_BUFSIZE];
+	ssize_t n;
+
+	if (rtnl_fd < 0 && !rtnl_open())
+		return(0);
+
+	bzero(&r, sizeof(r));
+	r.nlh.nlmsg_len = sizeof(r);
+	r.nlh.nlmsg_type = RTM_GETLINK;
+	r.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	r.nlh.nlmsg_seq = ++rtnl_seq;
+	r.ifi.ifi_family = AF_UNSPEC;
+
+	bzero(&sa, sizeof(sa));
+	sa.nl_family = AF_NETLINK;
+	if (sendto(rtnl_fd, &r, sizeof(r), 0, (struct sockaddr *)&sa,
+	    sizeof(sa)) < 0) {
+		msg_syswarn("%s: sendto", __FUNCTION__);
+		rtnl_close();
+		return(0);
+	}
+
+	for (;;) {
+		if ((n = recv(rtnl_fd, buf, sizeof(buf), 0)) < 0) {
+			if (errno == EINTR)
+				continue;
+			msg_syswarn("%s: recv", __FUNCTION__);
+			rtnl_close();
+			return(0);
+		}
+		for (nlh = (struct nlmsghdr *)buf; NLMSG_OK(nlh, (size_t)n);
+		    nlh = NLMSG_NEXT(nlh, n)) {
+			/* skip answers to requests given up before */
+			if (nlh->nlmsg_seq != rtnl_seq)
+				continue;
+			if (nlh->nlmsg_type == NLMSG_DONE)
+				return(1);
+			if (nlh->nlmsg_type == NLMSG_ERROR) {
+				err = NLMSG_DATA(nlh);
+				msg_warn("%s: %s", __FUNCTION__,
+				    strerror(-err->error));
+				return(0);
+			}
+			if (nlh->nlmsg_type == RTM_NEWLINK)
+				rtnl_link_msg(nlh, func, arg);
+		}
+	}
+}
+
+/*****************************************************************************
+ * Closes netlink socket. It's opened again by the next request.
+ *****************************************************************************/
+void rtnl_close() {
+	if (rtnl_fd >= 0) {
+		close(rtnl_fd);
+		rtnl_fd = -1;
+	}
+}
+
+/*****************************************************************************
+ * Opens netlink socket. If successful, returns non-zero. Otherwise returns
+ * zero.
+ *****************************************************************************/
+static int rtnl_open() {
+	if ((rtnl_fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC,
+	    NETLINK_ROUTE)) < 0) {
+		msg_syswarn("%s: socket(NETLINK_ROUTE)", __FUNCTION__);
+		return(0);
+	}
+	return(1);
+}
+
+/*****************************************************************************
+ * Extracts index, name, flags and counters of interface from message %nlh%
+ * and passes them to %func% with %arg%. Kernels older than 2.6.35 report
+ * only 32-bit counters, they are widened. Counters missing in structure sent
+ * by the kernel are zero. Interfaces without counters are skipped.
+ *****************************************************************************/
+static void rtnl_link_msg(const struct nlmsghdr *nlh,
+    void (*func)(u_int, const char *, u_int, const struct rtnl_link_stats64 *,
+    void *), void *arg) {
+	const struct ifinfomsg *ifi;
+	const struct rtnl_link_stats *s32 = NULL;
+	const struct rtnl_link_stats64 *s64 = NULL;
+	struct rtnl_link_stats narrow;
+	struct rtnl_link_stats64 wide;
+	struct rtattr *rta;
+	const char *ifname = NULL;
+	int rta_len;
+
+	ifi = NLMSG_DATA(nlh);
+	rta = IFLA_RTA(ifi);
+	rta_len = IFLA_PAYLOAD(nlh);
+	for (; RTA_OK(rta, rta_len); rta = RTA_NEXT(rta, rta_len)) {
+		switch (rta->rta_type) {
+		case IFLA_IFNAME:
+			/* name is null-terminated by the kernel */
+			if (RTA_PAYLOAD(rta) > 0 &&
+			    memchr(RTA_DATA(rta), 0, RTA_PAYLOAD(rta)))
+				ifname = RTA_DATA(rta);
+			break;
+		case IFLA_STATS:
+			if (RTA_PAYLOAD(rta) >=
+			    RTNL_STATS_USED(struct rtnl_link_stats)) {
+				bzero(&narrow, sizeof(narrow));
+				memcpy(&narrow, RTA_DATA(rta),
+				    MIN(RTA_PAYLOAD(rta), sizeof(narrow)));
+				s32 = &narrow;
+			}
+			break;
+		case IFLA_STATS64:
+			/* attribute isn't aligned to 8 bytes */
+			if (RTA_PAYLOAD(rta) >=
+			    RTNL_STATS_USED(struct rtnl_link_stats64)) {
+				bzero(&wide, sizeof(wide));
+				memcpy(&wide, RTA_DATA(rta),
+				    MIN(RTA_PAYLOAD(rta), sizeof(wide)));
+				s64 = &wide;
+			}
+			break;
+		}
+	}
+	if (ifname == NULL)
+		return;
+
+	if (s64 == NULL) {
+		if (s32 == NULL)
+			return;
+		bzero(&wide, sizeof(wide));
+		wide.rx_packets		= s32->rx_packets;
+		wide.tx_packets		= s32->tx_packets;
+		wide.rx_bytes		= s32->rx_bytes;
+		wide.tx_bytes		= s32->tx_bytes;
+		wide.rx_errors		= s32->rx_errors;
+		wide.tx_errors		= s32->tx_errors;
+		wide.rx_dropped		= s32->rx_dropped;
+		wide.tx_dropped		= s32->tx_dropped;
+		wide.multicast		= s32->multicast;
+		wide.collisions		= s32->collisions;
+		wide.rx_fifo_errors	= s32->rx_fifo_errors;
+		wide.tx_fifo_errors	= s32->tx_fifo_errors;
+		s64 = &wide;
+	}
+	func(ifi->ifi_index, ifname, ifi->ifi_flags, s64, arg);
+}
+#endif
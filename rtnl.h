@@ -0,0 +1,14 @@
+/*
+ * Written by Vadim Guchenko <yhw@rambler-co.ru>
+ *
+ * 	$Id$
+ */
+
+#ifdef __linux__
+#include <linux/if_link.h>
+
+
+int rtnl_links(void (*)(u_int, const char *, u_int,
+    const struct rtnl_link_stats64 *, void *), void *);
+void rtnl_close(void);
+#endif
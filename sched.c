@@ -0,0 +1,417 @@
+/*
+ * Written by Vadim Guchenko <yhw@rambler-co.ru>
+ *
+ * 	$Id$
+ */
+
+#include <sys/types.h>
+#include <sys/time.h>
+
+#include <pthread.h>
+#include <signal.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "conf.h"
+#include "stats.h"
+#include "output.h"
+#include "sched.h"
+
+
+/* Samplers */
+struct sampler samplers[SCHED_MAXN];
+/* Number of elements in %samplers% array */
+int samplers_count = 0;
+
+/* Min-heap of samplers ordered by time of the next sample */
+struct sampler *sched_heap[SCHED_MAXN];
+
+/* Mutex held by sampler thread while samplers run. Other threads must hold
+   it to change samplers or data used by them */
+pthread_mutex_t sched_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Function called by sampler thread after samples are taken */
+void (*sched_publish)(void) = NULL;
+
+/* Process ID of process running sampler thread or 0 */
+pid_t sched_owner_pid = 0;
+
+/* This flag shows that sampler thread is taking samples */
+int f_sched_running = 0;
+/* This flag shows that process was forked while samples were taken, so data
+   of samplers may be inconsistent */
+int f_sched_torn = 0;
+
+
+static void *sched_thread(void *);
+static void sched_child(void);
+static int sched_timeout(int);
+static void sched_up(int);
+static void sched_down(int);
+static int sched_find(void (*)(void));
+
+
+/*****************************************************************************
+ * Removes all samplers. Must be called by every process which runs samplers,
+ * so processes started at the same moment get different jitter.
+ *****************************************************************************/
+void sched_init() {
+	samplers_count = 0;
+	srandom(getpid() ^ (u_int)time(NULL));
+}
+
+/*****************************************************************************
+ * Registers sampler %func% named %name% which is called every %interval%
+ * milliseconds. The first sample is taken after random delay up to %jitter%
+ * milliseconds, all further samples follow exactly %interval% apart. If
+ * %func% is already registered, only its interval is changed. After
+ * sched_start() must be called under sched_lock().
+ *****************************************************************************/
+void sched_add(const char *name, void (*func)(void), u_int interval,
+    u_int jitter) {
+	struct sampler *s;
+	int i;
+
+	if (interval == 0)
+		interval = 1;
+
+	if ((i = sched_find(func)) >= 0) {
+		s = sched_heap[i];
+		if (s->interval != interval) {
+			s->next = s->next - (u_llong)s->interval * 1000 +
+			    (u_llong)interval * 1000;
+			s->interval = interval;
+			sched_up(i);
+			sched_down(i);
+		}
+		return;
+	}
+
+	if (samplers_count == SCHED_MAXN) {
+		msg_err(0, "%s: too many samplers (maximum %d allowed)",
+		    __FUNCTION__, SCHED_MAXN);
+		return;
+	}
+	s = &samplers[samplers_count];
+	bzero(s, sizeof(*s));
+	snprintf(s->name, sizeof(s->name), "%s", name);
+	s->func = func;
+	s->interval = interval;
+	s->next = sched_now() +
+	    (jitter ? (u_llong)(random() % jitter) * 1000 : 0);
+	sched_heap[samplers_count] = s;
+	sched_up(samplers_count++);
+}
+
+/*****************************************************************************
+ * Changes interval of sampler %func% to %interval% milliseconds. The new
+ * interval is counted from the next sample, so unlike sched_add() it may be
+ * called by the sampler itself.
+ *****************************************************************************/
+void sched_interval(void (*func)(void), u_int interval) {
+	int i;
+
+	if (interval == 0)
+		interval = 1;
+	if ((i = sched_find(func)) >= 0)
+		sched_heap[i]->interval = interval;
+}
+
+/*****************************************************************************
+ * Moves the next sample of sampler %func% to %delay% milliseconds from now
+ * if it's due later. May be called by other sampler: the running sampler is
+ * already due, so it stays the first in heap.
+ *****************************************************************************/
+void sched_wake(void (*func)(void), u_int delay) {
+	u_llong next;
+	int i;
+
+	if ((i = sched_find(func)) < 0)
+		return;
+	next = sched_now() + (u_llong)(delay ? delay : 1) * 1000;
+	if (next < sched_heap[i]->next) {
+		sched_heap[i]->next = next;
+		sched_up(i);
+	}
+}
+
+/*****************************************************************************
+ * Unregisters sampler %func%. Nothing is done if it isn't registered.
+ *****************************************************************************/
+void sched_del(void (*func)(void)) {
+	struct sampler *s;
+	int i, j;
+
+	if ((i = sched_find(func)) < 0)
+		return;
+
+	/* remove from heap */
+	s = sched_heap[i];
+	sched_heap[i] = sched_heap[--samplers_count];
+	if (i < samplers_count) {
+		sched_up(i);
+		sched_down(i);
+	}
+
+	/* keep %samplers% array dense, heap points to its elements */
+	if (s != &samplers[samplers_count]) {
+		*s = samplers[samplers_count];
+		for (j = 0; j < samplers_count; j++)
+			if (sched_heap[j] == &samplers[samplers_count])
+				sched_heap[j] = s;
+	}
+}
+
+/*****************************************************************************
+ * Starts sampler thread which calls registered samplers on schedule and
+ * %publish% after samples are taken. Samplers and data used by them may be
+ * changed later only under sched_lock().
+ *****************************************************************************/
+void sched_start(void (*publish)(void)) {
+	pthread_t thread;
+	sigset_t set, oset;
+	int err;
+
+	sched_publish = publish;
+	sched_owner_pid = getpid();
+
+	/* fork(2) doesn't wait for samplers, children find out whether they
+	   got data changed by sampler in the middle */
+	if ((err = pthread_atfork(NULL, NULL, sched_child)))
+		msg_err(1, "%s: pthread_atfork: %s", __FUNCTION__, strerror(err));
+
+	/* signals are processed by the main thread only */
+	sigfillset(&set);
+	pthread_sigmask(SIG_BLOCK, &set, &oset);
+	err = pthread_create(&thread, NULL, sched_thread, NULL);
+	pthread_sigmask(SIG_SETMASK, &oset, NULL);
+	if (err)
+		msg_err(1, "%s: pthread_create: %s", __FUNCTION__, strerror(err));
+	pthread_detach(thread);
+}
+
+/*****************************************************************************
+ * Returns non-zero if the current process runs sampler thread.
+ *****************************************************************************/
+int sched_is_owner() {
+	return(sched_owner_pid && sched_owner_pid == getpid());
+}
+
+/*****************************************************************************
+ * Returns non-zero if the current process was forked while samplers ran, so
+ * their data must not be used.
+ *****************************************************************************/
+int sched_is_torn() {
+	return(f_sched_torn);
+}
+
+/*****************************************************************************
+ * Stops samplers from running until sched_unlock() is called.
+ *****************************************************************************/
+void sched_lock() {
+	pthread_mutex_lock(&sched_mutex);
+}
+
+/*****************************************************************************
+ * Allows samplers to run again.
+ *****************************************************************************/
+void sched_unlock() {
+	pthread_mutex_unlock(&sched_mutex);
+}
+
+/*****************************************************************************
+ * Returns time in milliseconds until the next sample is due, but not more
+ * than %max%. Returns 0 if some sample is already late.
+ *****************************************************************************/
+static int sched_timeout(int max) {
+	u_llong now;
+
+	if (samplers_count == 0)
+		return(max);
+	now = sched_now();
+	if (sched_heap[0]->next <= now)
+		return(0);
+	/* round up, so the sample isn't early */
+	if ((sched_heap[0]->next - now + 999) / 1000 < (u_llong)max)
+		return((sched_heap[0]->next - now + 999) / 1000);
+	return(max);
+}
+
+/*****************************************************************************
+ * Calls all samplers which are due. Sampler which is late by a whole
+ * interval or more skips missed samples instead of catching up, so no two
+ * samples are ever taken closer than its interval. Returns number of taken
+ * samples.
+ *****************************************************************************/
+int sched_run() {
+	struct sampler *s;
+	u_llong now, start, interval;
+	u_long runtime;
+	int n;
+
+	n = 0;
+	now = sched_now();
+	while (samplers_count && sched_heap[0]->next <= now) {
+		s = sched_heap[0];
+		n++;
+
+		start = sched_now();
+		s->func();
+		now = sched_now();
+
+		runtime = now - start;
+		s->runs++;
+		s->runtime += runtime;
+		s->runtime_last = runtime;
+		if (runtime > s->runtime_max)
+			s->runtime_max = runtime;
+
+		interval = (u_llong)s->interval * 1000;
+		s->next += interval;
+		if (s->next <= now) {
+			s->skipped += (now - s->next) / interval + 1;
+			s->next += ((now - s->next) / interval + 1) * interval;
+		}
+		sched_down(0);
+	}
+	return(n);
+}
+
+/*****************************************************************************
+ * Processes SAMPLERS command.
+ *****************************************************************************/
+void do_samplers() {
+	time_t tm;
+	int i;
+
+	msg_debug(1, "Processing of SAMPLERS command started");
+
+	/* counters are read without the lock, they are informational only
+	   and the main thread mustn't wait for slow sampler */
+	tm = get_remote_tm();
+	for (i = 0; i < samplers_count; i++) {
+		out_u64(tm, out_key("sampler_runs", samplers[i].name),
+		    samplers[i].runs);
+		out_u64(tm, out_key("sampler_skipped", samplers[i].name),
+		    samplers[i].skipped);
+		out_u64(tm, out_key("sampler_runtime", samplers[i].name),
+		    samplers[i].runtime);
+		out_u64(tm, out_key("sampler_runtime_last", samplers[i].name),
+		    samplers[i].runtime_last);
+		out_u64(tm, out_key("sampler_runtime_max", samplers[i].name),
+		    samplers[i].runtime_max);
+	}
+
+	msg_debug(1, "Processing of SAMPLERS command finished");
+}
+
+/*****************************************************************************
+ * Sampler thread. Sleeps until the next sample is due, takes due samples and
+ * publishes them. Never returns.
+ *****************************************************************************/
+static void *sched_thread(void *arg) {
+	struct timespec ts;
+	int timeout;
+
+	/* suppress compiler warning */
+	arg = arg;
+
+	for (;;) {
+		/* samplers can be changed while sleeping, so sleep no longer
+		   than one second */
+		sched_lock();
+		timeout = sched_timeout(1000);
+		sched_unlock();
+
+		if (timeout > 0) {
+			ts.tv_sec = timeout / 1000;
+			ts.tv_nsec = (timeout % 1000) * 1000000;
+			while (nanosleep(&ts, &ts) < 0 && errno == EINTR)
+				;
+		}
+
+		sched_lock();
+		__atomic_store_n(&f_sched_running, 1, __ATOMIC_SEQ_CST);
+		if (sched_run() && sched_publish)
+			sched_publish();
+		__atomic_store_n(&f_sched_running, 0, __ATOMIC_RELEASE);
+		sched_unlock();
+	}
+	return(NULL);
+}
+
+/*****************************************************************************
+ * Called in child after fork(2). Sampler thread doesn't exist in child, so
+ * its mutex is reinitialized.
+ *****************************************************************************/
+static void sched_child() {
+	f_sched_torn = __atomic_load_n(&f_sched_running, __ATOMIC_SEQ_CST);
+	f_sched_running = 0;
+	pthread_mutex_init(&sched_mutex, NULL);
+}
+
+/*****************************************************************************
+ * Returns monotonic time in microseconds.
+ *****************************************************************************/
+u_llong sched_now() {
+	struct timespec ts;
+
+#ifdef CLOCK_MONOTONIC
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+#else
+	if (clock_gettime(CLOCK_REALTIME, &ts) < 0)
+#endif
+		msg_syserr(1, "%s: clock_gettime", __FUNCTION__);
+	return((u_llong)ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+}
+
+/*****************************************************************************
+ * Moves element %i% of heap up while it's due earlier than its parent.
+ *****************************************************************************/
+static void sched_up(int i) {
+	struct sampler *s;
+
+	s = sched_heap[i];
+	while (i > 0 && sched_heap[(i - 1) / 2]->next > s->next) {
+		sched_heap[i] = sched_heap[(i - 1) / 2];
+		i = (i - 1) / 2;
+	}
+	sched_heap[i] = s;
+}
+
+/*****************************************************************************
+ * Moves element %i% of heap down while it's due later than its children.
+ *****************************************************************************/
+static void sched_down(int i) {
+	struct sampler *s;
+	int j;
+
+	s = sched_heap[i];
+	while ((j = 2 * i + 1) < samplers_count) {
+		if (j + 1 < samplers_count &&
+		    sched_heap[j + 1]->next < sched_heap[j]->next)
+			j++;
+		if (sched_heap[j]->next >= s->next)
+			break;
+		sched_heap[i] = sched_heap[j];
+		i = j;
+	}
+	sched_heap[i] = s;
+}
+
+/*****************************************************************************
+ * Returns index in heap of sampler %func% or -1 if it isn't registered.
+ *****************************************************************************/
+static int sched_find(void (*func)(void)) {
+	int i;
+
+	for (i = 0; i < samplers_count; i++)
+		if (sched_heap[i]->func == func)
+			return(i);
+	return(-1);
+}
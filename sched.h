@@ -0,0 +1,46 @@
+/*
+ * Written by Vadim Guchenko <yhw@rambler-co.ru>
+ *
+ * 	$Id$
+ */
+
+/* Maximum number of samplers */
+#define SCHED_MAXN		8
+
+/* Maximum length of sampler name not including null */
+#define SCHED_NAME_MAXLEN	15
+
+
+/* Structure for periodic sampler */
+struct sampler {
+	/* name used in output of SAMPLERS command */
+	char	name[SCHED_NAME_MAXLEN + 1];
+	/* function taking the sample */
+	void	(*func)(void);
+	/* interval between samples in milliseconds */
+	u_int	interval;
+	/* monotonic time in microseconds of the next sample */
+	u_llong	next;
+	/* number of samples taken and skipped because of late run */
+	u_long	runs;
+	u_long	skipped;
+	/* total, last and maximum runtime in microseconds */
+	u_llong	runtime;
+	u_long	runtime_last;
+	u_long	runtime_max;
+};
+
+
+void sched_init(void);
+void sched_add(const char *, void (*)(void), u_int, u_int);
+void sched_del(void (*)(void));
+void sched_interval(void (*)(void), u_int);
+void sched_wake(void (*)(void), u_int);
+void sched_start(void (*)(void));
+int sched_is_owner(void);
+int sched_is_torn(void);
+void sched_lock(void);
+void sched_unlock(void);
+int sched_run(void);
+u_llong sched_now(void);
+void do_samplers(void);
@@ -0,0 +1,121 @@
+/*
+ * Written by Vadim Guchenko <yhw@rambler-co.ru>
+ *
+ * 	$Id$
+ */
+
+#include <sys/types.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "conf.h"
+#include "sketch.h"
+
+
+static u_int sketch_index(u_int);
+
+
+/*****************************************************************************
+ * Adds sample %value% to sketch %s%. Negative samples are ignored.
+ *****************************************************************************/
+void sketch_add(struct sketch *s, int value) {
+	if (value < 0)
+		return;
+	s->count[sketch_index(value)]++;
+	s->total++;
+}
+
+/*****************************************************************************
+ * Removes sample %value% added before from sketch %s%. Negative samples are
+ * ignored.
+ *****************************************************************************/
+void sketch_del(struct sketch *s, int value) {
+	u_int i;
+
+	if (value < 0)
+		return;
+	i = sketch_index(value);
+	if (s->count[i] == 0)
+		return;
+	s->count[i]--;
+	s->total--;
+}
+
+/*****************************************************************************
+ * Adds all samples of sketch %src% to sketch %dst%.
+ *****************************************************************************/
+void sketch_merge(struct sketch *dst, const struct sketch *src) {
+	u_int i;
+
+	for (i = 0; i < SKETCH_BUCKETS; i++)
+		dst->count[i] += src->count[i];
+	dst->total += src->total;
+}
+
+/*****************************************************************************
+ * Returns estimation of quantile %q% (0 <= %q% <= 1) of samples in sketch %s%
+ * or -1 if it's empty.
+ *****************************************************************************/
+int sketch_quantile(const struct sketch *s, double q) {
+	u_int i, e, rank, n;
+	double x;
+
+	if (s->total == 0)
+		return(-1);
+	/* nearest rank, i.e. ceil(q * total) - 1 */
+	x = q * s->total;
+	rank = x;
+	if (rank == x && rank > 0)
+		rank--;
+	if (rank >= s->total)
+		rank = s->total - 1;
+	for (i = 0, n = 0; i < SKETCH_BUCKETS - 1; i++)
+		if ((n += s->count[i]) > rank)
+			break;
+	if (i < SKETCH_LINEAR)
+		return(i);
+
+	/* middle of bucket */
+	i -= SKETCH_LINEAR;
+	e = i / (1 << SKETCH_SUBBITS) + 1;
+	return((((1 << SKETCH_SUBBITS) + i % (1 << SKETCH_SUBBITS)) << e) +
+	    ((1 << e) - 1) / 2);
+}
+
+/*****************************************************************************
+ * Returns bucket of value %v%. Beyond linear range every power of two is
+ * divided into 2^%SKETCH_SUBBITS% buckets by the bits following the highest
+ * one.
+ *****************************************************************************/
+static u_int sketch_index(u_int v) {
+	u_int e, x;
+
+	if (v < SKETCH_LINEAR)
+		return(v);
+	/* e = log2(v) */
+	e = 0;
+	x = v;
+	if (x >> 16) {
+		e += 16;
+		x >>= 16;
+	}
+	if (x >> 8) {
+		e += 8;
+		x >>= 8;
+	}
+	if (x >> 4) {
+		e += 4;
+		x >>= 4;
+	}
+	if (x >> 2) {
+		e += 2;
+		x >>= 2;
+	}
+	if (x >> 1)
+		e += 1;
+	e -= SKETCH_SUBBITS;
+	return(SKETCH_LINEAR + (e - 1) * (1 << SKETCH_SUBBITS) +
+	    ((v >> e) & ((1 << SKETCH_SUBBITS) - 1)));
+}
@@ -0,0 +1,32 @@
+/*
+ * Written by Vadim Guchenko <yhw@rambler-co.ru>
+ *
+ * 	$Id$
+ */
+
+/* Number of mantissa bits kept for values beyond linear range */
+#define SKETCH_SUBBITS		3
+/* Values below this one have buckets of their own */
+#define SKETCH_LINEAR		(2 << SKETCH_SUBBITS)
+/* Number of buckets enough for any non-negative int */
+#define SKETCH_BUCKETS		(SKETCH_LINEAR + (31 - SKETCH_SUBBITS - 1) * \
+				    (1 << SKETCH_SUBBITS))
+
+
+/* Structure for quantile sketch of non-negative integer samples (DDSketch
+   with logarithm linearly interpolated between powers of two). Relative
+   error of quantiles is at most 1/16, values below %SKETCH_LINEAR% are
+   exact. Samples can be removed as well as added, so sketch follows sliding
+   window, and sketches are merged by adding their counters */
+struct sketch {
+	/* number of samples in every bucket */
+	u_int	count[SKETCH_BUCKETS];
+	/* total number of samples */
+	u_int	total;
+};
+
+
+void sketch_add(struct sketch *, int);
+void sketch_del(struct sketch *, int);
+void sketch_merge(struct sketch *, const struct sketch *);
+int sketch_quantile(const struct sketch *, double);
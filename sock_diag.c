@@ -0,0 +1,337 @@
+/*
+ * Written by Vadim Guchenko <yhw@rambler-co.ru>
+ *
+ * 	$Id$
+ */
+
+#ifdef __linux__
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/sock_diag.h>
+#include <linux/inet_diag.h>
+#include <linux/unix_diag.h>
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "conf.h"
+#include "sock_diag.h"
+
+
+/* Size of buffer for netlink messages */
+#define SOCK_DIAG_BUFSIZE	32768
+
+/* Timeout in seconds of waiting for the kernel answer */
+#define SOCK_DIAG_TIMEOUT	5
+
+/* Size of one operation of inet_diag filter, as int for jump arithmetic */
+#define SOCK_DIAG_OP_SIZE	((int)sizeof(struct inet_diag_bc_op))
+
+
+/* Structure for inet_diag request with filter of local ports */
+struct sock_diag_inet_req {
+	struct nlmsghdr		nlh;
+	struct inet_diag_req_v2	req;
+	struct rtattr		rta;
+	/* two comparisons of 2 operations each and jump for every range of
+	   ports */
+	struct inet_diag_bc_op	bc[SOCK_DIAG_PORTS_MAXN * 5];
+};
+
+/* Structure for unix_diag request */
+struct sock_diag_unix_req {
+	struct nlmsghdr		nlh;
+	struct unix_diag_req	req;
+};
+
+/* Structure for callback called for every socket reported by the kernel,
+   only one of functions is set */
+struct sock_diag_cb {
+	void	(*inet_func)(const struct inet_diag_msg *, void *);
+	void	(*unix_func)(const char *, u_int,
+		    const struct unix_diag_rqlen *, void *);
+	void	*arg;
+};
+
+
+/* Netlink socket kept open between samples or -1 */
+int sock_diag_fd = -1;
+
+/* Process which opened the socket and netlink port ID of the socket */
+pid_t sock_diag_pid = 0;
+uint32_t sock_diag_port = 0;
+
+/* Sequence number of the last request */
+uint32_t sock_diag_seq = 0;
+
+
+static int sock_diag_open(void);
+static int sock_diag_dump(struct nlmsghdr *, const struct sock_diag_cb *);
+static void sock_diag_unix_msg(const struct nlmsghdr *,
+    const struct sock_diag_cb *);
+static int sock_diag_filter(struct inet_diag_bc_op *, const uint16_t (*)[2],
+    int);
+
+
+/*****************************************************************************
+ * Asks the kernel for sockets of address family %family% and protocol
+ * %protocol% which are in states given by bit mask %states% of TCP_*
+ * constants. If %nports% is non-zero, only sockets bound to port in one of
+ * %nports% ranges %ports% (pairs of the lowest and the highest port in host
+ * byte order) are returned. %func% is called with %arg% for every socket. If the kernel doesn't support such requests, returns zero, so the
+ * caller should fall back to /proc. Otherwise returns non-zero.
+ *****************************************************************************/
+int sock_diag_inet(int family, int protocol, u_int states,
+    const uint16_t (*ports)[2], int nports,
+    void (*func)(const struct inet_diag_msg *, void *), void *arg) {
+	struct sock_diag_inet_req r;
+	struct sock_diag_cb cb;
+	int bc_len;
+
+	if (nports > SOCK_DIAG_PORTS_MAXN)
+		nports = 0;
+
+	bzero(&r, sizeof(r));
+	bc_len = nports ? sock_diag_filter(r.bc, ports, nports) : 0;
+	r.nlh.nlmsg_len = offsetof(struct sock_diag_inet_req, bc) + bc_len;
+	if (bc_len == 0)
+		r.nlh.nlmsg_len = offsetof(struct sock_diag_inet_req, rta);
+	r.req.sdiag_family = family;
+	r.req.sdiag_protocol = protocol;
+	r.req.idiag_states = states;
+	r.rta.rta_type = INET_DIAG_REQ_BYTECODE;
+	r.rta.rta_len = RTA_LENGTH(bc_len);
+
+	bzero(&cb, sizeof(cb));
+	cb.inet_func = func;
+	cb.arg = arg;
+	return(sock_diag_dump(&r.nlh, &cb));
+}
+
+/*****************************************************************************
+ * Asks the kernel for unix domain sockets which are in states given by bit
+ * mask %states% of TCP_* constants. %func% is called with %arg%, path of
+ * socket, its inode number and queue lengths for every socket which has
+ * path. Abstract
+ * path is passed with '@' instead of leading null like in /proc/net/unix.
+ * Queue lengths are NULL if the kernel doesn't report them. If the kernel
+ * doesn't support such requests, returns zero, so the caller should fall
+ * back to /proc. Otherwise returns non-zero.
+ *****************************************************************************/
+int sock_diag_unix(u_int states,
+    void (*func)(const char *, u_int, const struct unix_diag_rqlen *, void *),
+    void *arg) {
+	struct sock_diag_unix_req r;
+	struct sock_diag_cb cb;
+
+	bzero(&r, sizeof(r));
+	r.nlh.nlmsg_len = sizeof(r);
+	r.req.sdiag_family = AF_UNIX;
+	r.req.udiag_states = states;
+	r.req.udiag_show = UDIAG_SHOW_NAME | UDIAG_SHOW_RQLEN;
+
+	bzero(&cb, sizeof(cb));
+	cb.unix_func = func;
+	cb.arg = arg;
+	return(sock_diag_dump(&r.nlh, &cb));
+}
+
+/*****************************************************************************
+ * Closes netlink socket. It's opened again by the next request.
+ *****************************************************************************/
+void sock_diag_close() {
+	if (sock_diag_fd >= 0) {
+		close(sock_diag_fd);
+		sock_diag_fd = -1;
+	}
+}
+
+/*****************************************************************************
+ * Opens netlink socket. If successful, returns non-zero. Otherwise returns
+ * zero.
+ *****************************************************************************/
+static int sock_diag_open() {
+	struct sockaddr_nl sa;
+	struct timeval tv;
+	socklen_t len;
+
+	if ((sock_diag_fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC,
+	    NETLINK_SOCK_DIAG)) < 0) {
+		msg_syswarn("%s: socket(NETLINK_SOCK_DIAG)", __FUNCTION__);
+		return(0);
+	}
+	/* the kernel chooses port ID, answers are addressed to it */
+	bzero(&sa, sizeof(sa));
+	sa.nl_family = AF_NETLINK;
+	len = sizeof(sa);
+	if (bind(sock_diag_fd, (struct sockaddr *)&sa, sizeof(sa)) < 0 ||
+	    getsockname(sock_diag_fd, (struct sockaddr *)&sa, &len) < 0) {
+		msg_syswarn("%s: bind", __FUNCTION__);
+		sock_diag_close();
+		return(0);
+	}
+	/* lost answer shouldn't stop sampling forever */
+	tv.tv_sec = SOCK_DIAG_TIMEOUT;
+	tv.tv_usec = 0;
+	if (setsockopt(sock_diag_fd, SOL_SOCKET, SO_RCVTIMEO, &tv,
+	    sizeof(tv)) < 0) {
+		msg_syswarn("%s: setsockopt(SO_RCVTIMEO)", __FUNCTION__);
+		sock_diag_close();
+		return(0);
+	}
+	sock_diag_pid = getpid();
+	sock_diag_port = sa.nl_pid;
+	return(1);
+}
+
+/*****************************************************************************
+ * Sends dump request %nlh% which has only its length and payload filled in
+ * and calls %cb% for every socket in the answer. If successful, returns
+ * non-zero. Otherwise returns zero.
+ *****************************************************************************/
+static int sock_diag_dump(struct nlmsghdr *nlh, const struct sock_diag_cb *cb) {
+	struct sockaddr_nl sa;
+	struct nlmsgerr *err;
+	char buf[SOCK_DIAG_BUFSIZE];
+	ssize_t n;
+
+	/* socket inherited from parent process is shared with it, so they
+	   would read answers of each other */
+	if (sock_diag_fd >= 0 && sock_diag_pid != getpid())
+		sock_diag_close();
+	if (sock_diag_fd < 0 && !sock_diag_open())
+		return(0);
+
+	nlh->nlmsg_type = SOCK_DIAG_BY_FAMILY;
+	nlh->nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	nlh->nlmsg_seq = ++sock_diag_seq;
+
+	bzero(&sa, sizeof(sa));
+	sa.nl_family = AF_NETLINK;
+	if (sendto(sock_diag_fd, nlh, nlh->nlmsg_len, 0, (struct sockaddr *)&sa,
+	    sizeof(sa)) < 0) {
+		msg_syswarn("%s: sendto", __FUNCTION__);
+		sock_diag_close();
+		return(0);
+	}
+
+	for (;;) {
+		if ((n = recv(sock_diag_fd, buf, sizeof(buf), 0)) < 0) {
+			if (errno == EINTR)
+				continue;
+			msg_syswarn("%s: recv", __FUNCTION__);
+			sock_diag_close();
+			return(0);
+		}
+		for (nlh = (struct nlmsghdr *)buf; NLMSG_OK(nlh, (size_t)n);
+		    nlh = NLMSG_NEXT(nlh, n)) {
+			/* skip answers to requests given up before and
+			   messages not addressed to the socket */
+			if (nlh->nlmsg_seq != sock_diag_seq ||
+			    nlh->nlmsg_pid != sock_diag_port)
+				continue;
+			if (nlh->nlmsg_type == NLMSG_DONE)
+				return(1);
+			if (nlh->nlmsg_type == NLMSG_ERROR) {
+				err = NLMSG_DATA(nlh);
+				/* protocol module isn't loaded or kernel
+				   is too old */
+				msg_debug(1, "%s: %s", __FUNCTION__,
+				    strerror(-err->error));
+				return(0);
+			}
+			if (nlh->nlmsg_type != SOCK_DIAG_BY_FAMILY)
+				continue;
+			if (cb->inet_func)
+				cb->inet_func(NLMSG_DATA(nlh), cb->arg);
+			else
+				sock_diag_unix_msg(nlh, cb);
+		}
+	}
+}
+
+/*****************************************************************************
+ * Extracts path, inode number and queue lengths of unix domain socket from
+ * message %nlh% and passes them to %cb%. Sockets without path are skipped.
+ *****************************************************************************/
+static void sock_diag_unix_msg(const struct nlmsghdr *nlh,
+    const struct sock_diag_cb *cb) {
+	const struct unix_diag_msg *msg = NLMSG_DATA(nlh);
+	const struct unix_diag_rqlen *rqlen = NULL;
+	struct rtattr *rta;
+	char path[sizeof(((struct sockaddr_un *)0)->sun_path) + 1];
+	size_t len;
+	int rta_len;
+
+	path[0] = 0;
+	rta = (struct rtattr *)(msg + 1);
+	rta_len = nlh->nlmsg_len - NLMSG_LENGTH(sizeof(struct unix_diag_msg));
+	for (; RTA_OK(rta, rta_len); rta = RTA_NEXT(rta, rta_len)) {
+		switch (rta->rta_type) {
+		case UNIX_DIAG_NAME:
+			if ((len = RTA_PAYLOAD(rta)) == 0)
+				break;
+			if (len > sizeof(path) - 1)
+				len = sizeof(path) - 1;
+			memcpy(path, RTA_DATA(rta), len);
+			path[len] = 0;
+			if (path[0] == 0)
+				path[0] = '@';
+			break;
+		case UNIX_DIAG_RQLEN:
+			if (RTA_PAYLOAD(rta) >= sizeof(*rqlen))
+				rqlen = RTA_DATA(rta);
+			break;
+		}
+	}
+	if (path[0])
+		cb->unix_func(path, msg->udiag_ino, rqlen, cb->arg);
+}
+
+/*****************************************************************************
+ * Builds filter accepting sockets bound to local port in one of %nports%
+ * ranges %ports% into %bc%. Returns length of the filter in bytes.
+ *
+ * Every range is checked by pair "sport >= lowest" and "sport <= highest"
+ * followed by unconditional jump to the end of the filter, which accepts
+ * the socket.
+ * Jump 4 bytes beyond the end rejects it. The kernel accepts only jumps to
+ * operations reachable through %yes% fields, so %yes% always points to the
+ * next operation and all jumps are taken through %no%.
+ *****************************************************************************/
+static int sock_diag_filter(struct inet_diag_bc_op *bc,
+    const uint16_t (*ports)[2], int nports) {
+	int i, len, rest;
+
+	len = nports * 5 * SOCK_DIAG_OP_SIZE;
+	for (i = 0; i < nports; i++, bc += 5) {
+		rest = len - i * 5 * SOCK_DIAG_OP_SIZE;
+		/* sport >= lowest, otherwise try the next range */
+		bc[0].code = INET_DIAG_BC_S_GE;
+		bc[0].yes = 2 * SOCK_DIAG_OP_SIZE;
+		bc[0].no = (i < nports - 1) ? 5 * SOCK_DIAG_OP_SIZE : rest + 4;
+		bc[1].no = ports[i][0];
+		/* sport <= highest, otherwise try the next range */
+		rest -= 2 * SOCK_DIAG_OP_SIZE;
+		bc[2].code = INET_DIAG_BC_S_LE;
+		bc[2].yes = 2 * SOCK_DIAG_OP_SIZE;
+		bc[2].no = (i < nports - 1) ? 3 * SOCK_DIAG_OP_SIZE : rest + 4;
+		bc[3].no = ports[i][1];
+		/* accept */
+		rest -= 2 * SOCK_DIAG_OP_SIZE;
+		bc[4].code = INET_DIAG_BC_JMP;
+		bc[4].yes = SOCK_DIAG_OP_SIZE;
+		bc[4].no = rest;
+	}
+	return(len);
+}
+#endif
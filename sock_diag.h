@@ -0,0 +1,21 @@
+/*
+ * Written by Vadim Guchenko <yhw@rambler-co.ru>
+ *
+ * 	$Id$
+ */
+
+#ifdef __linux__
+#include <linux/inet_diag.h>
+#include <linux/unix_diag.h>
+
+/* Maximum number of port ranges in filter passed to the kernel */
+#define SOCK_DIAG_PORTS_MAXN	64
+
+
+int sock_diag_inet(int, int, u_int, const uint16_t (*)[2], int,
+    void (*)(const struct inet_diag_msg *, void *), void *);
+int sock_diag_unix(u_int,
+    void (*)(const char *, u_int, const struct unix_diag_rqlen *, void *),
+    void *);
+void sock_diag_close(void);
+#endif
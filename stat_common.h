@@ -13,6 +13,7 @@
 //#include <osreldate.h>
 
 #include "conf.h"
+#include "output.h"
 
 
 time_t get_remote_tm(void);
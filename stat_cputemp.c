@@ -220,8 +220,8 @@ void do_cputemp() {
 		return;
 	avgtemp /= count;
 	tm = get_remote_tm();
-	printf("%lu cputemp_average %f\n", (u_long)tm, avgtemp);
-	printf("%lu cputemp_minimum %f\n", (u_long)tm, mintemp);
-	printf("%lu cputemp_maximum %f\n", (u_long)tm, maxtemp);
+	out_printf("%lu cputemp_average %f\n", (u_long)tm, avgtemp);
+	out_printf("%lu cputemp_minimum %f\n", (u_long)tm, mintemp);
+	out_printf("%lu cputemp_maximum %f\n", (u_long)tm, maxtemp);
 	msg_debug(1, "Processing of CPUTEMP command finished");
 }
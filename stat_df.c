@@ -25,6 +25,7 @@ void do_df() {
 	llong dfsize, dfsizeavail, dffree, dffreeavail, dfused;
 	long inodessize, inodesfree, inodesused;
 	double dfpercent, inodespercent;
+	const char *mnt;
 
 	msg_debug(1, "Processing of DF command started");
 
@@ -73,17 +74,18 @@ void do_df() {
 		inodespercent	= inodessize == 0 ? 100.0 :
 			(double)inodesused / (double)inodessize * 100.0;
 
-		printf("%lu dfsize:%s %lld\n",		(u_long)tm, mntbuf[i].f_mntonname, dfsize);
-		printf("%lu dfsizeavail:%s %lld\n",	(u_long)tm, mntbuf[i].f_mntonname, dfsizeavail);
-		printf("%lu dffree:%s %lld\n",		(u_long)tm, mntbuf[i].f_mntonname, dffree);
-		printf("%lu dffreeavail:%s %lld\n",	(u_long)tm, mntbuf[i].f_mntonname, dffreeavail);
-		printf("%lu dfused:%s %lld\n",		(u_long)tm, mntbuf[i].f_mntonname, dfused);
-		printf("%lu dfpercent:%s %.0f\n",	(u_long)tm, mntbuf[i].f_mntonname, dfpercent);
+		mnt = mntbuf[i].f_mntonname;
+		out_i64(tm, out_key("dfsize", mnt),		dfsize);
+		out_i64(tm, out_key("dfsizeavail", mnt),	dfsizeavail);
+		out_i64(tm, out_key("dffree", mnt),		dffree);
+		out_i64(tm, out_key("dffreeavail", mnt),	dffreeavail);
+		out_i64(tm, out_key("dfused", mnt),		dfused);
+		out_double(tm, out_key("dfpercent", mnt),	dfpercent, 0);
 
-		printf("%lu inodessize:%s %ld\n",	(u_long)tm, mntbuf[i].f_mntonname, inodessize);
-		printf("%lu inodesfree:%s %ld\n",	(u_long)tm, mntbuf[i].f_mntonname, inodesfree);
-		printf("%lu inodesused:%s %ld\n",	(u_long)tm, mntbuf[i].f_mntonname, inodesused);
-		printf("%lu inodespercent:%s %.0f\n",	(u_long)tm, mntbuf[i].f_mntonname, inodespercent);
+		out_i64(tm, out_key("inodessize", mnt),		inodessize);
+		out_i64(tm, out_key("inodesfree", mnt),		inodesfree);
+		out_i64(tm, out_key("inodesused", mnt),		inodesused);
+		out_double(tm, out_key("inodespercent", mnt),	inodespercent, 0);
 	}
 #ifdef __linux__    
     free_mntbuf(&mntbuf, mntsize);
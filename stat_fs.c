@@ -43,6 +43,7 @@ void stat_fs() {
 	llong space_size, space_size_avail, space_free, space_free_avail, space_used;
 	long inodes_size, inodes_free, inodes_used;
 	double space_used_ratio, inodes_used_ratio;
+	const char *mnt;
 
 	msg_debug(1, "Processing of FS command started");
 
@@ -80,7 +81,7 @@ void stat_fs() {
 		/* process FS_LIST command */
 		if (f_stat_fs_command_fs_list) {
 			tm = get_remote_tm();
-			printf("%lu fs_exists:%s 1\n", (u_long)tm, mntbuf[i].f_mntonname);
+			out_printf("%lu fs_exists:%s 1\n", (u_long)tm, mntbuf[i].f_mntonname);
 		}
 
 		/* go to the next file system if no FS command given */
@@ -108,27 +109,18 @@ void stat_fs() {
 		    (double)inodes_used / (double)inodes_size * 100.0;
 
 		tm = get_remote_tm();
-		printf("%lu fs_space_size:%s %lld\n",
-		    (u_long)tm, mntbuf[i].f_mntonname, space_size);
-		printf("%lu fs_space_size_avail:%s %lld\n",
-		    (u_long)tm, mntbuf[i].f_mntonname, space_size_avail);
-		printf("%lu fs_space_free:%s %lld\n",
-		    (u_long)tm, mntbuf[i].f_mntonname, space_free);
-		printf("%lu fs_space_free_avail:%s %lld\n",
-		    (u_long)tm, mntbuf[i].f_mntonname, space_free_avail);
-		printf("%lu fs_space_used:%s %lld\n",
-		    (u_long)tm, mntbuf[i].f_mntonname, space_used);
-		printf("%lu fs_space_used_ratio:%s %.0f\n",
-		    (u_long)tm, mntbuf[i].f_mntonname, space_used_ratio);
-
-		printf("%lu fs_inodes_size:%s %ld\n",
-		    (u_long)tm, mntbuf[i].f_mntonname, inodes_size);
-		printf("%lu fs_inodes_free:%s %ld\n",
-		    (u_long)tm, mntbuf[i].f_mntonname, inodes_free);
-		printf("%lu fs_inodes_used:%s %ld\n",
-		    (u_long)tm, mntbuf[i].f_mntonname, inodes_used);
-		printf("%lu fs_inodes_used_ratio:%s %.0f\n",
-		    (u_long)tm, mntbuf[i].f_mntonname, inodes_used_ratio);
+		mnt = mntbuf[i].f_mntonname;
+		out_i64(tm, out_key("fs_space_size", mnt),		space_size);
+		out_i64(tm, out_key("fs_space_size_avail", mnt),	space_size_avail);
+		out_i64(tm, out_key("fs_space_free", mnt),		space_free);
+		out_i64(tm, out_key("fs_space_free_avail", mnt),	space_free_avail);
+		out_i64(tm, out_key("fs_space_used", mnt),		space_used);
+		out_double(tm, out_key("fs_space_used_ratio", mnt),	space_used_ratio, 0);
+
+		out_i64(tm, out_key("fs_inodes_size", mnt),		inodes_size);
+		out_i64(tm, out_key("fs_inodes_free", mnt),		inodes_free);
+		out_i64(tm, out_key("fs_inodes_used", mnt),		inodes_used);
+		out_double(tm, out_key("fs_inodes_used_ratio", mnt),	inodes_used_ratio, 0);
 	}
 #ifdef __linux__    
     free_mntbuf(&mntbuf, mntsize);
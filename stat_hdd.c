@@ -248,7 +248,7 @@ void stat_hdd() {
 	f_ata_request_supported = stat_hdd_is_ata_request_supported();
 	if (f_stat_hdd_command_hdd || f_stat_hdd_command_smart) {
 		tm = get_remote_tm();
-		printf("%lu ata_request_supported %d\n", (u_long)tm, f_ata_request_supported);
+		out_printf("%lu ata_request_supported %d\n", (u_long)tm, f_ata_request_supported);
 	}
 
 	/* determine number of ATA channels */
@@ -288,7 +288,7 @@ void stat_hdd() {
 				/* process HDD_LIST command */
 				if (f_stat_hdd_command_hdd_list) {
 					tm = get_remote_tm();
-					printf("%lu hdd_exists:%s 1\n", (u_long)tm, dev[device].name);
+					out_printf("%lu hdd_exists:%s 1\n", (u_long)tm, dev[device].name);
 				}
 	
 				/* go to the next device if no HDD or SMART command given */
@@ -307,15 +307,15 @@ void stat_hdd() {
 					sectors = stat_hdd_get_device_size(&dev[device]);
 	
 					tm = get_remote_tm();
-					printf("%lu hdd_model:%s %s\n",
+					out_printf("%lu hdd_model:%s %s\n",
 					    (u_long)tm, dev[device].name, dev[device].model);
-					printf("%lu hdd_serno:%s %s\n",
+					out_printf("%lu hdd_serno:%s %s\n",
 					    (u_long)tm, dev[device].name, dev[device].serial);
-					printf("%lu hdd_revision:%s %s\n",
+					out_printf("%lu hdd_revision:%s %s\n",
 					    (u_long)tm, dev[device].name, dev[device].revision);
-					printf("%lu hdd_size_sectors:%s %llu\n",
+					out_printf("%lu hdd_size_sectors:%s %llu\n",
 					    (u_long)tm, dev[device].name, sectors);
-					printf("%lu hdd_size_mbytes:%s %llu\n",
+					out_printf("%lu hdd_size_mbytes:%s %llu\n",
 					    (u_long)tm, dev[device].name, sectors >> 11);
 	
 					/* print devstat statistics of device */
@@ -344,9 +344,9 @@ void stat_hdd() {
 				}
 	
 				tm = get_remote_tm();
-				printf("%lu smart_supported:%s %d\n",
+				out_printf("%lu smart_supported:%s %d\n",
 				    (u_long)tm, dev[device].name, f_smart_supported);
-				printf("%lu smart_enabled:%s %d\n",
+				out_printf("%lu smart_enabled:%s %d\n",
 				    (u_long)tm, dev[device].name, f_smart_enabled);
 	
 				/* don't try to get SMART if no attributes requested */
@@ -499,21 +499,21 @@ void stat_hdd() {
 
 					if (f_stat_hdd_command_hdd_list) {
 						tm = get_remote_tm();
-						printf("%lu hdd_exists:%s 1\n",
+						out_printf("%lu hdd_exists:%s 1\n",
 							(u_long)tm, dev[0].name);
 					}
 					if (f_stat_hdd_command_hdd) {
 						sectors = stat_hdd_get_device_size(&dev[0]);
 						tm = get_remote_tm();
-						printf("%lu hdd_model:%s %s\n",
+						out_printf("%lu hdd_model:%s %s\n",
 							(u_long)tm, dev[0].name, dev[0].model);
-						printf("%lu hdd_serno:%s %s\n",
+						out_printf("%lu hdd_serno:%s %s\n",
 							(u_long)tm, dev[0].name, dev[0].serial);
-						printf("%lu hdd_revision:%s %s\n",
+						out_printf("%lu hdd_revision:%s %s\n",
 							(u_long)tm, dev[0].name, dev[0].revision);
-						printf("%lu hdd_size_sectors:%s %llu\n",
+						out_printf("%lu hdd_size_sectors:%s %llu\n",
 							(u_long)tm, dev[0].name, sectors);
-						printf("%lu hdd_size_mbytes:%s %llu\n",
+						out_printf("%lu hdd_size_mbytes:%s %llu\n",
 							(u_long)tm, dev[0].name, sectors >> 11);
 						stat_hdd_print_devstat(dev[0].name);
 					}
@@ -536,8 +536,8 @@ void stat_hdd() {
 						msg_notice("SMART has been successfully enabled on device %s", dev[0].name);
 					}
 					tm = get_remote_tm();
-					printf("%lu smart_supported:%s %d\n", (u_long)tm, dev[0].name, f_smart_supported);
-					printf("%lu smart_enabled:%s %d\n", (u_long)tm, dev[0].name, f_smart_enabled);
+					out_printf("%lu smart_supported:%s %d\n", (u_long)tm, dev[0].name, f_smart_supported);
+					out_printf("%lu smart_enabled:%s %d\n", (u_long)tm, dev[0].name, f_smart_enabled);
 					if (!f_stat_hdd_smart_attrs_requested) {
 						msg_debug(2, "%s: No SMART attributes requested", __FUNCTION__);
 						break;
@@ -571,13 +571,13 @@ void stat_hdd() {
 		snprintf(dev[0].name, sizeof(dev[0].name), "%s%d", dinfo.devices[i].device_name, dinfo.devices[i].unit_number);
 		if (f_stat_hdd_command_hdd_list) {
 			tm = get_remote_tm();
-			printf("%lu hdd_exists:%s 1\n", (u_long)tm, dev[0].name);
+			out_printf("%lu hdd_exists:%s 1\n", (u_long)tm, dev[0].name);
 		}
 		if (f_stat_hdd_command_hdd) {
 			stat_hdd_print_devstat(dev[0].name);
 		}
 /*
-		printf("device %s, unit %d, type %x\n",
+		out_printf("device %s, unit %d, type %x\n",
 			dinfo.devices[i].device_name, dinfo.devices[i].unit_number,
 			dinfo.devices[i].device_type & DEVSTAT_TYPE_MASK);
 */
@@ -695,19 +695,19 @@ static void stat_hdd_print_devstat(const char *name) {
 
 	/* print statistics */
 	tm = dinfo_tm;
-	printf("%lu hdd_busy_time:%s %lu\n", (u_long)tm, name, busy_sec);
-	printf("%lu hdd_bytes_read:%s %llu\n", (u_long)tm, name, (u_llong)bytes_read);
-	printf("%lu hdd_bytes_written:%s %llu\n", (u_long)tm, name, (u_llong)bytes_written);
-	printf("%lu hdd_bytes_deleted:%s %llu\n", (u_long)tm, name, (u_llong)bytes_deleted);
+	out_printf("%lu hdd_busy_time:%s %lu\n", (u_long)tm, name, busy_sec);
+	out_printf("%lu hdd_bytes_read:%s %llu\n", (u_long)tm, name, (u_llong)bytes_read);
+	out_printf("%lu hdd_bytes_written:%s %llu\n", (u_long)tm, name, (u_llong)bytes_written);
+	out_printf("%lu hdd_bytes_deleted:%s %llu\n", (u_long)tm, name, (u_llong)bytes_deleted);
 #if __FreeBSD_version >= 500000
-	printf("%lu hdd_operations_read:%s %llu\n", (u_long)tm, name, (unsigned long long) (0ll+ds->operations[DEVSTAT_READ]));
-	printf("%lu hdd_operations_written:%s %llu\n", (u_long)tm, name, (unsigned long long) (0ll+ds->operations[DEVSTAT_WRITE]));
-	printf("%lu hdd_operations_deleted:%s %llu\n", (u_long)tm, name, (unsigned long long) (0ll+ds->operations[DEVSTAT_FREE]));
-	printf("%lu hdd_duration_read:%s %lu\n", (u_long)tm, name, (0l+ds->duration[DEVSTAT_READ].sec));
-	printf("%lu hdd_duration_written:%s %lu\n", (u_long)tm, name, (0l+ds->duration[DEVSTAT_WRITE].sec));
-	printf("%lu hdd_duration_deleted:%s %lu\n", (u_long)tm, name, (0l+ds->duration[DEVSTAT_FREE].sec));
-
-	printf("%lu hdd_operations_queue_length:%s %llu\n", (u_long)tm, name, qlen);
+	out_printf("%lu hdd_operations_read:%s %llu\n", (u_long)tm, name, (unsigned long long) (0ll+ds->operations[DEVSTAT_READ]));
+	out_printf("%lu hdd_operations_written:%s %llu\n", (u_long)tm, name, (unsigned long long) (0ll+ds->operations[DEVSTAT_WRITE]));
+	out_printf("%lu hdd_operations_deleted:%s %llu\n", (u_long)tm, name, (unsigned long long) (0ll+ds->operations[DEVSTAT_FREE]));
+	out_printf("%lu hdd_duration_read:%s %lu\n", (u_long)tm, name, (0l+ds->duration[DEVSTAT_READ].sec));
+	out_printf("%lu hdd_duration_written:%s %lu\n", (u_long)tm, name, (0l+ds->duration[DEVSTAT_WRITE].sec));
+	out_printf("%lu hdd_duration_deleted:%s %lu\n", (u_long)tm, name, (0l+ds->duration[DEVSTAT_FREE].sec));
+
+	out_printf("%lu hdd_operations_queue_length:%s %llu\n", (u_long)tm, name, qlen);
 #endif
 }
 
@@ -1420,8 +1420,8 @@ void stat_hdd_process_smart_attributes(const struct ata_device *dev) {
 	tm = get_remote_tm();
 #ifdef __linux__    
     if(!parse_disk(&smart_data, dev, 1)) {
-        printf("%lu smart_supported:%s %d\n", tm, GET_DEV_NAME, smart_data.smart_supported);
-        printf("%lu smart_enabled:%s %d\n", tm, GET_DEV_NAME, smart_data.smart_enabled);
+        out_printf("%lu smart_supported:%s %d\n", tm, GET_DEV_NAME, smart_data.smart_supported);
+        out_printf("%lu smart_enabled:%s %d\n", tm, GET_DEV_NAME, smart_data.smart_enabled);
     } else 
         msg_err(0, "Can't parse disk %s", dev);
 	for (i = 1; i < MAX_SMART_ATTR_ID; i++) {
@@ -1475,15 +1475,15 @@ void stat_hdd_process_smart_attributes(const struct ata_device *dev) {
 		raw_value = (uint64_t)raw_word[0] |
 		    (uint64_t)raw_word[1] << 16 |
 		    (uint64_t)raw_word[2] << 32;
-		printf("%lu smart_%u_flags:%s %u\n",	(u_long)tm, (u_int)id, GET_DEV_NAME,
+		out_printf("%lu smart_%u_flags:%s %u\n",	(u_long)tm, (u_int)id, GET_DEV_NAME,
 		    flags);
-		printf("%lu smart_%u_value:%s %u\n",	(u_long)tm, (u_int)id, GET_DEV_NAME,
+		out_printf("%lu smart_%u_value:%s %u\n",	(u_long)tm, (u_int)id, GET_DEV_NAME,
 		    value);
-		printf("%lu smart_%u_worst:%s %u\n",	(u_long)tm, (u_int)id, GET_DEV_NAME,
+		out_printf("%lu smart_%u_worst:%s %u\n",	(u_long)tm, (u_int)id, GET_DEV_NAME,
 		    worst);
-		printf("%lu smart_%u_thresh:%s %u\n",	(u_long)tm, (u_int)id, GET_DEV_NAME,
+		out_printf("%lu smart_%u_thresh:%s %u\n",	(u_long)tm, (u_int)id, GET_DEV_NAME,
 		    thresh);
-		printf("%lu smart_%u_raw:%s %llu\n",	(u_long)tm, (u_int)id, GET_DEV_NAME,
+		out_printf("%lu smart_%u_raw:%s %llu\n",	(u_long)tm, (u_int)id, GET_DEV_NAME,
 #ifndef __linux__        
 		    (u_llong)raw_value);
 #else            
@@ -1497,10 +1497,10 @@ void stat_hdd_process_smart_attributes(const struct ata_device *dev) {
 			cur = raw_word[0];
 			avg = raw_word[1];
 			if (cur)
-				printf("%lu smart_spinup_time:%s %d\n", (u_long)tm,
+				out_printf("%lu smart_spinup_time:%s %d\n", (u_long)tm,
 				    GET_DEV_NAME, cur);
 			if (avg)
-				printf("%lu smart_spinup_time_avg:%s %d\n", (u_long)tm,
+				out_printf("%lu smart_spinup_time_avg:%s %d\n", (u_long)tm,
 				    GET_DEV_NAME, avg);
 			break;
 		/* temperature */
@@ -1508,16 +1508,16 @@ void stat_hdd_process_smart_attributes(const struct ata_device *dev) {
 			cur = raw_word[0];
 			min = VG_MIN(raw_word[1], raw_word[2]);
 			max = VG_MAX(raw_word[1], raw_word[2]);
-			printf("%lu smart_temp:%s %d\n", (u_long)tm, GET_DEV_NAME, cur);
+			out_printf("%lu smart_temp:%s %d\n", (u_long)tm, GET_DEV_NAME, cur);
 			if (min && max && cur >= min && cur <= max) {
-				printf("%lu smart_temp_min:%s %d\n", (u_long)tm,
+				out_printf("%lu smart_temp_min:%s %d\n", (u_long)tm,
 				    GET_DEV_NAME, min);
-				printf("%lu smart_temp_max:%s %d\n", (u_long)tm,
+				out_printf("%lu smart_temp_max:%s %d\n", (u_long)tm,
 				    GET_DEV_NAME, max);
 			}
 			break;
 		}
 	}
 
-	printf("%lu smart_failed:%s %u\n", (u_long)tm, GET_DEV_NAME, f_failed_max);
+	out_printf("%lu smart_failed:%s %u\n", (u_long)tm, GET_DEV_NAME, f_failed_max);
 }
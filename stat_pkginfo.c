@@ -46,7 +46,7 @@ void do_pkginfo() {
 			continue;
 		strlcpy(filename+strlen(PKGDIR), dp->d_name, sizeof(filename)-strlen(PKGDIR));
 		if (stat(filename, &sb) == 0) {
-			printf("%lu pkg_ctime:%s %lu\n", (u_long)tm, dp->d_name, 0lu+sb.st_ctime);
+			out_printf("%lu pkg_ctime:%s %lu\n", (u_long)tm, dp->d_name, 0lu+sb.st_ctime);
 		}
 		strlcat(filename, "/+CONTENTS", sizeof(filename));
 		if ((contents=fopen(filename, "r")) == NULL) {
@@ -56,16 +56,16 @@ void do_pkginfo() {
 		while (fgets(buf, sizeof(buf), contents) != NULL) {
 			parse_chomp(buf);
 			if (parse_get_str(buf, &p, "@name") && parse_get_wspace(p, &p)) {
-				printf("%lu pkg_exist:%s 1\n", (u_long)tm, p);
+				out_printf("%lu pkg_exist:%s 1\n", (u_long)tm, p);
 			} else if (parse_get_str(buf, &p, "@comment") && parse_get_wspace(p, &p) && parse_get_str(p, &p, "ORIGIN:")) {
-				printf("%lu pkg_origin:%s %s\n", (u_long)tm, dp->d_name, p);
+				out_printf("%lu pkg_origin:%s %s\n", (u_long)tm, dp->d_name, p);
 			}
 		}
 		fclose(contents);
 		pkgs ++;
 	}
 	closedir(pkgdir);
-	printf("%lu pkg_count %u\n", (u_long)tm, pkgs);
+	out_printf("%lu pkg_count %u\n", (u_long)tm, pkgs);
 	msg_debug(1, "Processing of PKGINFO command finished");
 }
 
@@ -92,7 +92,7 @@ static void stat_raid_process_geom_class(struct gclass *classp) {
 		/* process RAID_LIST command */
 		if (f_stat_raid_command_raid_list) {
 			tm = get_remote_tm();
-			printf("%lu raid_exists:%s 1\n", (u_long)tm, name);
+			out_printf("%lu raid_exists:%s 1\n", (u_long)tm, name);
 		}
 
 		/* go to the next RAID if no RAID command given */
@@ -131,8 +131,8 @@ static void stat_raid_process_geom_class(struct gclass *classp) {
 
 		tm = get_remote_tm();
 		if (state)
-			printf("%lu raid_state:%s %s\n", (u_long)tm, name, state);
-		printf("%lu raid_state_error:%s %d\n", (u_long)tm, name, state_error);
+			out_printf("%lu raid_state:%s %s\n", (u_long)tm, name, state);
+		out_printf("%lu raid_state_error:%s %d\n", (u_long)tm, name, state_error);
 	}
 }
 #endif
@@ -356,13 +356,13 @@ void stat_smbios_decode_struct(struct smbios_s *smbios, struct decode_state *dec
 	    smbios->h.length)
 #define print_field_as_string(var, field)						\
 	if (is_field_exists(field) && smbios->field && smbios->field <= strings_n)	\
-		printf("%lu " var " %s\n", (u_long)tm, str[smbios->field - 1])
+		out_printf("%lu " var " %s\n", (u_long)tm, str[smbios->field - 1])
 #define print_param_field_as_string(var, num, field)						\
 	if (is_field_exists(field) && smbios->field && smbios->field <= strings_n)	\
-		printf("%lu " var ":%u %s\n", (u_long)tm, num, str[smbios->field - 1])
+		out_printf("%lu " var ":%u %s\n", (u_long)tm, num, str[smbios->field - 1])
 #define print_param_field_as_num(var, num, field)	\
 	if (is_field_exists(field) && smbios->field)	 \
-		printf("%lu " var ":%u %d\n", (u_long)tm, num, smbios->field)
+		out_printf("%lu " var ":%u %d\n", (u_long)tm, num, smbios->field)
 
 	switch (smbios->h.type) {
 	case 0: /* BIOS Information */
@@ -381,7 +381,7 @@ void stat_smbios_decode_struct(struct smbios_s *smbios, struct decode_state *dec
 		print_field_as_string("system_serial_number", u.system.serial_number);
 		break;
 	case 2: /* Base Board Information */
-		printf("%lu module_handle:%u %u\n", (u_long)tm, decode_state->modules, smbios->h.handle);
+		out_printf("%lu module_handle:%u %u\n", (u_long)tm, decode_state->modules, smbios->h.handle);
 		print_param_field_as_num("module_type", decode_state->modules, u.module.type);
 		if (is_field_exists(u.module.type) && smbios->u.module.type == 10) {
 			print_field_as_string("base_board_manufacturer", u.module.manufacturer);
@@ -391,7 +391,7 @@ void stat_smbios_decode_struct(struct smbios_s *smbios, struct decode_state *dec
 			print_field_as_string("base_board_asset_tag", u.module.asset_tag);
 			print_field_as_string("base_board_location", u.module.location);
 			if (is_field_exists(u.module.chassis_handle) && smbios->u.module.chassis_handle)
-				printf("%lu base_board_chassis_handle %u\n", (u_long)tm, smbios->u.module.chassis_handle);
+				out_printf("%lu base_board_chassis_handle %u\n", (u_long)tm, smbios->u.module.chassis_handle);
 		}
 		print_param_field_as_string("module_manufacturer", decode_state->modules, u.module.manufacturer);
 		print_param_field_as_string("module_product_name", decode_state->modules, u.module.product_name);
@@ -400,11 +400,11 @@ void stat_smbios_decode_struct(struct smbios_s *smbios, struct decode_state *dec
 		print_param_field_as_string("module_asset_tag", decode_state->modules, u.module.asset_tag);
 		print_param_field_as_string("module_location", decode_state->modules, u.module.location);
 		if (is_field_exists(u.module.chassis_handle) && smbios->u.module.chassis_handle)
-			printf("%lu module_chassis_handle:%u %u\n", (u_long)tm, decode_state->modules, smbios->u.module.chassis_handle);
+			out_printf("%lu module_chassis_handle:%u %u\n", (u_long)tm, decode_state->modules, smbios->u.module.chassis_handle);
 		break;
 		decode_state->modules++;
 	case 3: /* System Enclosure or Chassis */
-		printf("%lu chassis_handle:%u %u\n", (u_long)tm, decode_state->modules, smbios->h.handle);
+		out_printf("%lu chassis_handle:%u %u\n", (u_long)tm, decode_state->modules, smbios->h.handle);
 		print_param_field_as_num("chassis_type", decode_state->chassis, u.chassis.type);
 		print_param_field_as_string("chassis_manufacturer", decode_state->chassis, u.chassis.manufacturer);
 		print_param_field_as_string("chassis_version", decode_state->chassis, u.chassis.version);
@@ -435,16 +435,16 @@ void stat_smbios_decode_struct(struct smbios_s *smbios, struct decode_state *dec
 		decode_state->processors++;
 		break;
 	case 17: /* Memory Device  */
-		printf("%lu memory_handle:%u %u\n", (u_long)tm, decode_state->memory_devs, smbios->h.handle);
+		out_printf("%lu memory_handle:%u %u\n", (u_long)tm, decode_state->memory_devs, smbios->h.handle);
 		if (is_field_exists(u.memory.physical_handle))
-			printf("%lu physical_memory_handle:%hhu %hu\n", (u_long)tm, decode_state->memory_devs, smbios->u.memory.physical_handle);
+			out_printf("%lu physical_memory_handle:%hhu %hu\n", (u_long)tm, decode_state->memory_devs, smbios->u.memory.physical_handle);
 		if (is_field_exists(u.memory.size)) {
 			size = smbios->u.memory.size;
 			if (size & 0x8000)
 				size &= ~(0x8000);
 			else
 				size *= 1024;
-			printf("%lu memory_size_kb:%hhu %lu\n", (u_long)tm, decode_state->memory_devs, size);
+			out_printf("%lu memory_size_kb:%hhu %lu\n", (u_long)tm, decode_state->memory_devs, size);
 		}
 		print_param_field_as_num("memory_form_factor", decode_state->memory_devs, u.memory.form_factor);
 		print_param_field_as_string("memory_device_locator", decode_state->memory_devs, u.memory.device_locator);
@@ -41,22 +41,22 @@ void stat_swap_activity() {
 	value = 0;
 	if (sysctl_get_by_name("vm.stats.vm.v_swapout", &value, sizeof(value), 0)) {
 		tm = get_remote_tm();
-		printf("%lu swap_operations_out %llu\n", (u_long)tm, value);
+		out_printf("%lu swap_operations_out %llu\n", (u_long)tm, value);
 	}
 	value = 0;
 	if (sysctl_get_by_name("vm.stats.vm.v_swapin", &value, sizeof(value), 0)) {
 		tm = get_remote_tm();
-		printf("%lu swap_operations_in %llu\n", (u_long)tm, value);
+		out_printf("%lu swap_operations_in %llu\n", (u_long)tm, value);
 	}
 	value = 0;
 	if (sysctl_get_by_name("vm.stats.vm.v_swappgsout", &value, sizeof(value), 0)) {
 		tm = get_remote_tm();
-		printf("%lu swap_pages_out %llu\n", (u_long)tm, value);
+		out_printf("%lu swap_pages_out %llu\n", (u_long)tm, value);
 	}
 	value = 0;
 	if (sysctl_get_by_name("vm.stats.vm.v_swappgsin", &value, sizeof(value), 0)) {
 		tm = get_remote_tm();
-		printf("%lu swap_pages_in %llu\n", (u_long)tm, value);
+		out_printf("%lu swap_pages_in %llu\n", (u_long)tm, value);
 	}
 }
 
@@ -94,11 +94,11 @@ void stat_swap_space_usage() {
 
 	/* print swap statistics */
 	tm = get_remote_tm();
-	printf("%lu swap_exists %d\n", (u_long)tm, f_swap_exists);
-	printf("%lu swap_space_size %lld\n", (u_long)tm, space_size);
-	printf("%lu swap_space_used %lld\n", (u_long)tm, space_used);
-	printf("%lu swap_space_free %lld\n", (u_long)tm, space_free);
-	printf("%lu swap_space_used_ratio %.0f\n", (u_long)tm, space_used_ratio);
+	out_printf("%lu swap_exists %d\n", (u_long)tm, f_swap_exists);
+	out_printf("%lu swap_space_size %lld\n", (u_long)tm, space_size);
+	out_printf("%lu swap_space_used %lld\n", (u_long)tm, space_used);
+	out_printf("%lu swap_space_free %lld\n", (u_long)tm, space_free);
+	out_printf("%lu swap_space_used_ratio %.0f\n", (u_long)tm, space_used_ratio);
 
 	/* close kvm descriptor */
 	kvm_close(kd);
@@ -25,7 +25,7 @@ u_int sysctl_n = 0;
 		    (u_llong)size, (u_llong)sizeof(TYPE));			\
 		continue;							\
 	}									\
-	printf("%lu sysctl_%s "FORMAT"\n", (u_long)tm, var, *(TYPE *)valbuf);	\
+	out_printf("%lu sysctl_%s "FORMAT"\n", (u_long)tm, var, *(TYPE *)valbuf);	\
 }
 
 /*****************************************************************************
@@ -110,7 +110,7 @@ void stat_sysctl() {
 		else if (strcmp(fmt, "QU") == 0)
 			OUTPUT_VAR("%qu", u_llong)
 		else if (strcmp(fmt, "A") == 0)
-			printf("%lu sysctl_%s %.*s\n", (u_long)tm, var, (int) size, valbuf);
+			out_printf("%lu sysctl_%s %.*s\n", (u_long)tm, var, (int) size, valbuf);
 	}
 
 	msg_debug(1, "Processing of SYSCTL command finished");
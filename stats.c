@@ -7,6 +7,7 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <sys/time.h>
+#include <sys/mman.h>
 #include <sys/sysctl.h>
 #include <sys/param.h>
 #include <sys/mount.h>
@@ -29,6 +30,8 @@
 #include <errno.h>
 #include <signal.h>
 #include <fcntl.h>
+#include <ctype.h>
+#include <math.h>
 #include <ifaddrs.h>
 #ifndef __linux__
     #include <sys/dkstat.h>
@@ -50,12 +53,86 @@
 #else
     #include <dirent.h>
     #include <netpacket/packet.h>
+    #include <netinet/tcp.h>
+    #include <arpa/inet.h>
 #endif
 #include "conf.h"
 #include "stat.h"
-
-/* Maximum time in seconds available for each child process */
-#define CHILD_TIMEOUT		15
+#include "stats.h"
+#include "output.h"
+#include "cache.h"
+#include "pool.h"
+#include "sched.h"
+#include "sock_diag.h"
+#include "proc_net.h"
+#include "sketch.h"
+#include "window.h"
+#include "rollup.h"
+#include "diskstats.h"
+#include "rtnl.h"
+#include "table.h"
+
+/* FNV-1a hash */
+#define FNV_INIT		2166136261U
+#define FNV_STEP(h, c)		(((h) ^ (u_int)(c)) * 16777619U)
+
+/* Minimum size of hash table of configured sockets, power of 2 */
+#define SOCK_HASH_MIN_SIZE	16
+
+/* Definition of socket %i% of index, configured or discovered one */
+#define SOCK_CONF(i)		((i) < conf.socket_count ? \
+				    &conf.socket_conf[i] : \
+				    &sock_auto[(i) - conf.socket_count].sc)
+
+/* Number of sockets in index */
+#define SOCK_COUNT		(conf.socket_count + sock_auto_count)
+
+/* Duration of period of HDD queue quantiles in seconds */
+#define HDD_QUEUE_PERIOD	300
+
+/* Maximum length of HDD name including unit number not including null */
+#define HDD_NAME_MAXLEN		31
+
+/* Period of HDD utilization, IOPS and latency in seconds */
+#define HDD_RATE_PERIOD		60
+
+/* Size of sector in /proc/diskstats */
+#define DISKSTATS_SECTOR_SIZE	512
+
+/* Number of rates calculated for every interface, see %if_rate_names% */
+#define IF_RATE_MAXN		6
+
+/* Number of periods of average and peak interface rates, see
+   %if_rate_periods% */
+#define IF_RATE_PERIODS		3
+
+/* Length of interval in seconds for which the maximum rate is kept */
+#define IF_PEAK_INTERVAL	10
+
+/* Number of intervals in the longest period of peak interface rates */
+#define IF_PEAK_INTERVALS	90
+
+/* Interval in milliseconds of sampler of sockets in burst when there are no
+   such sockets, it's woken up by sampler of all sockets */
+#define SOCK_BURST_IDLE		60000
+
+/* Structure for cumulative 64-bit interface counters */
+struct if_counters {
+	u_llong ipackets;
+	u_llong ibytes;
+	u_llong ierrors;
+	u_llong opackets;
+	u_llong obytes;
+	u_llong oerrors;
+	u_llong collisions;
+#ifdef __linux__
+	u_llong idrops;
+	u_llong odrops;
+	u_llong ififo;
+	u_llong ofifo;
+	u_llong imcasts;
+#endif
+};
 
 /* Structure for interface statistics */
 struct if_stats {
@@ -63,6 +140,7 @@ struct if_stats {
 	char ifname[IFNAMSIZ];
 	/* this flag shows whether current element of array used or not */
 	int f_used;
+#ifndef __linux__
 	/* raw 32-bit interface counters retrieved on previous iteration */
 	struct {
 		u_long ipackets;
@@ -73,28 +151,56 @@ struct if_stats {
 		u_long oerrors;
 		u_long collisions;
 	} prev;
-	/* current cumulative 64-bit interface counters */
-	struct {
-		u_llong ipackets;
-		u_llong ibytes;
-		u_llong ierrors;
-		u_llong opackets;
-		u_llong obytes;
-		u_llong oerrors;
-		u_llong collisions;
-	} cur;
+#endif
+	/* current interface counters */
+	struct if_counters cur;
+	/* counters and monotonic time in milliseconds of the previous sample,
+	   time is 0 before the first sample */
+	u_llong	rate_base[IF_RATE_MAXN];
+	u_llong	rate_base_ms;
+	/* this flag shows that rates below are calculated */
+	char	f_rates;
+	/* rates per second between the last two samples, their exponentially
+	   weighted averages and maximums over %if_rate_periods% */
+	double	rate[IF_RATE_MAXN];
+	double	rate_avg[IF_RATE_MAXN][IF_RATE_PERIODS];
+	double	rate_peak[IF_RATE_MAXN][IF_RATE_PERIODS];
+	/* maximum rates during the last %IF_PEAK_INTERVALS% intervals of
+	   %IF_PEAK_INTERVAL% seconds, ring indexed by number of interval */
+	double	peak_max[IF_PEAK_INTERVALS][IF_RATE_MAXN];
+	u_llong	peak_interval[IF_PEAK_INTERVALS];
+};
+
+/* Structure for bursts of socket queue over threshold */
+struct sock_burst {
+	/* this flag shows that queue is over threshold now */
+	int	f_active;
+	/* number of bursts and total time in milliseconds over threshold */
+	u_long	count;
+	u_llong	time;
+	/* duration in milliseconds and maximum queue length of the current
+	   or the last burst */
+	u_llong	duration;
+	int	peak;
+	/* monotonic time in milliseconds when the current burst started and
+	   when queue was sampled last time */
+	u_llong	start_ms;
+	u_llong	last_ms;
 };
 
 /* Structure for sockets load average */
 struct socket_la {
 	char	var[VAR_MAXLEN + 1];
-	int	qlen[300];
+	/* number of socket in index, see SOCK_CONF() */
+	int	conf;
+	/* queue lengths, -1 if socket didn't exist */
+	struct window qlen;
+	/* history of queue lengths for the last hour */
+	struct rollup history;
 	u_int	incqlen;
 	u_int	qlimit;
-	u_int	last_ptr;
-	u_int	first_ptr;
-	u_int	entries;
-	double	sum;
+	/* bursts of queue over %conf.socket_burst% percents of limit */
+	struct sock_burst burst;
 /* caching KVM pointers for fast updating w/o lookups in sysctl */
 #ifndef __linux__
 	u_quad_t	gencnt;
@@ -103,51 +209,272 @@ struct socket_la {
 #endif
 };
 
-/* Array of sockets */
-struct socket_la sockets_la[SOCKET_MAXN];
-
-/* Last update time for sockets */
-struct timespec sockets_ltime;
+/* Array of sockets, there is no more sockets than configured ones */
+struct socket_la *sockets_la = NULL;
 
 /* Number of elements in sockets_la array */
 int sockets_count = 0;
 
-#ifndef __linux__
+/* Number of allocated elements of %sockets_la%, %sock_hash_next%,
+   %sock_slot% and %sock_mask% arrays */
+int sock_index_size = 0;
+
+/* Hash table of configured and discovered sockets by address, heads of
+   chains of socket numbers in index (see SOCK_CONF()) or -1, size is
+   power of 2 */
+int *sock_hash_head = NULL;
+u_int sock_hash_size = 0;
+/* Next socket in chain for every socket of index or -1 */
+int *sock_hash_next = NULL;
+/* Element of %sockets_la% for every socket of index or -1 */
+int *sock_slot = NULL;
+/* Flags of %sockets_la% elements found during the current sample */
+char *sock_mask = NULL;
+/* Time when sockets are sampled */
+time_t sock_sample_tm;
+/* Monotonic time in milliseconds when sockets are sampled */
+u_llong sock_sample_ms;
+/* This flag shows that only sockets in burst are sampled */
+int sock_fast = 0;
+/* Number of regular samples of sockets */
+u_long sock_sample_seq = 0;
+
+/* Structure for discovered socket */
+struct sock_auto {
+	/* definition of socket like configured one */
+	struct socket_conf sc;
+	/* name of process owning socket or empty string if it isn't known */
+	char	process[PROCESS_NAME_MAXLEN + 1];
+	/* this flag shows that owner of socket doesn't match definitions
+	   of discovery, so socket is only remembered and isn't watched */
+	char	f_hidden;
+	/* value of %sock_sample_seq% when socket was found last time */
+	u_long	seen;
+};
+
+/* Discovered sockets, they follow configured sockets in index, and number
+   of used and allocated elements */
+struct sock_auto *sock_auto = NULL;
+int sock_auto_count = 0;
+int sock_auto_size = 0;
+/* Numbers of watched and hidden discovered sockets, each of them is limited
+   by %conf.socket_discover_max% */
+int sock_auto_watched = 0;
+int sock_auto_hidden = 0;
+
+/* Structure for socket found by discovery during sample */
+struct sock_found {
+	/* definition of socket */
+	struct socket_conf sc;
+	/* this flag shows that socket is discovered only if its owner
+	   matches definitions of discovery */
+	int	f_owner;
+#ifdef __linux__
+	/* inode number of socket */
+	u_int	inode;
+#endif
+};
+
+/* Sockets found by discovery during the current sample, they are added
+   to index after the sample, and number of used and allocated elements */
+struct sock_found *sock_found = NULL;
+int sock_found_count = 0;
+int sock_found_size = 0;
+#ifdef __linux__
+/* Owners of sockets found during the current sample, %sock_found_size%
+   elements */
+struct proc_net_owner *sock_owners = NULL;
+#endif
+
+/* Number of sockets not discovered during the last sample because of
+   %conf.socket_discover_max% */
+int sock_auto_overflow = 0;
+
+/* Names of socket types, see socket_conf structure */
+const char *sock_type_names[] = { "tcp", "udp", "tcp6", "udp6", "unix" };
+
 /* Structure for HDD's load average */
 struct hdd_la {
-	char	device_name[DEVSTAT_NAME_LEN];
-	int	unit_number;
-	u_int	incompleted_count[900];
-	u_int	last_ptr;
-	llong	sum_5min;
-	llong	sum_15min;
+	char	device_name[HDD_NAME_MAXLEN + 1];
+	/* history of number of incompleted commands */
+	struct rollup queue;
+	/* distribution of number of incompleted commands during the current
+	   and the previous %HDD_QUEUE_PERIOD% */
+	struct sketch queue_cur;
+	struct sketch queue_prev;
+	/* number of the current period since the Epoch */
+	u_long	queue_period;
+#ifdef __linux__
+	/* counters and monotonic time in milliseconds at the start of the
+	   current rate period, time is 0 before the first sample */
+	u_llong	rate_base[DISKSTATS_MAXN];
+	u_llong	rate_base_ms;
+	/* this flag shows that rates below are calculated */
+	char	f_rates;
+	/* busy time in percents, operations per second and average time of
+	   operation in milliseconds over the last rate period */
+	double	util;
+	double	iops_read;
+	double	iops_written;
+	double	await_read;
+	double	await_written;
+#endif
 	char	f_used;
 };
 
-/* Array of interfaces */
-struct if_stats iface_stats[IFACE_MAXN];
-/* Number of elements in %iface_stats% array */
-int iface_count = 0;
+/* Table of HDD's by hash of name */
+struct table hdds = { .elem_size = sizeof(struct hdd_la) };
+
+/* Table of interfaces by index */
+struct table ifaces = { .elem_size = sizeof(struct if_stats) };
+
+/* Names of interface rates in NETSTAT output */
+const char *if_rate_names[IF_RATE_MAXN] = {
+	"bytes_in", "bytes_out", "packets_in", "packets_out", "errors_in",
+	"errors_out"
+};
 
-/* Array of HDD's */
-struct hdd_la hdds_la[32];
-/* Number of elements in hdds_la array */
-int hdds_count = 0;
+/* Periods of average and peak interface rates in minutes */
+const int if_rate_periods[IF_RATE_PERIODS] = { 1, 5, 15 };
 
+#ifndef __linux__
 struct devinfo hdd_dinfo;
 
 #endif //__linux__
+
+/* Structure for socket statistics published by sampler thread */
+struct socket_stats {
+	char	var[VAR_MAXLEN + 1];
+	/* the last queue length or -1 if socket doesn't exist */
+	int	qlen;
+	u_int	incqlen;
+	u_int	qlimit;
+	/* average, maximum and quantiles of queue length over window */
+	double	load;
+	int	peak;
+	int	p50;
+	int	p95;
+	int	p99;
+	/* averages of queue length over 1, 5, 15 and 60 minutes */
+	double	load1;
+	double	load5;
+	double	load15;
+	double	load60;
+	/* maximum of queue length over 60 minutes */
+	int	peak60;
+	/* bursts of queue */
+	struct sock_burst burst;
+};
+
+/* Structure for interface statistics published by sampler thread */
+struct iface_stats {
+	char	ifname[IFNAMSIZ];
+	struct if_counters cur;
+	/* this flag shows that rates below are calculated */
+	char	f_rates;
+	/* the last rates per second, their averages and peaks over
+	   %if_rate_periods% */
+	double	rate[IF_RATE_MAXN];
+	double	rate_avg[IF_RATE_MAXN][IF_RATE_PERIODS];
+	double	rate_peak[IF_RATE_MAXN][IF_RATE_PERIODS];
+};
+
+/* Structure for HDD statistics published by sampler thread */
+struct hdd_stats {
+	char	device_name[HDD_NAME_MAXLEN + 1];
+	/* averages of number of incompleted commands over 1, 5, 15 and
+	   60 minutes */
+	double	load1;
+	double	load5;
+	double	load15;
+	double	load60;
+	/* quantiles of number of incompleted commands */
+	int	p50;
+	int	p95;
+	int	p99;
+#ifdef __linux__
+	/* this flag shows that values below are calculated */
+	char	f_rates;
+	double	util;
+	double	iops_read;
+	double	iops_written;
+	double	await_read;
+	double	await_written;
+#endif
+};
+
+/* Structure for counters published by sampler thread. Published snapshot is
+   never changed, so request handlers read it without locks */
+struct stats_snapshot {
+	/* sockets, interfaces and HDD's and numbers of allocated elements
+	   of these arrays */
+	struct socket_stats	*sockets;
+	int			sockets_count;
+	int			sockets_size;
+	struct iface_stats	*ifaces;
+	int			iface_count;
+	int			iface_size;
+	struct hdd_stats	*hdds;
+	int			hdds_count;
+	int			hdds_size;
+	/* number of watched discovered sockets and number of sockets which
+	   aren't discovered because of limit */
+	int			sockets_auto;
+	int			sockets_overflow;
+	/* next snapshot in list of retired or free snapshots */
+	struct stats_snapshot	*next;
+	/* value of %stats_readers_gen% when snapshot was retired */
+	u_long			retired_gen;
+};
+
+/* Structure for snapshot passed by sampler process to workers through
+   shared memory. Sampler process makes %seq% odd while it writes snapshot,
+   so worker takes snapshot only if %seq% is even and unchanged after
+   copying */
+struct stats_shared {
+	u_long	seq;
+	int	sockets_count;
+	int	iface_count;
+	int	hdds_count;
+	int	sockets_auto;
+	int	sockets_overflow;
+	/* sockets, interfaces and HDD's one after another */
+	u_llong	data[];
+};
+
+/* Snapshot read by request handlers or NULL */
+struct stats_snapshot *stats_published = NULL;
+/* Generation of the main thread, incremented whenever it holds no snapshot */
+u_long stats_readers_gen = 0;
+/* Snapshots which may still be read by the main thread */
+struct stats_snapshot *stats_retired = NULL;
+/* Snapshots ready for reuse */
+struct stats_snapshot *stats_free = NULL;
+/* Memory shared by sampler process with workers or NULL */
+struct stats_shared *stats_shared = NULL;
+/* Value of %stats_shared->seq% when worker took snapshot last time */
+u_long stats_shared_seq = 0;
+/* This flag shows that snapshot didn't fit in shared memory */
+int f_stats_shared_full = 0;
+
 /* Time of remote system at the moment when it's serving started */
 time_t remote_tm;
 /* Value of local timer at the moment when serving of remote system started */
 struct timeval start_timeval;
 
+struct stats_snapshot *stats_alloc(int, int, int);
+void stats_replace(struct stats_snapshot *);
+void stats_export(const struct stats_snapshot *);
+const struct stats_snapshot *stats_get(void);
 int sysctl_get(int *, u_int, void *, size_t, const char *);
 int sysctl_get_by_name(const char *, void *, size_t, int);
 size_t sysctl_get_alloc(int *, u_int, void **, const char *);
-struct if_stats *iface_get(const char *);
-struct if_stats *iface_add(const char *);
+int stats_reserve(void **, int *, int, size_t);
+struct if_stats *iface_get(u_int, const char *);
+struct if_stats *iface_add(u_int, const char *);
 void ifaces_pack(void);
+void iface_rates(struct if_stats *, u_llong);
+void iface_peaks(struct if_stats *, u_llong);
 void init_remote_tm(time_t);
 time_t get_remote_tm(void);
 void wait_for_children(void);
@@ -175,45 +502,81 @@ void do_exec(void);
 void do_cputemp(void);
 void do_hdd_load(void);
 void do_pkginfo(void);
+void do_hdd(void);
+void sock_key(int, const void *, int, const void **, size_t *, uint16_t *);
+u_int sock_hash(int, const void *, size_t, uint16_t);
+int sock_index_alloc(int);
+void sock_index_slots(void);
+void sock_index_hash(void);
+int sock_find(int, const void *, size_t, uint16_t);
+int sock_lookup(int, void *, u_int);
+int sock_add(int);
+int sock_discover_match(const struct socket_conf *, const char *);
+void sock_discover_found(int, const void *, size_t, uint16_t, u_int);
+void sock_discover(void);
+void sock_auto_add(const struct socket_conf *, const char *);
+void sock_auto_name(struct socket_conf *);
+void sock_auto_pack(void);
+void sock_auto_recount(void);
+void sock_burst(int, int);
+void sock_burst_plan(void);
+void sock_sample(int);
+u_int hdd_key(const char *);
+struct hdd_la *hdd_get(const char *);
+struct hdd_la *hdd_add(const char *);
+void hdd_update(struct hdd_la *, time_t, int);
+void hdds_pack(void);
+#ifdef __linux__
+void iface_link(u_int, const char *, u_int,
+    const struct rtnl_link_stats64 *, void *);
+int hdd_is_disk(const struct diskstats_dev *);
+void hdd_rates(struct hdd_la *, const struct diskstats_dev *, u_llong);
+struct sock_diag_state;
+void sock_diag_set(struct sock_diag_state *, void *, u_int, int, int);
+void sock_diag_found(const struct inet_diag_msg *, void *);
+void sock_diag_unix_found(const char *, u_int, const struct unix_diag_rqlen *,
+    void *);
+int sock_diag_update(int, char *, int *);
+#endif
+
+/* Commands indexed by CMD_* constants */
+struct command commands[CMD_MAXN] = {
+	[CMD_TIME]		= { "TIME",		do_time,		CMD_F_INLINE },
+	[CMD_UNAME]		= { "UNAME",		do_uname,		CMD_F_INLINE },
+	[CMD_VERSION]		= { "VERSION",		stat_version,		CMD_F_INLINE },
+	[CMD_UPTIME]		= { "UPTIME",		do_uptime,		CMD_F_INLINE },
+	[CMD_NETSTAT]		= { "NETSTAT",		do_netstat,		CMD_F_INLINE },
+	[CMD_IFADDRS]		= { "IFADDRS",		do_ifaddrs,		CMD_F_INLINE },
+	[CMD_SMBIOS]		= { "SMBIOS",		stat_smbios,		0 },
+	[CMD_VMSTAT]		= { "VMSTAT",		do_vmstat,		CMD_F_INLINE },
+	[CMD_SYSCTL]		= { "SYSCTL",		stat_sysctl,		0 },
+	[CMD_SWAP]		= { "SWAP",		stat_swap,		0 },
+	[CMD_ACPI_TEMPERATURE]	= { "ACPI_TEMPERATURE",	do_acpi_temperature,	0 },
+	[CMD_RAID]		= { "RAID",		stat_raid,		0 },
+	[CMD_APACHE]		= { "APACHE",		do_apache,		0 },
+	[CMD_NGINX]		= { "NGINX",		do_nginx,		0 },
+	[CMD_MEMCACHE]		= { "MEMCACHE",		do_memcache,		0 },
+	[CMD_SOCKET]		= { "SOCKET",		do_socket,		CMD_F_INLINE },
+	[CMD_EXEC]		= { "EXEC",		do_exec,		0 },
+	[CMD_CPUTEMP]		= { "CPUTEMP",		do_cputemp,		0 },
+	[CMD_HDDLOAD]		= { "HDDLOAD",		do_hdd_load,		CMD_F_INLINE },
+	[CMD_PKGINFO]		= { "PKGINFO",		do_pkginfo,		0 },
+	[CMD_HDD]		= { "HDD",		do_hdd,			0 },
+#ifdef __linux__
+	[CMD_SMART]		= { "SMART",		stat_smart,		0 },
+	[CMD_HDD_LIST]		= { "HDD_LIST",		stat_hdd_list,		0 },
+#endif
+	[CMD_DF]		= { "DF",		do_df,			0 },
+	[CMD_FS]		= { "FS",		stat_fs,		0 },
+	[CMD_CACHE]		= { "CACHE",		do_cache,		CMD_F_INLINE },
+	[CMD_SAMPLERS]		= { "SAMPLERS",		do_samplers,		CMD_F_INLINE },
+};
 
 /*****************************************************************************
- * Processes client connection. %fd% is socket descriptor of client
- * connection.
+ * Redirects stdin, stdout and stderr to client connection %fd% and tunes
+ * messages for client process.
  *****************************************************************************/
-void process_connection(int fd) {
-	char line[INPUT_LINE_MAXLEN + 1], *p, *q, *arg1_b;
-	u_int debug_level_tmp;
-	u_long tm_tmp;
-	u_char smart_attr;
-	int f_go		= 0;
-	int f_version		= 0;
-	int f_time		= 0;
-	int f_uname		= 0;
-	int f_vmstat		= 0;
-	int f_sysctl		= 0;
-	int f_swap		= 0;
-	int f_acpi_temperature	= 0;
-	int f_df		= 0;
-	int f_fs		= 0;
-	int f_hdd		= 0;
-#ifdef __linux__    
-	int f_smart		= 0;
-	int f_hdd_list		= 0;
-#endif    
-	int f_raid		= 0;
-	int f_uptime		= 0;
-	int f_netstat		= 0;
-	int f_ifaddrs		= 0;
-	int f_smbios		= 0;
-	int f_apache		= 0;
-	int f_nginx		= 0;
-	int f_memcache		= 0;
-	int f_socket		= 0;
-	int f_exec		= 0;
-	int f_cputemp		= 0;
-	int f_hdd_load		= 0;
-	int f_pkginfo		= 0;
-
+static void redirect_connection(int fd) {
 	/* redirect stdin, stdout and stderr to connected socket */
 	dup2(fd, 0);
 	dup2(0, 1);
@@ -228,193 +591,743 @@ void process_connection(int fd) {
 
 	/* all further messages should be sent both to stderr and syslog */
 	f_msg_stderr = 1;
+}
+
+/*****************************************************************************
+ * Processes client connection. %fd% is socket descriptor of client
+ * connection.
+ *****************************************************************************/
+void process_connection(int fd) {
+	char line[INPUT_LINE_MAXLEN + 1];
+	struct request req;
+	int res;
 
-	/* set remote time to local time */
-	init_remote_tm(time(NULL));
+	redirect_connection(fd);
+	out_open(1, NULL, 0);
 
-	while (fgets(line, sizeof(line), stdin)) {
-		/* remove end of line for easy parsing */
-		parse_chomp(line);
+	req_init(&req);
+	for (;;) {
+		res = REQ_MORE;
+		while (res == REQ_MORE && fgets(line, sizeof(line), stdin)) {
+			/* remove end of line for easy parsing */
+			parse_chomp(line);
 
-		/* line too long */
-		if (strlen(line) == (sizeof(line) - 1))
-			msg_err(1, "Input line is too long: '%s'", line);
+			/* line too long */
+			if (strlen(line) == (sizeof(line) - 1))
+				msg_err(1, "Input line is too long: '%s'", line);
 
-		/* do parsing */
-		if (       parse_get_str(line, &p, "GO") && !*p) {
-			f_go = 1;
-			break;
-		} else if (parse_get_str(line, &p, "HELP") && !*p) {
-			do_help();
-		} else if (parse_get_str(line, &p, "QUIT") && !*p) {
+			res = req_parse(&req, line);
+		}
+		if (res == REQ_QUIT)
 			return;
-		} else if (parse_get_str(line, &p, "DEBUG")) {
-			if (parse_get_ch(p, &p, ' ') &&
-			    parse_get_uint(p, &p, &debug_level_tmp) && !*p &&
-			    debug_level_tmp <= 2) {
-				msg_debug_level = debug_level_tmp;
-			} else {
-				msg_err(0, "Parsing error. Format: DEBUG <0-2>");
-			}
-		} else if (parse_get_str(line, &p, "VERSION") && !*p) {
-			f_version = 1;
-		} else if (parse_get_str(line, &p, "TIME")) {
-			if (parse_get_ch(p, &p, ' ') &&
-			    parse_get_ulint(p, &p, &tm_tmp) && !*p) {
-				f_time = 1;
-				init_remote_tm(tm_tmp);
-			} else {
-				msg_err(0, "Parsing error. Format: TIME <time>");
-			}
-		} else if (parse_get_str(line, &p, "UNAME") && !*p) {
-			f_uname = 1;
-		} else if (parse_get_str(line, &p, "VMSTAT") && !*p) {
-			f_vmstat = 1;
-		} else if (parse_get_str(line, &p, "SYSCTL")) {
-			if (!(parse_get_wspace(p, &p) && (arg1_b = p, 1) &&
-			    parse_get_chset(p, &p, SYSCTL_VAR_CHSET, -SYSCTL_VAR_MAXLEN) &&
-			    !*p)) {
-				msg_err(0, "Parsing error. Format: SYSCTL <variable>");
-				continue;
-			}
-			if (sysctl_n == SYSCTL_MAXN) {
-				msg_err(0, "Too many SYSCTL commands (maximum %u allowed)",
-				    (u_int)SYSCTL_MAXN);
-				continue;
-			}
-			if (!(sysctl_vars[sysctl_n] = strdup(arg1_b))) {
-				msg_syserr(0, "%s: SYSCTL: strdup(%s)", __FUNCTION__, arg1_b);
-				continue;
-			}
-			sysctl_n++;
-			f_sysctl = 1;
-		} else if (parse_get_str(line, &p, "SWAP") && !*p) {
-			f_swap = 1;
-		} else if (parse_get_str(line, &p, "ACPI_TEMPERATURE") && !*p) {
-			f_acpi_temperature = 1;
-		} else if (parse_get_str(line, &p, "DF") && !*p) {
-			f_df = 1;
-		} else if (parse_get_str(line, &p, "FS") && !*p) {
-			f_fs = 1;
-			f_stat_fs_command_fs = 1;
-		} else if (parse_get_str(line, &p, "FS_LIST") && !*p) {
-			f_fs = 1;
-			f_stat_fs_command_fs_list = 1;
-		} else if (parse_get_str(line, &p, "HDD") && !*p) {
-			f_hdd = 1;
-			f_stat_hdd_command_hdd = 1;
-		} else if (parse_get_str(line, &p, "HDD_LIST") && !*p) {
-#ifndef __linux__        
-			f_hdd = 1;
-			f_stat_hdd_command_hdd_list = 1;
-#else
-            f_hdd_list = 1;
-#endif            
-		} else if (parse_get_str(line, &p, "SMART")) {
-			if (!*p) {
-#ifndef __linux__        
-				f_hdd = 1;
+
+		if (ferror(stdin))
+			msg_syserr(1, "process_connection: fgets");
+
+		if (res != REQ_GO) {
+			/* session is finished by closing connection */
+			if (req.f_session)
+				return;
+			msg_err(1, "Incomplete directives: no GO");
+		}
+
+		/* counters are sampled by the main process only */
+		if (req.f_subscribe)
+			msg_err(1, "SUBSCRIBE is supported only in event loop mode");
+
+		alarm(CLIENT_TIMEOUT);
+
+		req_run(&req);
+
+		wait_for_children();
+
+		if (!req.f_session)
+			break;
+
+		/* finish the batch and wait for the next one */
+		out_printf("%s\n", SESSION_END_MARKER);
+		out_flush();
+		req_reset(&req);
+		alarm(SESSION_TIMEOUT);
+	}
+}
+
+/*****************************************************************************
+ * Processes already parsed client request %req% on client connection %fd%.
+ * %prefix% of length %prefix_len% is written to the client before the
+ * response.
+ *****************************************************************************/
+void process_request(int fd, struct request *req, const char *prefix,
+    size_t prefix_len) {
+	redirect_connection(fd);
+	out_open(1, prefix, prefix_len);
+
+	req_run(req);
+
+	wait_for_children();
+}
+
+/*****************************************************************************
+ * Initializes client request %req%.
+ *****************************************************************************/
+void req_init(struct request *req) {
+	bzero(req, sizeof(*req));
+	req->remote_tm = req->local_tm = time(NULL);
+	req->debug_level = -1;
+}
+
+/*****************************************************************************
+ * Frees memory allocated while parsing client request %req%.
+ *****************************************************************************/
+void req_free(struct request *req) {
+	u_int i;
+
+	for (i = 0; i < req->sysctl_n; i++)
+		free(req->sysctl_vars[i]);
+	req->sysctl_n = 0;
+}
+
+/*****************************************************************************
+ * Prepares client request %req% for the next batch of session. Session mode
+ * is kept.
+ *****************************************************************************/
+void req_reset(struct request *req) {
+	int f_session;
+
+	f_session = req->f_session;
+	req_free(req);
+	req_init(req);
+	req->f_session = f_session;
+}
+
+/*****************************************************************************
+ * Parses directive %line% of client request %req%. Returns REQ_GO if request
+ * is complete, REQ_QUIT if client asked to close connection and REQ_MORE
+ * otherwise.
+ *****************************************************************************/
+int req_parse(struct request *req, char *line) {
+	char *p, *q, *arg1_b;
+	u_int debug_level_tmp, interval_tmp;
+	int i;
+	u_long tm_tmp;
+	u_char smart_attr;
+
+	if (       parse_get_str(line, &p, "GO") && !*p) {
+		return(REQ_GO);
+	} else if (parse_get_str(line, &p, "HELP") && !*p) {
+		do_help();
+	} else if (parse_get_str(line, &p, "QUIT") && !*p) {
+		return(REQ_QUIT);
+	} else if (parse_get_str(line, &p, "SESSION") && !*p) {
+		req->f_session = 1;
+	} else if (parse_get_str(line, &p, "SUBSCRIBE")) {
+		if (!(parse_get_wspace(p, &p) && (arg1_b = p, 1) &&
+		    parse_get_chset(p, &p, CHSET_ALPHA_ENG "_", -CMD_NAME_MAXLEN) &&
+		    parse_get_wspace(p, &q) &&
+		    parse_get_uint(q, &q, &interval_tmp) && !*q &&
+		    interval_tmp > 0 && interval_tmp <= SUBSCRIBE_INTERVAL_MAX)) {
+			out_error("Parsing error. Format: SUBSCRIBE <command> "
+			    "<1-%u>", (u_int)SUBSCRIBE_INTERVAL_MAX);
+			return(REQ_MORE);
+		}
+		*p = 0;
+		for (i = 0; i < CMD_MAXN; i++)
+			if (!strcmp(commands[i].name, arg1_b))
+				break;
+		if (i == CMD_MAXN || !(commands[i].flags & CMD_F_INLINE)) {
+			out_error("Command '%s' can't be subscribed", arg1_b);
+			return(REQ_MORE);
+		}
+		req->f_cmd[i] = 1;
+		req->sub_interval[i] = interval_tmp;
+		req->f_subscribe = 1;
+	} else if (parse_get_str(line, &p, "DEBUG")) {
+		if (parse_get_ch(p, &p, ' ') &&
+		    parse_get_uint(p, &p, &debug_level_tmp) && !*p &&
+		    debug_level_tmp <= 2) {
+			req->debug_level = debug_level_tmp;
+		} else {
+			out_error("Parsing error. Format: DEBUG <0-2>");
+		}
+	} else if (parse_get_str(line, &p, "VERSION") && !*p) {
+		req->f_cmd[CMD_VERSION] = 1;
+	} else if (parse_get_str(line, &p, "TIME")) {
+		if (parse_get_ch(p, &p, ' ') &&
+		    parse_get_ulint(p, &p, &tm_tmp) && !*p) {
+			req->f_cmd[CMD_TIME] = 1;
+			req->remote_tm = tm_tmp;
+			req->local_tm = time(NULL);
+		} else {
+			out_error("Parsing error. Format: TIME <time>");
+		}
+	} else if (parse_get_str(line, &p, "UNAME") && !*p) {
+		req->f_cmd[CMD_UNAME] = 1;
+	} else if (parse_get_str(line, &p, "VMSTAT") && !*p) {
+		req->f_cmd[CMD_VMSTAT] = 1;
+	} else if (parse_get_str(line, &p, "SYSCTL")) {
+		if (!(parse_get_wspace(p, &p) && (arg1_b = p, 1) &&
+		    parse_get_chset(p, &p, SYSCTL_VAR_CHSET, -SYSCTL_VAR_MAXLEN) &&
+		    !*p)) {
+			out_error("Parsing error. Format: SYSCTL <variable>");
+			return(REQ_MORE);
+		}
+		if (req->sysctl_n == SYSCTL_MAXN) {
+			out_error("Too many SYSCTL commands (maximum %u allowed)",
+			    (u_int)SYSCTL_MAXN);
+			return(REQ_MORE);
+		}
+		if (!(req->sysctl_vars[req->sysctl_n] = strdup(arg1_b))) {
+			msg_syserr(0, "%s: SYSCTL: strdup(%s)", __FUNCTION__, arg1_b);
+			return(REQ_MORE);
+		}
+		req->sysctl_n++;
+		req->f_cmd[CMD_SYSCTL] = 1;
+	} else if (parse_get_str(line, &p, "SWAP") && !*p) {
+		req->f_cmd[CMD_SWAP] = 1;
+	} else if (parse_get_str(line, &p, "ACPI_TEMPERATURE") && !*p) {
+		req->f_cmd[CMD_ACPI_TEMPERATURE] = 1;
+	} else if (parse_get_str(line, &p, "DF") && !*p) {
+		req->f_cmd[CMD_DF] = 1;
+	} else if (parse_get_str(line, &p, "FS") && !*p) {
+		req->f_cmd[CMD_FS] = 1;
+		req->f_fs_command_fs = 1;
+	} else if (parse_get_str(line, &p, "FS_LIST") && !*p) {
+		req->f_cmd[CMD_FS] = 1;
+		req->f_fs_command_fs_list = 1;
+	} else if (parse_get_str(line, &p, "HDD") && !*p) {
+		req->f_cmd[CMD_HDD] = 1;
+		req->f_hdd_command_hdd = 1;
+	} else if (parse_get_str(line, &p, "HDD_LIST") && !*p) {
+#ifndef __linux__
+		req->f_cmd[CMD_HDD] = 1;
+		req->f_hdd_command_hdd_list = 1;
 #else
-                f_smart = 1;
+		req->f_cmd[CMD_HDD_LIST] = 1;
 #endif
-				f_stat_hdd_command_smart = 1;
-			} else if (parse_get_ch(p, &q, ' ') &&
-			    parse_get_uint8(q, &q, &smart_attr) && !*q) {
-#ifndef __linux__        
-				f_hdd = 1;
+	} else if (parse_get_str(line, &p, "SMART")) {
+		if (!*p) {
+			req->f_hdd_command_smart = 1;
+		} else if (parse_get_ch(p, &q, ' ') &&
+		    parse_get_uint8(q, &q, &smart_attr) && !*q) {
+			req->f_hdd_command_smart = 1;
+			req->f_hdd_smart_attrs_requested = 1;
+			req->hdd_smart_attrs[smart_attr] = 1;
+		} else if (parse_get_ch(p, &q, ' ') &&
+		    parse_get_str(q, &q, "ALL") && !*q) {
+			req->f_hdd_command_smart = 1;
+			req->f_hdd_smart_attrs_requested = 1;
+			memset(req->hdd_smart_attrs, 1,
+			    sizeof(req->hdd_smart_attrs));
+		} else {
+			out_error("Parsing error. Format: SMART [<attribute>|ALL]");
+			return(REQ_MORE);
+		}
+#ifndef __linux__
+		req->f_cmd[CMD_HDD] = 1;
 #else
-                f_smart = 1;
+		req->f_cmd[CMD_SMART] = 1;
 #endif
-				f_stat_hdd_command_smart = 1;
-				f_stat_hdd_smart_attrs_requested = 1;
-				f_stat_hdd_smart_attrs[smart_attr] = 1;
-			} else if (parse_get_ch(p, &q, ' ') &&
-			    parse_get_str(q, &q, "ALL") && !*q) {
-#ifndef __linux__        
-				f_hdd = 1;
-#else
-                f_smart = 1;
+	} else if (parse_get_str(line, &p, "RAID") && !*p) {
+		req->f_cmd[CMD_RAID] = 1;
+		req->f_raid_command_raid = 1;
+	} else if (parse_get_str(line, &p, "RAID_LIST") && !*p) {
+		req->f_cmd[CMD_RAID] = 1;
+		req->f_raid_command_raid_list = 1;
+	} else if (parse_get_str(line, &p, "UPTIME") && !*p) {
+		req->f_cmd[CMD_UPTIME] = 1;
+	} else if (parse_get_str(line, &p, "NETSTAT") && !*p) {
+		req->f_cmd[CMD_NETSTAT] = 1;
+	} else if (parse_get_str(line, &p, "IFADDRS") && !*p) {
+		req->f_cmd[CMD_IFADDRS] = 1;
+	} else if (parse_get_str(line, &p, "SMBIOS") && !*p) {
+		req->f_cmd[CMD_SMBIOS] = 1;
+	} else if (parse_get_str(line, &p, "APACHE") && !*p) {
+		req->f_cmd[CMD_APACHE] = 1;
+	} else if (parse_get_str(line, &p, "NGINX") && !*p) {
+		req->f_cmd[CMD_NGINX] = 1;
+	} else if (parse_get_str(line, &p, "MEMCACHE") && !*p) {
+		req->f_cmd[CMD_MEMCACHE] = 1;
+	} else if (parse_get_str(line, &p, "SOCKET") && !*p) {
+		req->f_cmd[CMD_SOCKET] = 1;
+	} else if (parse_get_str(line, &p, "EXEC") && !*p) {
+		req->f_cmd[CMD_EXEC] = 1;
+	} else if (parse_get_str(line, &p, "CPUTEMP") && !*p) {
+		req->f_cmd[CMD_CPUTEMP] = 1;
+	} else if (parse_get_str(line, &p, "HDDLOAD") && !*p) {
+		req->f_cmd[CMD_HDDLOAD] = 1;
+	} else if (parse_get_str(line, &p, "PKGINFO") && !*p) {
+		req->f_cmd[CMD_PKGINFO] = 1;
+	} else if (parse_get_str(line, &p, "CACHE") && !*p) {
+		req->f_cmd[CMD_CACHE] = 1;
+	} else if (parse_get_str(line, &p, "SAMPLERS") && !*p) {
+		req->f_cmd[CMD_SAMPLERS] = 1;
+	} else {
+		out_error("Unknown directive '%s'", line);
+	}
+	return(REQ_MORE);
+}
+
+/*****************************************************************************
+ * Returns non-zero if all commands of client request %req% can be processed
+ * inside the main process. Otherwise returns zero.
+ *****************************************************************************/
+int req_is_inline(const struct request *req) {
+	int i;
+
+	for (i = 0; i < CMD_MAXN; i++)
+		if (req->f_cmd[i] && !(commands[i].flags & CMD_F_INLINE))
+			return(0);
+	return(1);
+}
+
+/*****************************************************************************
+ * Returns hash of arguments of command %cmd% of client request %req%, so
+ * snapshots of the command with different arguments are kept apart.
+ *****************************************************************************/
+u_int req_args_hash(const struct request *req, int cmd) {
+	u_int h, j;
+	const char *p;
+
+	h = FNV_INIT;
+	switch (cmd) {
+	case CMD_FS:
+		h = FNV_STEP(h, req->f_fs_command_fs);
+		h = FNV_STEP(h, req->f_fs_command_fs_list);
+		break;
+	case CMD_HDD:
+		h = FNV_STEP(h, req->f_hdd_command_hdd);
+		h = FNV_STEP(h, req->f_hdd_command_hdd_list);
+		/* FALLTHROUGH */
+#ifdef __linux__
+	case CMD_SMART:
 #endif
-				f_stat_hdd_command_smart = 1;
-				f_stat_hdd_smart_attrs_requested = 1;
-				memset(f_stat_hdd_smart_attrs, 1,
-				    sizeof(f_stat_hdd_smart_attrs));
-			} else {
-				msg_err(0, "Parsing error. Format: SMART [<attribute>|ALL]");
+		h = FNV_STEP(h, req->f_hdd_command_smart);
+		h = FNV_STEP(h, req->f_hdd_smart_attrs_requested);
+		if (req->f_hdd_smart_attrs_requested)
+			for (j = 0; j < sizeof(req->hdd_smart_attrs); j++)
+				h = FNV_STEP(h, req->hdd_smart_attrs[j]);
+		break;
+	case CMD_RAID:
+		h = FNV_STEP(h, req->f_raid_command_raid);
+		h = FNV_STEP(h, req->f_raid_command_raid_list);
+		break;
+	case CMD_SYSCTL:
+		for (j = 0; j < req->sysctl_n; j++)
+			for (p = req->sysctl_vars[j]; ; p++) {
+				h = FNV_STEP(h, (u_char)*p);
+				if (!*p)
+					break;
 			}
-		} else if (parse_get_str(line, &p, "RAID") && !*p) {
-			f_raid = 1;
-			f_stat_raid_command_raid = 1;
-		} else if (parse_get_str(line, &p, "RAID_LIST") && !*p) {
-			f_raid = 1;
-			f_stat_raid_command_raid_list = 1;
-		} else if (parse_get_str(line, &p, "UPTIME") && !*p) {
-			f_uptime = 1;
-		} else if (parse_get_str(line, &p, "NETSTAT") && !*p) {
-			f_netstat = 1;
-		} else if (parse_get_str(line, &p, "IFADDRS") && !*p) {
-			f_ifaddrs = 1;
-		} else if (parse_get_str(line, &p, "SMBIOS") && !*p) {
-			f_smbios = 1;
-		} else if (parse_get_str(line, &p, "APACHE") && !*p) {
-			f_apache = 1;
-		} else if (parse_get_str(line, &p, "NGINX") && !*p) {
-			f_nginx = 1;
-		} else if (parse_get_str(line, &p, "MEMCACHE") && !*p) {
-			f_memcache = 1;
-		} else if (parse_get_str(line, &p, "SOCKET") && !*p) {
-			f_socket = 1;
-		} else if (parse_get_str(line, &p, "EXEC") && !*p) {
-			f_exec = 1;
-		} else if (parse_get_str(line, &p, "CPUTEMP") && !*p) {
-			f_cputemp = 1;
-		} else if (parse_get_str(line, &p, "HDDLOAD") && !*p) {
-			f_hdd_load = 1;
-		} else if (parse_get_str(line, &p, "PKGINFO") && !*p) {
-			f_pkginfo = 1;
-		} else {
-			msg_err(0, "Unknown directive '%s'", line);
+		break;
+	}
+	return(h);
+}
+
+/*****************************************************************************
+ * Processes commands of parsed client request %req%.
+ *****************************************************************************/
+void req_run(struct request *req) {
+	int i, debug_level;
+	u_int j;
+
+	/* set remote time */
+	init_remote_tm(req->remote_tm + (time(NULL) - req->local_tm));
+
+	debug_level = msg_debug_level;
+	if (req->debug_level >= 0)
+		msg_debug_level = req->debug_level;
+
+	/* pass arguments of commands */
+	f_stat_fs_command_fs		= req->f_fs_command_fs;
+	f_stat_fs_command_fs_list	= req->f_fs_command_fs_list;
+	f_stat_hdd_command_hdd		= req->f_hdd_command_hdd;
+	f_stat_hdd_command_hdd_list	= req->f_hdd_command_hdd_list;
+	f_stat_hdd_command_smart	= req->f_hdd_command_smart;
+	f_stat_hdd_smart_attrs_requested = req->f_hdd_smart_attrs_requested;
+	memcpy(f_stat_hdd_smart_attrs, req->hdd_smart_attrs,
+	    sizeof(f_stat_hdd_smart_attrs));
+	f_stat_raid_command_raid	= req->f_raid_command_raid;
+	f_stat_raid_command_raid_list	= req->f_raid_command_raid_list;
+	for (j = 0; j < req->sysctl_n; j++)
+		sysctl_vars[j] = req->sysctl_vars[j];
+	sysctl_n = req->sysctl_n;
+
+	/* commands processed inside the client process are quick, so their
+	   output is written before any command which can hang */
+	for (i = 0; i < CMD_MAXN; i++)
+		if (req->f_cmd[i] && (commands[i].flags & CMD_F_INLINE)) {
+			req_run_cmd(req, i);
+			out_flush();
 		}
+	pool_run(req);
+	out_report();
+
+	msg_debug_level = debug_level;
+}
+
+/*****************************************************************************
+ * Processes command %cmd% of client request %req%. Arguments of the command
+ * must be already passed by req_run().
+ *****************************************************************************/
+void req_run_cmd(struct request *req, int cmd) {
+	u_int ttl;
+
+	if (cache_lookup(cmd, &ttl))
+		cache_run(cmd, req_args_hash(req, cmd), ttl);
+	else
+		commands[cmd].func();
+}
+
+/*****************************************************************************
+ * Stores name of command %cmd% in lower case to %name% of size %size%.
+ *****************************************************************************/
+void command_name(int cmd, char *name, size_t size) {
+	size_t i;
+
+	for (i = 0; commands[cmd].name[i] && i < size - 1; i++)
+		name[i] = tolower((u_char)commands[cmd].name[i]);
+	name[i] = 0;
+}
+
+/*****************************************************************************
+ * Processes HDD command.
+ *****************************************************************************/
+void do_hdd() {
+#ifdef __linux__
+	struct diskstats_dev d;
+	time_t tm;
+	char *p;
+
+	stat_hdd(0);
+
+	/* counters of all disks are taken from one read of /proc/diskstats */
+	if ((p = diskstats_read()) == NULL)
+		return;
+	tm = get_remote_tm();
+	while (diskstats_next(&p, &d)) {
+		if (!hdd_is_disk(&d))
+			continue;
+		out_u64(tm, out_key("hdd_busy_time", d.name),
+		    d.val[DISKSTATS_IO_TICKS] / 1000);
+		out_u64(tm, out_key("hdd_bytes_read", d.name),
+		    d.val[DISKSTATS_READ_SECTORS] * DISKSTATS_SECTOR_SIZE);
+		out_u64(tm, out_key("hdd_bytes_written", d.name),
+		    d.val[DISKSTATS_WRITE_SECTORS] * DISKSTATS_SECTOR_SIZE);
+		out_u64(tm, out_key("hdd_bytes_deleted", d.name),
+		    d.val[DISKSTATS_DISCARD_SECTORS] * DISKSTATS_SECTOR_SIZE);
+		out_u64(tm, out_key("hdd_operations_read", d.name),	d.val[DISKSTATS_READS]);
+		out_u64(tm, out_key("hdd_operations_written", d.name),	d.val[DISKSTATS_WRITES]);
+		out_u64(tm, out_key("hdd_operations_deleted", d.name),	d.val[DISKSTATS_DISCARDS]);
+		out_u64(tm, out_key("hdd_operations_flushed", d.name),	d.val[DISKSTATS_FLUSHES]);
+		out_u64(tm, out_key("hdd_duration_read", d.name),
+		    d.val[DISKSTATS_READ_TICKS] / 1000);
+		out_u64(tm, out_key("hdd_duration_written", d.name),
+		    d.val[DISKSTATS_WRITE_TICKS] / 1000);
+		out_u64(tm, out_key("hdd_duration_deleted", d.name),
+		    d.val[DISKSTATS_DISCARD_TICKS] / 1000);
+		out_u64(tm, out_key("hdd_duration_flushed", d.name),
+		    d.val[DISKSTATS_FLUSH_TICKS] / 1000);
+		out_u64(tm, out_key("hdd_operations_queue_length", d.name),
+		    d.val[DISKSTATS_IN_FLIGHT]);
+	}
+#else
+	stat_hdd();
+#endif
+}
+
+/*****************************************************************************
+ * Publishes current counters of sockets, interfaces and HDD's for request
+ * handlers. Called by sampler thread after samples are taken, or by client
+ * process which updated the counters itself. Sampler process of workers
+ * passes the counters to them through shared memory instead.
+ *****************************************************************************/
+void stats_publish() {
+	struct stats_snapshot *snap;
+	struct socket_stats *ss;
+	struct iface_stats *is;
+	struct hdd_stats *hs;
+	const struct if_stats *ifs;
+	const struct hdd_la *hdd;
+	struct rollup_stats rs;
+	struct sketch queue;
+	int i;
+
+	if ((snap = stats_alloc(sockets_count, ifaces.count,
+	    hdds.count)) == NULL)
+		return;
+
+	for (i = 0; i < sockets_count; i++) {
+		ss = &snap->sockets[i];
+		strcpy(ss->var, sockets_la[i].var);
+		ss->qlen = window_last(&sockets_la[i].qlen);
+		ss->incqlen = sockets_la[i].incqlen;
+		ss->qlimit = sockets_la[i].qlimit;
+		ss->load = window_avg(&sockets_la[i].qlen);
+		ss->peak = window_max(&sockets_la[i].qlen);
+		ss->p50 = window_quantile(&sockets_la[i].qlen, 0.50);
+		ss->p95 = window_quantile(&sockets_la[i].qlen, 0.95);
+		ss->p99 = window_quantile(&sockets_la[i].qlen, 0.99);
+		ss->load1 = rollup_avg(&sockets_la[i].history, 60);
+		ss->load5 = rollup_avg(&sockets_la[i].history, 300);
+		ss->load15 = rollup_avg(&sockets_la[i].history, 900);
+		ss->load60 = rollup_avg(&sockets_la[i].history, 3600);
+		ss->peak60 = rollup_get(&sockets_la[i].history, 3600, &rs) ?
+		    rs.max : -1;
+		ss->burst = sockets_la[i].burst;
 	}
-	if (ferror(stdin))
-		msg_syserr(1, "process_connection: fgets");
-
-	if (!f_go)
-		msg_err(1, "Incomplete directives: no GO");
-
-	if (f_time)		do_time();
-	if (f_uname)		do_uname();
-	if (f_version)		stat_version();
-	if (f_uptime)		do_uptime();
-	if (f_netstat)		do_netstat();
-	if (f_ifaddrs)		do_ifaddrs();
-	if (f_smbios)		stat_smbios();
-	if (f_vmstat)		do_vmstat();
-	if (f_sysctl)		stat_sysctl();
-	if (f_swap)		stat_swap();
-	if (f_acpi_temperature)	do_acpi_temperature();
-	if (f_raid)		stat_raid();
-	if (f_apache)		do_apache();
-	if (f_nginx)		do_nginx();
-	if (f_memcache)		do_memcache();
-	if (f_socket)		do_socket();
-	if (f_exec)		do_exec();
-	if (f_cputemp)		do_cputemp();
-	if (f_hdd_load)		do_hdd_load();
-	/* stat_hdd() and do_df()/stat_fs() should be called last because
-	   they sometimes hang */
-	if (f_pkginfo)		do_pkginfo();
+	snap->sockets_count = sockets_count;
+	snap->sockets_auto = sock_auto_watched;
+	snap->sockets_overflow = sock_auto_overflow;
+
+	/* only reported fields are copied, history stays in sampler */
+	for (i = 0; i < ifaces.count; i++) {
+		ifs = TABLE_ELEM(&ifaces, i);
+		is = &snap->ifaces[i];
+		strcpy(is->ifname, ifs->ifname);
+		is->cur = ifs->cur;
+		is->f_rates = ifs->f_rates;
+		memcpy(is->rate, ifs->rate, sizeof(is->rate));
+		memcpy(is->rate_avg, ifs->rate_avg, sizeof(is->rate_avg));
+		memcpy(is->rate_peak, ifs->rate_peak, sizeof(is->rate_peak));
+	}
+	snap->iface_count = ifaces.count;
+	for (i = 0; i < hdds.count; i++) {
+		hdd = TABLE_ELEM(&hdds, i);
+		hs = &snap->hdds[i];
+		strcpy(hs->device_name, hdd->device_name);
+		hs->load1 = rollup_avg(&hdd->queue, 60);
+		hs->load5 = rollup_avg(&hdd->queue, 300);
+		hs->load15 = rollup_avg(&hdd->queue, 900);
+		hs->load60 = rollup_avg(&hdd->queue, 3600);
+		queue = hdd->queue_cur;
+		sketch_merge(&queue, &hdd->queue_prev);
+		hs->p50 = sketch_quantile(&queue, 0.50);
+		hs->p95 = sketch_quantile(&queue, 0.95);
+		hs->p99 = sketch_quantile(&queue, 0.99);
 #ifdef __linux__
-	if (f_hdd)		stat_hdd(0);
-	if (f_smart)		stat_smart();
-	if (f_hdd_list)		stat_hdd_list();
-#else    
-	if (f_hdd)		stat_hdd();
+		hs->f_rates = hdd->f_rates;
+		hs->util = hdd->util;
+		hs->iops_read = hdd->iops_read;
+		hs->iops_written = hdd->iops_written;
+		hs->await_read = hdd->await_read;
+		hs->await_written = hdd->await_written;
 #endif
-	if (f_df)		do_df();
-	if (f_fs)		stat_fs();
+	}
+	snap->hdds_count = hdds.count;
 
-	wait_for_children();
+	/* sampler process passes counters to workers and keeps nothing */
+	if (stats_shared && sched_is_owner()) {
+		stats_export(snap);
+		snap->next = stats_free;
+		stats_free = snap;
+		return;
+	}
+	stats_replace(snap);
+}
+
+/*****************************************************************************
+ * Returns unused snapshot with room for %nsockets% sockets, %nifaces%
+ * interfaces and %nhdds% HDD's or NULL on error.
+ *****************************************************************************/
+struct stats_snapshot *stats_alloc(int nsockets, int nifaces, int nhdds) {
+	struct stats_snapshot *snap, **pp;
+	u_long gen;
+
+	/* collect snapshots nobody can read anymore */
+	gen = __atomic_load_n(&stats_readers_gen, __ATOMIC_SEQ_CST);
+	for (pp = &stats_retired; (snap = *pp); ) {
+		if (snap->retired_gen != gen) {
+			*pp = snap->next;
+			snap->next = stats_free;
+			stats_free = snap;
+		} else
+			pp = &snap->next;
+	}
+
+	if ((snap = stats_free))
+		stats_free = snap->next;
+	else if ((snap = calloc(1, sizeof(*snap))) == NULL) {
+		msg_syserr(0, "%s: calloc", __FUNCTION__);
+		return(NULL);
+	}
+	if (!stats_reserve((void **)&snap->sockets, &snap->sockets_size,
+	    nsockets, sizeof(snap->sockets[0])) ||
+	    !stats_reserve((void **)&snap->ifaces, &snap->iface_size,
+	    nifaces, sizeof(snap->ifaces[0])) ||
+	    !stats_reserve((void **)&snap->hdds, &snap->hdds_size,
+	    nhdds, sizeof(snap->hdds[0]))) {
+		snap->next = stats_free;
+		stats_free = snap;
+		return(NULL);
+	}
+	return(snap);
+}
+
+/*****************************************************************************
+ * Makes snapshot %snap% published. Replaced snapshot is reused only after
+ * the main thread passed through stats_quiescent(), so the main thread
+ * never sees a snapshot being changed.
+ *****************************************************************************/
+void stats_replace(struct stats_snapshot *snap) {
+	struct stats_snapshot *old;
+
+	old = __atomic_exchange_n(&stats_published, snap, __ATOMIC_SEQ_CST);
+	if (old) {
+		/* the main thread could get %old% before the exchange, and
+		   releases it at the next change of generation */
+		old->retired_gen = __atomic_load_n(&stats_readers_gen,
+		    __ATOMIC_SEQ_CST);
+		old->next = stats_retired;
+		stats_retired = old;
+	}
+}
+
+/*****************************************************************************
+ * Allocates memory for counters passed by sampler process to workers. Must
+ * be called before any fork(2). If successful, returns non-zero. Otherwise
+ * returns zero.
+ *****************************************************************************/
+int stats_share() {
+	void *p;
+
+	p = mmap(NULL, STATS_SHARED_SIZE, PROT_READ | PROT_WRITE,
+	    MAP_ANON | MAP_SHARED, -1, 0);
+	if (p == MAP_FAILED) {
+		msg_syswarn("%s: mmap", __FUNCTION__);
+		return(0);
+	}
+	stats_shared = p;
+	return(1);
+}
+
+/*****************************************************************************
+ * Writes snapshot %snap% to shared memory. Elements which don't fit are
+ * dropped, HDD's first.
+ *****************************************************************************/
+void stats_export(const struct stats_snapshot *snap) {
+	struct stats_shared *sh = stats_shared;
+	size_t room;
+	char *p;
+	u_long seq;
+	int n[3];
+
+	room = STATS_SHARED_SIZE - sizeof(*sh);
+	n[0] = MIN((size_t)snap->sockets_count, room / sizeof(snap->sockets[0]));
+	room -= n[0] * sizeof(snap->sockets[0]);
+	n[1] = MIN((size_t)snap->iface_count, room / sizeof(snap->ifaces[0]));
+	room -= n[1] * sizeof(snap->ifaces[0]);
+	n[2] = MIN((size_t)snap->hdds_count, room / sizeof(snap->hdds[0]));
+	if (n[0] + n[1] + n[2] < snap->sockets_count + snap->iface_count +
+	    snap->hdds_count) {
+		if (!f_stats_shared_full)
+			msg_warn("%s: counters don't fit in %d bytes of shared "
+			    "memory", __FUNCTION__, STATS_SHARED_SIZE);
+		f_stats_shared_full = 1;
+	} else
+		f_stats_shared_full = 0;
+
+	/* sequence number is left odd if previous sampler process died while
+	   writing */
+	seq = (sh->seq + 1) & ~1UL;
+	__atomic_store_n(&sh->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	sh->sockets_count = n[0];
+	sh->iface_count = n[1];
+	sh->hdds_count = n[2];
+	sh->sockets_auto = snap->sockets_auto;
+	sh->sockets_overflow = snap->sockets_overflow;
+	p = (char *)sh->data;
+	memcpy(p, snap->sockets, n[0] * sizeof(snap->sockets[0]));
+	p += n[0] * sizeof(snap->sockets[0]);
+	memcpy(p, snap->ifaces, n[1] * sizeof(snap->ifaces[0]));
+	p += n[1] * sizeof(snap->ifaces[0]);
+	memcpy(p, snap->hdds, n[2] * sizeof(snap->hdds[0]));
+	__atomic_store_n(&sh->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+/*****************************************************************************
+ * Publishes snapshot written to shared memory by sampler process if it's
+ * changed since the last call. Called by worker when it holds no snapshot.
+ * Snapshot being written is skipped, it's taken next time.
+ *****************************************************************************/
+void stats_import() {
+	const struct stats_shared *sh = stats_shared;
+	struct stats_snapshot *snap;
+	const char *p;
+	u_long seq;
+	int n[3];
+
+	seq = __atomic_load_n(&sh->seq, __ATOMIC_ACQUIRE);
+	if ((seq & 1) || seq == stats_shared_seq)
+		return;
+	n[0] = sh->sockets_count;
+	n[1] = sh->iface_count;
+	n[2] = sh->hdds_count;
+	/* numbers may be garbage if snapshot is being written */
+	if (n[0] < 0 || n[1] < 0 || n[2] < 0 ||
+	    (u_llong)n[0] * sizeof(snap->sockets[0]) +
+	    (u_llong)n[1] * sizeof(snap->ifaces[0]) +
+	    (u_llong)n[2] * sizeof(snap->hdds[0]) >
+	    STATS_SHARED_SIZE - sizeof(*sh))
+		return;
+	if ((snap = stats_alloc(n[0], n[1], n[2])) == NULL)
+		return;
+	snap->sockets_count = n[0];
+	snap->iface_count = n[1];
+	snap->hdds_count = n[2];
+	snap->sockets_auto = sh->sockets_auto;
+	snap->sockets_overflow = sh->sockets_overflow;
+	p = (const char *)sh->data;
+	memcpy(snap->sockets, p, n[0] * sizeof(snap->sockets[0]));
+	p += n[0] * sizeof(snap->sockets[0]);
+	memcpy(snap->ifaces, p, n[1] * sizeof(snap->ifaces[0]));
+	p += n[1] * sizeof(snap->ifaces[0]);
+	memcpy(snap->hdds, p, n[2] * sizeof(snap->hdds[0]));
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	if (__atomic_load_n(&sh->seq, __ATOMIC_RELAXED) != seq) {
+		snap->next = stats_free;
+		stats_free = snap;
+		return;
+	}
+	stats_shared_seq = seq;
+	stats_replace(snap);
+}
+
+/*****************************************************************************
+ * Returns the last published snapshot or NULL if nothing is published yet.
+ * The snapshot is valid until the next call of stats_quiescent().
+ *****************************************************************************/
+const struct stats_snapshot *stats_get() {
+	return(__atomic_load_n(&stats_published, __ATOMIC_SEQ_CST));
+}
+
+/*****************************************************************************
+ * Makes array *%p% of *%size% elements of %elem_size% bytes big enough for
+ * %count% elements. If successful, returns non-zero. Otherwise returns zero
+ * and the array is left unchanged.
+ *****************************************************************************/
+int stats_reserve(void **p, int *size, int count, size_t elem_size) {
+	void *n;
+	int new_size;
+
+	if (count <= *size)
+		return(1);
+	for (new_size = *size ? *size : 16; new_size < count; new_size *= 2)
+		;
+	if ((n = realloc(*p, new_size * elem_size)) == NULL) {
+		msg_syserr(0, "%s: realloc", __FUNCTION__);
+		return(0);
+	}
+	*p = n;
+	*size = new_size;
+	return(1);
+}
+
+/*****************************************************************************
+ * Tells sampler thread that the main thread holds no snapshot anymore.
+ *****************************************************************************/
+void stats_quiescent() {
+	__atomic_add_fetch(&stats_readers_gen, 1, __ATOMIC_SEQ_CST);
 }
 #ifndef __linux__
 
@@ -483,57 +1396,6 @@ size_t sysctl_get_alloc(int *mib, u_int mib_len, void **buf, const char *mib_str
 	return(size);
 }
 
-/*****************************************************************************
- * Finds element of array %iface_stats% corresponding to interface name
- * %ifname%. If successful, returns pointer to found element. Otherwise
- * returns NULL.
- *****************************************************************************/
-struct if_stats *iface_get(const char *ifname) {
-	int i;
-
-	for (i = 0; i < iface_count; i++)
-		if (strcmp(ifname, iface_stats[i].ifname) == 0)
-			return(&iface_stats[i]);
-
-	return(NULL);
-}
-
-/*****************************************************************************
- * Adds new element to array %iface_stats% with interface name %ifname%. If
- * successful, returns pointer to new element. Otherwise returns NULL.
- *****************************************************************************/
-struct if_stats *iface_add(const char *ifname) {
-	struct if_stats *p;
-
-	if (iface_count == IFACE_MAXN) {
-		msg_err(0, "Too many interfaces");
-		return(NULL);
-	}
-
-	p = &iface_stats[iface_count];
-	iface_count++;
-	bzero(p, sizeof(*p));
-	strcpy(p->ifname, ifname);
-	return(p);
-}
-
-/*****************************************************************************
- * Deletes unused elements from %iface_stats% array.
- *****************************************************************************/
-void ifaces_pack() {
-	int i, j;
-
-	for (i = 0, j = 0; i < iface_count; i++) {
-		if (iface_stats[i].f_used && (i > j)) {
-			iface_stats[j] = iface_stats[i];
-			iface_stats[i].f_used = 0;
-		}
-		if (iface_stats[j].f_used)
-			iface_stats[j++].f_used = 0;
-	}
-	iface_count = j;
-}
-
 /*****************************************************************************
  * Updates interfaces statistics.
  *****************************************************************************/
@@ -541,9 +1403,11 @@ void update_iface_counters() {
 	struct if_msghdr *ifm;
 	struct if_data *ifd;
 	struct if_stats *ifs;
+	struct sockaddr_dl *sdl;
 	char *buf, *lim, *next, ifname[IFNAMSIZ];
 	int mib[6];
 	size_t size;
+	u_llong now_ms;
 
 	/* get interfaces statistics from system */
 	mib[0] = CTL_NET;
@@ -555,6 +1419,7 @@ void update_iface_counters() {
 	size = sysctl_get_alloc(mib, 6, (void *)&buf, "NET_RT_IFLIST");
 	if (size == 0)
 		return;
+	now_ms = sched_now() / 1000;
 
 	lim = buf + size;
 	next = buf;
@@ -577,17 +1442,23 @@ void update_iface_counters() {
 		if ((ifm->ifm_flags & IFF_POINTOPOINT) && conf.f_skip_p2p_interfaces)
 			continue;
 
-		/* determine interface name by it's index */
-		if (if_indextoname(ifm->ifm_index, ifname) == NULL) {
+		/* interface name follows the message, if_indextoname(3) asks
+		   the kernel for all interfaces */
+		sdl = (struct sockaddr_dl *)(ifm + 1);
+		if ((ifm->ifm_addrs & RTA_IFP) && sdl->sdl_family == AF_LINK &&
+		    sdl->sdl_nlen > 0 && sdl->sdl_nlen < IFNAMSIZ) {
+			memcpy(ifname, sdl->sdl_data, sdl->sdl_nlen);
+			ifname[sdl->sdl_nlen] = 0;
+		} else if (if_indextoname(ifm->ifm_index, ifname) == NULL) {
 			msg_syserr(0, "update_iface_counters: if_indextoname(%d)", ifm->ifm_index);
 			continue;
 		}
 
 		ifd = &(ifm->ifm_data);
 
-		/* find element of %iface_stats% array corresponding to interface name */
-		if (!(ifs = iface_get(ifname)))
-			if (!(ifs = iface_add(ifname)))
+		/* find element of %ifaces% table corresponding to interface index */
+		if (!(ifs = iface_get(ifm->ifm_index, ifname)))
+			if (!(ifs = iface_add(ifm->ifm_index, ifname)))
 				continue;
 
 		ifs->f_used = 1;
@@ -607,286 +1478,1151 @@ void update_iface_counters() {
 		ifs->prev.obytes	= ifd->ifi_obytes;
 		ifs->prev.oerrors	= ifd->ifi_oerrors;
 		ifs->prev.collisions	= ifd->ifi_collisions;
+
+		iface_rates(ifs, now_ms);
 	}
 	free(buf);
 
-	/* delete unused elements from %iface_stats% array */
+	/* delete unused elements from %ifaces% table */
 	ifaces_pack();
 }
 #if __FreeBSD_version >= 500000
 /*****************************************************************************
- * Finds element of array %hdds_la% corresponding to HDD name.
+ * Updates HDD's statistics.
+ *****************************************************************************/
+void update_hdds_counters() {
+	struct statinfo stats;
+	int i;
+	struct hdd_la *hdd;
+	char name[HDD_NAME_MAXLEN + 1];
+	time_t tm;
+
+	if (conf.f_disable_hdds_la)
+		return;
+
+	stats.dinfo = &hdd_dinfo;
+#if __FreeBSD_version < 500000
+	if (getdevs(&stats) < 0) {
+		msg_err(0, "%s: getdevs: %s", __FUNCTION__, devstat_errbuf);
+#else
+	if (devstat_getdevs(NULL, &stats) < 0) {
+		msg_err(0, "%s: devstat_getdevs: %s", __FUNCTION__, devstat_errbuf);
+#endif
+		return;
+	}
+	tm = time(NULL);
+	for (i=0; i < hdd_dinfo.numdevs; i++) {
+		if (((hdd_dinfo.devices[i].device_type & DEVSTAT_TYPE_MASK) != DEVSTAT_TYPE_DIRECT) || (hdd_dinfo.devices[i].device_type & DEVSTAT_TYPE_PASS))
+			continue;
+		snprintf(name, sizeof(name), "%s%d",
+		    hdd_dinfo.devices[i].device_name,
+		    hdd_dinfo.devices[i].unit_number);
+		if((hdd = hdd_get(name)) == NULL)
+			if ((hdd = hdd_add(name)) == NULL)
+				continue;
+		hdd_update(hdd, tm, hdd_dinfo.devices[i].start_count -
+		    hdd_dinfo.devices[i].end_count);
+	}
+	hdds_pack();
+}
+#endif // __FreeBSD_version
+
+#endif // __linux__
+
+/*****************************************************************************
+ * Finds element of %ifaces% table corresponding to interface with index
+ * %index% and name %ifname%. Index of destroyed interface may be given to
+ * new one, so statistics are reset if name differs. If successful, returns
+ * pointer to found element. Otherwise returns NULL.
+ *****************************************************************************/
+struct if_stats *iface_get(u_int index, const char *ifname) {
+	struct if_stats *p;
+	int i;
+
+	if ((i = table_first(&ifaces, index)) < 0)
+		return(NULL);
+	p = TABLE_ELEM(&ifaces, i);
+	if (strcmp(ifname, p->ifname) != 0) {
+		bzero(p, sizeof(*p));
+		strcpy(p->ifname, ifname);
+	}
+	return(p);
+}
+
+/*****************************************************************************
+ * Adds new element to %ifaces% table for interface with index %index% and
+ * name %ifname%. If successful, returns pointer to new element. Otherwise
+ * returns NULL.
+ *****************************************************************************/
+struct if_stats *iface_add(u_int index, const char *ifname) {
+	struct if_stats *p;
+	int i;
+
+	if ((i = table_add(&ifaces, index)) < 0)
+		return(NULL);
+	p = TABLE_ELEM(&ifaces, i);
+	strcpy(p->ifname, ifname);
+	return(p);
+}
+
+/*****************************************************************************
+ * Deletes unused elements from %ifaces% table. Elements are scanned from the
+ * end, so element moved into place of deleted one is already checked.
+ *****************************************************************************/
+void ifaces_pack() {
+	struct if_stats *p;
+	int i;
+
+	for (i = ifaces.count - 1; i >= 0; i--) {
+		p = TABLE_ELEM(&ifaces, i);
+		if (p->f_used)
+			p->f_used = 0;
+		else
+			table_del(&ifaces, i);
+	}
+}
+
+/*****************************************************************************
+ * Calculates rates of interface %ifs% from its counters sampled at monotonic
+ * time %now_ms%. Averages are exponentially weighted with time constant
+ * equal to their periods, like load average.
+ *****************************************************************************/
+void iface_rates(struct if_stats *ifs, u_llong now_ms) {
+	u_llong v[IF_RATE_MAXN], *base = ifs->rate_base, dt, n;
+	double decay[IF_RATE_PERIODS], *max;
+	int i, j;
+
+	v[0] = ifs->cur.ibytes;
+	v[1] = ifs->cur.obytes;
+	v[2] = ifs->cur.ipackets;
+	v[3] = ifs->cur.opackets;
+	v[4] = ifs->cur.ierrors;
+	v[5] = ifs->cur.oerrors;
+
+	if (ifs->rate_base_ms) {
+		if ((dt = now_ms - ifs->rate_base_ms) == 0)
+			return;
+		/* counters are reset if interface is recreated */
+		for (i = 0; i < IF_RATE_MAXN; i++)
+			if (v[i] < base[i])
+				break;
+		if (i == IF_RATE_MAXN) {
+			for (j = 0; j < IF_RATE_PERIODS; j++)
+				decay[j] = exp(-(double)dt /
+				    (if_rate_periods[j] * 60000.0));
+			n = now_ms / 1000 / IF_PEAK_INTERVAL;
+			max = ifs->peak_max[n % IF_PEAK_INTERVALS];
+			if (ifs->peak_interval[n % IF_PEAK_INTERVALS] != n) {
+				ifs->peak_interval[n % IF_PEAK_INTERVALS] = n;
+				bzero(max, sizeof(ifs->peak_max[0]));
+			}
+			for (i = 0; i < IF_RATE_MAXN; i++) {
+				ifs->rate[i] = (v[i] - base[i]) * 1000.0 / dt;
+				for (j = 0; j < IF_RATE_PERIODS; j++)
+					ifs->rate_avg[i][j] = ifs->f_rates ?
+					    ifs->rate_avg[i][j] * decay[j] +
+					    ifs->rate[i] * (1 - decay[j]) :
+					    ifs->rate[i];
+				if (max[i] < ifs->rate[i])
+					max[i] = ifs->rate[i];
+			}
+			iface_peaks(ifs, n);
+			ifs->f_rates = 1;
+		}
+	}
+	memcpy(base, v, sizeof(ifs->rate_base));
+	ifs->rate_base_ms = now_ms;
+}
+
+/*****************************************************************************
+ * Calculates peak rates of interface %ifs% over %if_rate_periods% ending
+ * with interval %n%. Peaks are maximums over whole intervals of
+ * %IF_PEAK_INTERVAL% seconds, so the oldest part of period may be missed
+ * by less than one interval.
+ *****************************************************************************/
+void iface_peaks(struct if_stats *ifs, u_llong n) {
+	u_llong k;
+	int i, j, m, mmax;
+
+	bzero(ifs->rate_peak, sizeof(ifs->rate_peak));
+	/* intervals before the first one do not exist */
+	mmax = n < IF_PEAK_INTERVALS ? (int)n + 1 : IF_PEAK_INTERVALS;
+	/* peaks of longer periods continue from shorter ones */
+	for (j = 0, m = 0; j < IF_RATE_PERIODS; j++) {
+		if (j > 0)
+			for (i = 0; i < IF_RATE_MAXN; i++)
+				ifs->rate_peak[i][j] = ifs->rate_peak[i][j - 1];
+		for (; m < if_rate_periods[j] * 60 / IF_PEAK_INTERVAL && m < mmax;
+		    m++) {
+			k = (n - m) % IF_PEAK_INTERVALS;
+			if (ifs->peak_interval[k] != n - m)
+				continue;
+			for (i = 0; i < IF_RATE_MAXN; i++)
+				if (ifs->rate_peak[i][j] < ifs->peak_max[k][i])
+					ifs->rate_peak[i][j] =
+					    ifs->peak_max[k][i];
+		}
+	}
+}
+
+/*****************************************************************************
+ * Returns key of HDD %name% in %hdds% table.
+ *****************************************************************************/
+u_int hdd_key(const char *name) {
+	u_int h;
+
+	for (h = FNV_INIT; *name; name++)
+		h = FNV_STEP(h, *name);
+	return(h);
+}
+
+/*****************************************************************************
+ * Finds element of %hdds% table corresponding to HDD %name%.
  * If successful, returns pointer to found element. Otherwise
  * returns NULL.
  *****************************************************************************/
-struct hdd_la *hdd_get(struct devstat *ds) {
+struct hdd_la *hdd_get(const char *name) {
+	struct hdd_la *hdd;
+	int i;
+
+	for (i = table_first(&hdds, hdd_key(name)); i >= 0;
+	    i = table_next(&hdds, i)) {
+		hdd = TABLE_ELEM(&hdds, i);
+		if (!strcmp(name, hdd->device_name))
+			return(hdd);
+	}
+	return(NULL);
+}
+
+/*****************************************************************************
+ * Adds new element for HDD %name% to %hdds% table. If successful, returns
+ * pointer to new element. Otherwise returns NULL.
+ *****************************************************************************/
+struct hdd_la *hdd_add(const char *name) {
+	struct hdd_la *hdd;
+	int i;
+
+	if ((i = table_add(&hdds, hdd_key(name))) < 0)
+		return(NULL);
+	hdd = TABLE_ELEM(&hdds, i);
+	strncpy(hdd->device_name, name, HDD_NAME_MAXLEN);
+	return(hdd);
+}
+
+/*****************************************************************************
+ * Adds number of incompleted commands %queue% of HDD %hdd% sampled at time
+ * %tm% to its statistics and marks it used.
+ *****************************************************************************/
+void hdd_update(struct hdd_la *hdd, time_t tm, int queue) {
+	u_long period;
+
+	hdd->f_used = 1;
+	rollup_push(&hdd->queue, tm, queue);
+	period = tm / HDD_QUEUE_PERIOD;
+	if (hdd->queue_period != period) {
+		if (hdd->queue_period + 1 == period)
+			hdd->queue_prev = hdd->queue_cur;
+		else
+			bzero(&hdd->queue_prev, sizeof(hdd->queue_prev));
+		bzero(&hdd->queue_cur, sizeof(hdd->queue_cur));
+		hdd->queue_period = period;
+	}
+	sketch_add(&hdd->queue_cur, queue);
+}
+
+/*****************************************************************************
+ * Deletes unused elements from %hdds% table. Elements are scanned from the
+ * end, so element moved into place of deleted one is already checked.
+ *****************************************************************************/
+void hdds_pack() {
+	struct hdd_la *hdd;
 	int i;
 
-	for (i = 0; i < hdds_count; i++)
-		if (!strcmp(ds->device_name, hdds_la[i].device_name) && ds->unit_number == hdds_la[i].unit_number)
-			return(&hdds_la[i]);
-	return(NULL);
+	for (i = hdds.count - 1; i >= 0; i--) {
+		hdd = TABLE_ELEM(&hdds, i);
+		if (hdd->f_used)
+			hdd->f_used = 0;
+		else
+			table_del(&hdds, i);
+	}
+}
+
+/*****************************************************************************
+ * Extracts key of socket of type %type% with address %addr% into %key%, %len%
+ * and %port%. %addr% is element of %conf.socket_conf% if %f_conf% is
+ * non-zero and socket reported by the kernel otherwise.
+ *****************************************************************************/
+void sock_key(int type, const void *addr, int f_conf, const void **key,
+    size_t *len, uint16_t *port) {
+	const struct socket_conf *sc = addr;
+#ifndef __linux__
+	const struct inpcb *inp = addr;
+	const struct xunpcb *xunp = addr;
+#else
+	const struct sockaddr_in *sin = addr;
+	const struct sockaddr_in6 *sin6 = addr;
+#endif
+
+	*port = 0;
+	switch (type) {
+	case 0:
+	case 1:
+		*len = sizeof(sc->sockaddr.sin.sin_addr);
+		if (f_conf) {
+			*key = &sc->sockaddr.sin.sin_addr;
+			*port = sc->sockaddr.sin.sin_port;
+		} else {
+#ifndef __linux__
+			*key = &inp->inp_laddr;
+			*port = inp->inp_lport;
+#else
+			*key = &sin->sin_addr;
+			*port = sin->sin_port;
+#endif
+		}
+		break;
+	case 2:
+	case 3:
+		*len = sizeof(sc->sockaddr.sin6.sin6_addr);
+		if (f_conf) {
+			*key = &sc->sockaddr.sin6.sin6_addr;
+			*port = sc->sockaddr.sin6.sin6_port;
+		} else {
+#ifndef __linux__
+			*key = &inp->in6p_laddr;
+			*port = inp->inp_lport;
+#else
+			*key = &sin6->sin6_addr;
+			*port = sin6->sin6_port;
+#endif
+		}
+		break;
+	default:
+		if (f_conf) {
+			*key = sc->sockaddr.sun.sun_path;
+			*len = strlen(sc->sockaddr.sun.sun_path);
+		} else {
+#ifndef __linux__
+			*key = xunp->xu_addr.sun_path;
+			*len = strnlen(xunp->xu_addr.sun_path,
+			    xunp->xu_addr.sun_len -
+			    offsetof(struct sockaddr_un, sun_path));
+#else
+			*key = addr;
+			*len = strlen(addr);
+#endif
+		}
+		break;
+	}
+}
+
+/*****************************************************************************
+ * Returns hash of socket of type %type% with key %key% of %len% bytes and
+ * port %port%.
+ *****************************************************************************/
+u_int sock_hash(int type, const void *key, size_t len, uint16_t port) {
+	const u_char *p = key;
+	u_int h;
+
+	h = FNV_STEP(FNV_INIT, type);
+	h = FNV_STEP(h, port & 0xff);
+	h = FNV_STEP(h, port >> 8);
+	while (len--)
+		h = FNV_STEP(h, *p++);
+	return(h & (sock_hash_size - 1));
+}
+
+/*****************************************************************************
+ * Builds index of %conf.socket_conf% array and discovered sockets by socket
+ * address and drops elements of %sockets_la% array which aren't configured
+ * or discovered anymore. Discovered sockets which don't match new
+ * definitions of discovery or are configured now are forgotten. Must be
+ * called after configuration is read.
+ *****************************************************************************/
+void sock_index_build() {
+	struct sock_auto *a;
+	const void *key;
+	size_t len;
+	uint16_t port;
+	int i, j, k, n;
+
+	/* configured sockets which don't fit into index are ignored,
+	   discovered ones are dropped first */
+	if (!sock_index_alloc(SOCK_COUNT)) {
+		sock_auto_count = 0;
+		if (conf.socket_count > sock_index_size)
+			conf.socket_count = sock_index_size;
+		if (sock_hash_size == 0)
+			conf.socket_count = 0;
+		msg_err(0, "%s: only %d sockets are watched", __FUNCTION__,
+		    conf.socket_count);
+	}
+
+	n = sock_auto_count;
+	sock_auto_count = 0;
+	sock_index_hash();
+	for (i = 0, j = 0; i < n; i++) {
+		a = &sock_auto[i];
+		/* hidden sockets are checked again when found next time */
+		if (a->f_hidden || sock_discover_match(&a->sc,
+		    a->process[0] ? a->process : NULL) <= 0)
+			continue;
+		sock_key(a->sc.type, &a->sc, 1, &key, &len, &port);
+		if (sock_find(a->sc.type, key, len, port) >= 0)
+			continue;
+		for (k = 0; k < conf.socket_count; k++)
+			if (!strcmp(a->sc.var, conf.socket_conf[k].var))
+				break;
+		if (k < conf.socket_count)
+			continue;
+		if (i > j)
+			sock_auto[j] = *a;
+		j++;
+	}
+	sock_auto_count = j;
+	sock_auto_recount();
+	sock_index_hash();
+
+	/* configuration is read rarely, so statistics of sockets are
+	   matched with new configuration by names */
+	for (j = 0; j < sockets_count; j++) {
+		for (i = 0; i < SOCK_COUNT; i++)
+			if (!strcmp(sockets_la[j].var, SOCK_CONF(i)->var))
+				break;
+		if (i < SOCK_COUNT) {
+			sockets_la[j].conf = i;
+			if (sockets_la[j].qlen.size == SOCK_CONF(i)->window)
+				continue;
+			/* history is lost if length of window is changed */
+			window_free(&sockets_la[j].qlen);
+			if (window_init(&sockets_la[j].qlen,
+			    SOCK_CONF(i)->window))
+				continue;
+		}
+		window_free(&sockets_la[j].qlen);
+		if (j != sockets_count - 1)
+			sockets_la[j] = sockets_la[sockets_count - 1];
+		sockets_count --;
+		j --;
+	}
+	sock_index_slots();
+}
+
+/*****************************************************************************
+ * Makes arrays indexed by sockets of index or elements of %sockets_la% big
+ * enough for %count% configured and discovered sockets and chooses size of
+ * hash table with twice as many chains. If successful, returns non-zero.
+ * Otherwise returns zero and arrays keep their sizes.
+ *****************************************************************************/
+int sock_index_alloc(int count) {
+	void *p;
+	u_int hash_size;
+
+	if (count > sock_index_size) {
+		if ((p = realloc(sockets_la, count * sizeof(*sockets_la))) == NULL) {
+			msg_syserr(0, "%s: realloc", __FUNCTION__);
+			return(0);
+		}
+		sockets_la = p;
+		if ((p = realloc(sock_hash_next, count * sizeof(int))) == NULL) {
+			msg_syserr(0, "%s: realloc", __FUNCTION__);
+			return(0);
+		}
+		sock_hash_next = p;
+		if ((p = realloc(sock_slot, count * sizeof(int))) == NULL) {
+			msg_syserr(0, "%s: realloc", __FUNCTION__);
+			return(0);
+		}
+		sock_slot = p;
+		if ((p = realloc(sock_mask, count)) == NULL) {
+			msg_syserr(0, "%s: realloc", __FUNCTION__);
+			return(0);
+		}
+		sock_mask = p;
+		sock_index_size = count;
+	}
+
+	for (hash_size = SOCK_HASH_MIN_SIZE; hash_size < (u_int)count * 2;
+	    hash_size *= 2)
+		;
+	if (hash_size != sock_hash_size) {
+		if ((p = realloc(sock_hash_head, hash_size * sizeof(int))) == NULL) {
+			msg_syserr(0, "%s: realloc", __FUNCTION__);
+			return(0);
+		}
+		sock_hash_head = p;
+		sock_hash_size = hash_size;
+	}
+	return(1);
+}
+
+/*****************************************************************************
+ * Builds hash table of configured and discovered sockets.
+ *****************************************************************************/
+void sock_index_hash() {
+	const struct socket_conf *sc;
+	const void *key;
+	size_t len;
+	uint16_t port;
+	u_int h;
+	int i;
+
+	for (h = 0; h < sock_hash_size; h++)
+		sock_hash_head[h] = -1;
+	for (i = 0; i < SOCK_COUNT; i++) {
+		sc = SOCK_CONF(i);
+		sock_key(sc->type, sc, 1, &key, &len, &port);
+		h = sock_hash(sc->type, key, len, port);
+		sock_hash_next[i] = sock_hash_head[h];
+		sock_hash_head[h] = i;
+	}
+}
+
+/*****************************************************************************
+ * Updates index of %sockets_la% array by elements of %conf.socket_conf%.
+ *****************************************************************************/
+void sock_index_slots() {
+	int i;
+
+	for (i = 0; i < SOCK_COUNT; i++)
+		sock_slot[i] = -1;
+	for (i = 0; i < sockets_count; i++)
+		sock_slot[sockets_la[i].conf] = i;
+}
+
+/*****************************************************************************
+ * Finds configured or discovered socket of type %type% with key %key% of
+ * %len% bytes and port %port% (see sock_key()). If successful, returns its
+ * number in index. Otherwise returns -1.
+ *****************************************************************************/
+int sock_find(int type, const void *key, size_t len, uint16_t port) {
+	const struct socket_conf *sc;
+	const void *ckey;
+	size_t clen;
+	uint16_t cport;
+	int i;
+
+	if (sock_hash_size == 0)
+		return(-1);
+	for (i = sock_hash_head[sock_hash(type, key, len, port)]; i >= 0;
+	    i = sock_hash_next[i]) {
+		sc = SOCK_CONF(i);
+		if (sc->type != type || !sc->var[0])
+			continue;
+		sock_key(type, sc, 1, &ckey, &clen, &cport);
+		if (cport == port && clen == len && !memcmp(ckey, key, len))
+			break;
+	}
+	return(i);
+}
+
+/*****************************************************************************
+ * Finds element of array %sockets_la% corresponding to configured or
+ * discovered socket of type %type% with address %addr% and inode number
+ * %inode% (zero if it's unknown). The element is added if it doesn't exist
+ * yet and not only sockets in burst are sampled. Unknown socket is passed
+ * to discovery. If successful, returns found element number. Otherwise
+ * returns -1.
+ *****************************************************************************/
+int sock_lookup(int type, void *addr, u_int inode) {
+	const void *key;
+	size_t len;
+	uint16_t port;
+	int i;
+
+	sock_key(type, addr, 0, &key, &len, &port);
+	if ((i = sock_find(type, key, len, port)) < 0) {
+		if (!sock_fast && conf.socket_discover_count)
+			sock_discover_found(type, key, len, port, inode);
+		return(-1);
+	}
+	if (i >= conf.socket_count) {
+		sock_auto[i - conf.socket_count].seen = sock_sample_seq;
+		if (sock_auto[i - conf.socket_count].f_hidden)
+			return(-1);
+	}
+	if (sock_slot[i] >= 0)
+		return(sock_slot[i]);
+	if (sock_fast)
+		return(-1);
+	return(sock_add(i));
+}
+
+#define ENTRIES(n) (sizeof(n)/sizeof(n[0]))
+
+/*****************************************************************************
+ * Adds new element to array %sockets_la% for element %confnum% of
+ * %conf.socket_conf% array. If successful, returns new element number.
+ * Otherwise returns -1.
+ *****************************************************************************/
+int sock_add(int confnum) {
+	if (sockets_count == sock_index_size)
+		return(-1);
+
+	bzero(&sockets_la[sockets_count], sizeof(sockets_la[0]));
+	if (!window_init(&sockets_la[sockets_count].qlen,
+	    SOCK_CONF(confnum)->window))
+		return(-1);
+	strcpy(sockets_la[sockets_count].var, SOCK_CONF(confnum)->var);
+	sockets_la[sockets_count].conf = confnum;
+	sock_slot[confnum] = sockets_count;
+	return(sockets_count ++);
+}
+
+/*****************************************************************************
+ * Update element %socknum% in array %sockets_la%. Samples of sockets in
+ * burst taken between regular samples change only bursts.
+ *****************************************************************************/
+void sock_update(int socknum, int qlen, int incqlen, int qlimit) {
+	struct socket_la *socket = &sockets_la[socknum];
+
+	if (!sock_fast) {
+		window_push(&socket->qlen, qlen);
+		rollup_push(&socket->history, sock_sample_tm, qlen);
+	}
+	if (incqlen >= 0)
+		socket->incqlen = incqlen;
+	if (qlimit >= 0)
+		socket->qlimit = qlimit;
+	if (conf.socket_burst > 0)
+		sock_burst(socknum, qlen);
+}
+
+/*****************************************************************************
+ * Updates bursts of element %socknum% in array %sockets_la% by queue length
+ * %qlen%. Burst starts when queue reaches %conf.socket_burst% percents of
+ * its limit and lasts while it stays there. UDP sockets have no queue
+ * limit, so they never burst.
+ *****************************************************************************/
+void sock_burst(int socknum, int qlen) {
+	struct socket_la *socket = &sockets_la[socknum];
+	struct sock_burst *b = &socket->burst;
+	int f_over;
+
+	f_over = qlen > 0 && socket->qlimit > 0 &&
+	    !(SOCK_CONF(socket->conf)->type & 1) &&
+	    (u_llong)qlen * 100 >= (u_llong)socket->qlimit * conf.socket_burst;
+	if (b->f_active) {
+		/* time is counted between samples which both are over
+		   threshold, so interval in which queue went down is not
+		   counted and burst seen by one sample lasts 0 ms */
+		if (f_over) {
+			b->time += sock_sample_ms - b->last_ms;
+			b->duration = sock_sample_ms - b->start_ms;
+			if (qlen > b->peak)
+				b->peak = qlen;
+		}
+		b->f_active = f_over;
+	} else if (f_over) {
+		b->f_active = 1;
+		b->count++;
+		b->start_ms = sock_sample_ms;
+		b->duration = 0;
+		b->peak = qlen;
+	}
+	b->last_ms = sock_sample_ms;
+}
+
+/*****************************************************************************
+ * Sets interval of sampler of sockets in burst: %conf.socket_burst_interval%
+ * while there are such sockets, %SOCK_BURST_IDLE% otherwise. Regular sample
+ * which finds a new burst wakes the sampler up at once.
+ *****************************************************************************/
+void sock_burst_plan() {
+	int i;
+
+	if (conf.socket_burst <= 0 || !sched_is_owner())
+		return;
+	for (i = 0; i < sockets_count; i++)
+		if (sockets_la[i].burst.f_active)
+			break;
+	if (i == sockets_count) {
+		sched_interval(update_socket_bursts, SOCK_BURST_IDLE);
+		return;
+	}
+	sched_interval(update_socket_bursts, conf.socket_burst_interval);
+	if (!sock_fast)
+		sched_wake(update_socket_bursts, conf.socket_burst_interval);
+}
+
+/*****************************************************************************
+ * Deletes unused elements from %sockets_la% array.
+ *****************************************************************************/
+void sock_pack() {
+	int i, j;
+
+	for (i = 0, j = 0; i < sockets_count; i++) {
+		/* socket is forgotten when it doesn't exist for more than
+		   half of window */
+		if (sockets_la[i].qlen.missing > sockets_la[i].qlen.size / 2) {
+			window_free(&sockets_la[i].qlen);
+			continue;
+		}
+		if (i > j)
+			sockets_la[j] = sockets_la[i];
+		j++;
+	}
+	sockets_count = j;
+	sock_index_slots();
+	sock_auto_pack();
+}
+
+/*****************************************************************************
+ * Checks socket %sc% owned by process %process% against definitions of
+ * discovery. If process isn't known, %process% is NULL. Returns 1 if socket
+ * is discovered, 0 if it isn't and -1 if it depends on owner of socket.
+ *****************************************************************************/
+int sock_discover_match(const struct socket_conf *sc, const char *process) {
+	const struct socket_discover_conf *sd;
+	uint16_t port;
+	int i, res;
+
+	port = 0;
+	if (sc->type < 2)
+		port = ntohs(sc->sockaddr.sin.sin_port);
+	else if (sc->type < 4)
+		port = ntohs(sc->sockaddr.sin6.sin6_port);
+
+	res = 0;
+	for (i = 0; i < conf.socket_discover_count; i++) {
+		sd = &conf.socket_discover[i];
+		if (sd->type != sc->type || port < sd->port_min ||
+		    port > sd->port_max)
+			continue;
+		if (!sd->process[0])
+			return(1);
+		if (process == NULL)
+			res = -1;
+		else if (!strcmp(sd->process, process))
+			return(1);
+	}
+	return(res);
 }
 
 /*****************************************************************************
- * Adds new element to array %hdds_la%. If successful, returns pointer
- to new element. Otherwise returns NULL.
+ * Remembers socket of type %type% with key %key% of %len% bytes, port %port%
+ * (see sock_key()) and inode number %inode% which isn't in index, so it's
+ * checked against definitions of discovery after the sample.
  *****************************************************************************/
-struct hdd_la *hdd_add(struct devstat *ds) {
+void sock_discover_found(int type, const void *key, size_t len, uint16_t port,
+    u_int inode) {
+	struct sock_found *f;
+	void *p;
+	int res;
+
+	if (sock_found_count == sock_found_size) {
+		if ((p = realloc(sock_found, (sock_found_size ?
+		    sock_found_size * 2 : 16) * sizeof(*sock_found))) == NULL) {
+			msg_syserr(0, "%s: realloc", __FUNCTION__);
+			return;
+		}
+		sock_found = p;
+#ifdef __linux__
+		if ((p = realloc(sock_owners, (sock_found_size ?
+		    sock_found_size * 2 : 16) * sizeof(*sock_owners))) == NULL) {
+			msg_syserr(0, "%s: realloc", __FUNCTION__);
+			return;
+		}
+		sock_owners = p;
+#endif
+		sock_found_size = sock_found_size ? sock_found_size * 2 : 16;
+	}
 
-	if (hdds_count == sizeof(hdds_la) / sizeof(hdds_la[0])) {
-		msg_err(0, "Too many disks");
-		return(NULL);
+	f = &sock_found[sock_found_count];
+	bzero(&f->sc, sizeof(f->sc));
+	f->sc.type = type;
+	f->sc.window = DFL_SOCKET_WINDOW;
+	switch (type) {
+	case 0:
+	case 1:
+		f->sc.sockaddr.sin.sin_family = AF_INET;
+		f->sc.sockaddr.sin.sin_port = port;
+		memcpy(&f->sc.sockaddr.sin.sin_addr, key, len);
+		break;
+	case 2:
+	case 3:
+		f->sc.sockaddr.sin6.sin6_family = AF_INET6;
+		f->sc.sockaddr.sin6.sin6_port = port;
+		memcpy(&f->sc.sockaddr.sin6.sin6_addr, key, len);
+		break;
+	default:
+		if (len == 0 || len >= sizeof(f->sc.sockaddr.sun.sun_path))
+			return;
+		f->sc.sockaddr.sun.sun_family = AF_LOCAL;
+		memcpy(f->sc.sockaddr.sun.sun_path, key, len);
+		break;
+	}
+
+	if ((res = sock_discover_match(&f->sc, NULL)) == 0)
+		return;
+	/* space is left for sockets already found during the sample, they
+	   may become both watched and hidden. Socket whose owner isn't known
+	   yet may be hidden, so it isn't counted as not discovered */
+	if (sock_found_count >= 2 * conf.socket_discover_max -
+	    sock_auto_watched - sock_auto_hidden) {
+		if (res > 0)
+			sock_auto_overflow++;
+		return;
 	}
-	bzero(&hdds_la[hdds_count], sizeof(hdds_la[0]));
-	strcpy(hdds_la[hdds_count].device_name, ds->device_name);
-	hdds_la[hdds_count].unit_number = ds->unit_number;
-	return(&hdds_la[hdds_count++]);
+	f->f_owner = (res < 0);
+#ifdef __linux__
+	f->inode = inode;
+#endif
+	sock_found_count++;
 }
 
 /*****************************************************************************
- * Deletes unused elements from %hdds_la% array.
+ * Adds sockets found during the sample to index. If definition of
+ * discovery matching socket needs name of process, owners of sockets are
+ * looked for once for all such sockets.
  *****************************************************************************/
-void hdds_pack() {
-	int i, j;
+void sock_discover() {
+	int i;
+#ifdef __linux__
+	int n;
 
-	for (i = 0, j = 0; i < hdds_count; i++) {
-		if (hdds_la[i].f_used && (i > j)) {
-			hdds_la[j] = hdds_la[i];
-			hdds_la[i].f_used = 0;
-		}
-		if (hdds_la[j].f_used)
-			hdds_la[j++].f_used = 0;
+	n = 0;
+	for (i = 0; i < sock_found_count; i++) {
+		if (!sock_found[i].f_owner)
+			continue;
+		sock_owners[n].inode = sock_found[i].inode;
+		sock_owners[n].tag = i;
+		n++;
 	}
-	hdds_count = j;
+	proc_net_owners(sock_owners, n);
+	while (n--)
+		sock_auto_add(&sock_found[sock_owners[n].tag].sc,
+		    sock_owners[n].name);
+#endif
+	for (i = 0; i < sock_found_count; i++)
+		if (!sock_found[i].f_owner)
+			sock_auto_add(&sock_found[i].sc, NULL);
+	sock_found_count = 0;
 }
 
 /*****************************************************************************
- * Updates HDD's statistics.
+ * Adds discovered socket %sc% owned by process %process% (NULL if it isn't
+ * known) to index. Socket which doesn't match definitions of discovery or
+ * whose name is already used is added hidden, so it isn't checked again
+ * while it exists. Watched and hidden sockets over %conf.socket_discover_max%
+ * aren't added, hidden ones are checked again when found next time.
  *****************************************************************************/
-void update_hdds_counters() {
-	struct statinfo stats;
-	int i, ptr_5min;
-	long	delta, last_count;
-	struct hdd_la *hdd;
-
-	if (conf.f_disable_hdds_la)
+void sock_auto_add(const struct socket_conf *sc, const char *process) {
+	struct sock_auto *a;
+	const void *key;
+	size_t len;
+	uint16_t port;
+	u_int h, hash_size;
+	int i, n;
+	char f_hidden;
+
+	/* the same socket is reported more than once if SO_REUSEPORT is
+	   used */
+	sock_key(sc->type, sc, 1, &key, &len, &port);
+	if (sock_find(sc->type, key, len, port) >= 0)
 		return;
 
-	stats.dinfo = &hdd_dinfo;
-#if __FreeBSD_version < 500000
-	if (getdevs(&stats) < 0) {
-		msg_err(0, "%s: getdevs: %s", __FUNCTION__, devstat_errbuf);
-#else
-	if (devstat_getdevs(NULL, &stats) < 0) {
-		msg_err(0, "%s: devstat_getdevs: %s", __FUNCTION__, devstat_errbuf);
-#endif
+	f_hidden = (sock_discover_match(sc, process) <= 0);
+	if (f_hidden ? sock_auto_hidden >= conf.socket_discover_max :
+	    sock_auto_watched >= conf.socket_discover_max) {
+		if (!f_hidden)
+			sock_auto_overflow++;
 		return;
 	}
-	for (i=0; i < hdd_dinfo.numdevs; i++) {
-		if (((hdd_dinfo.devices[i].device_type & DEVSTAT_TYPE_MASK) != DEVSTAT_TYPE_DIRECT) || (hdd_dinfo.devices[i].device_type & DEVSTAT_TYPE_PASS))
-			continue;
-		if((hdd = hdd_get(&hdd_dinfo.devices[i])) == NULL)
-			if ((hdd = hdd_add(&hdd_dinfo.devices[i])) == NULL)
-				continue;
-		delta = hdd_dinfo.devices[i].start_count - hdd_dinfo.devices[i].end_count;
-		hdd->f_used = 1;
-		hdd->last_ptr++;
-		if(hdd->last_ptr >= sizeof(hdd->incompleted_count) / sizeof(hdd->incompleted_count[0]))
-			hdd->last_ptr -= sizeof(hdd->incompleted_count) / sizeof(hdd->incompleted_count[0]);
-		last_count = hdd->incompleted_count[hdd->last_ptr];
-		hdd->sum_15min += delta - last_count;
-		if((ptr_5min = hdd->last_ptr - 300) < 0)
-			ptr_5min += sizeof(hdd->incompleted_count) / sizeof(hdd->incompleted_count[0]);
-		last_count = hdd->incompleted_count[ptr_5min];
-		hdd->sum_5min += delta - last_count;
-		hdd->incompleted_count[hdd->last_ptr] = delta;
+
+	if (sock_auto_count == sock_auto_size) {
+		n = sock_auto_size ? sock_auto_size * 2 : 16;
+		if ((a = realloc(sock_auto, n * sizeof(*a))) == NULL) {
+			msg_syserr(0, "%s: realloc", __FUNCTION__);
+			return;
+		}
+		sock_auto = a;
+		sock_auto_size = n;
 	}
-	hdds_pack();
-}
-#endif // __FreeBSD_version
+	hash_size = sock_hash_size;
+	if (!sock_index_alloc(SOCK_COUNT + 1))
+		return;
 
-#endif // __linux__
+	a = &sock_auto[sock_auto_count];
+	a->sc = *sc;
+	a->process[0] = 0;
+	if (process)
+		strcpy(a->process, process);
+	a->f_hidden = f_hidden;
+	a->seen = sock_sample_seq;
+	sock_auto_name(&a->sc);
+	/* socket isn't watched if its name is used by configured or other
+	   watched socket */
+	for (i = 0; i < SOCK_COUNT && !a->f_hidden; i++)
+		if ((i < conf.socket_count || !sock_auto[i -
+		    conf.socket_count].f_hidden) &&
+		    !strcmp(a->sc.var, SOCK_CONF(i)->var))
+			a->f_hidden = 1;
+	if (a->f_hidden && !f_hidden &&
+	    sock_auto_hidden >= conf.socket_discover_max)
+		return;
+	msg_debug(1, "%s: %s socket %s", __FUNCTION__,
+	    a->f_hidden ? "hidden" : "discovered", a->sc.var);
+
+	n = SOCK_COUNT;
+	sock_auto_count++;
+	if (a->f_hidden)
+		sock_auto_hidden++;
+	else
+		sock_auto_watched++;
+	sock_slot[n] = -1;
+	if (hash_size != sock_hash_size) {
+		sock_index_hash();
+		return;
+	}
+	h = sock_hash(sc->type, key, len, port);
+	sock_hash_next[n] = sock_hash_head[h];
+	sock_hash_head[h] = n;
+}
 
 /*****************************************************************************
- * Finds element of array %socket_conf% corresponding to socket type and
- * address %addr%. If successful, returns pointer to found name. Otherwise
- * returns NULL.
+ * Names discovered socket %sc% by its type and address. Characters which
+ * aren't allowed in names of configured sockets are replaced with '_'.
  *****************************************************************************/
-char *sockname_get(int type, void *addr) {
-	int i;
-#ifndef __linux__
-	struct inpcb *inp = addr;
-	struct xunpcb *xunp = addr;
-#else
-	struct sockaddr_in *sin = addr;
-	struct sockaddr_in6 *sin6 = addr;
-	char * path = addr;
-#endif
+void sock_auto_name(struct socket_conf *sc) {
+	char addr[INET6_ADDRSTRLEN], *p;
+
+	switch (sc->type) {
+	case 0:
+	case 1:
+		inet_ntop(AF_INET, &sc->sockaddr.sin.sin_addr, addr,
+		    sizeof(addr));
+		snprintf(sc->var, sizeof(sc->var), "%s_%s_%u",
+		    sock_type_names[sc->type], addr,
+		    ntohs(sc->sockaddr.sin.sin_port));
+		break;
+	case 2:
+	case 3:
+		inet_ntop(AF_INET6, &sc->sockaddr.sin6.sin6_addr, addr,
+		    sizeof(addr));
+		snprintf(sc->var, sizeof(sc->var), "%s_%s_%u",
+		    sock_type_names[sc->type], addr,
+		    ntohs(sc->sockaddr.sin6.sin6_port));
+		break;
+	default:
+		snprintf(sc->var, sizeof(sc->var), "%s_%s",
+		    sock_type_names[sc->type], sc->sockaddr.sun.sun_path);
+		break;
+	}
+	for (p = sc->var; *p; p++)
+		if (!strchr(VAR_CHSET ".", *p))
+			*p = '_';
+	parse_tolower(sc->var);
+}
 
-	for (i=0; i < conf.socket_count; i++) {
-		if (!conf.socket_conf[i].var[0] ||
-		    conf.socket_conf[i].type != type)
+/*****************************************************************************
+ * Deletes discovered sockets which have gone: watched ones are forgotten
+ * with their element of %sockets_la% array, hidden ones when they aren't
+ * found by regular sample.
+ *****************************************************************************/
+void sock_auto_pack() {
+	int i, j, n;
+
+	for (i = 0, j = 0; i < sock_auto_count; i++) {
+		n = conf.socket_count + i;
+		if (sock_auto[i].f_hidden ?
+		    sock_auto[i].seen != sock_sample_seq : sock_slot[n] < 0) {
+			msg_debug(1, "%s: socket %s has gone", __FUNCTION__,
+			    sock_auto[i].sc.var);
 			continue;
-		switch(type) {
-		case 0:
-		case 1:
-#ifndef __linux__
-			if (conf.socket_conf[i].sockaddr.sin.sin_port != inp->inp_lport)
-				continue;
-			if (conf.socket_conf[i].sockaddr.sin.sin_addr.s_addr != inp->inp_laddr.s_addr)
-				continue;
-#else
-			if (conf.socket_conf[i].sockaddr.sin.sin_port != sin->sin_port)
-				continue;
-			if (conf.socket_conf[i].sockaddr.sin.sin_addr.s_addr != sin->sin_addr.s_addr)
-				continue;
-#endif
-			return(conf.socket_conf[i].var);
-			break;
-		case 2:
-		case 3:
-#ifndef __linux__
-			if (conf.socket_conf[i].sockaddr.sin6.sin6_port != inp->inp_lport)
-				continue;
-			if (memcmp(&conf.socket_conf[i].sockaddr.sin6.sin6_addr, &inp->in6p_laddr, sizeof(inp->in6p_laddr)))
-				continue;
-#else
-			if (conf.socket_conf[i].sockaddr.sin6.sin6_port != sin6->sin6_port)
-				continue;
-			if (memcmp(&conf.socket_conf[i].sockaddr.sin6.sin6_addr, &sin6->sin6_addr, sizeof(sin6->sin6_addr)))
-				continue;
-#endif
-			return(conf.socket_conf[i].var);
-			break;
-		case 4:
-#ifndef __linux__
-			if (strncmp(conf.socket_conf[i].sockaddr.sun.sun_path, xunp->xu_addr.sun_path, xunp->xu_addr.sun_len - offsetof(struct sockaddr_un, sun_path)))
-#else
-			if (strcmp(conf.socket_conf[i].sockaddr.sun.sun_path, path))
-#endif
-				continue;
-			return(conf.socket_conf[i].var);
-			break;
 		}
+		if (sock_slot[n] >= 0)
+			sockets_la[sock_slot[n]].conf = conf.socket_count + j;
+		if (i > j)
+			sock_auto[j] = sock_auto[i];
+		j++;
 	}
-	return(NULL);
+	if (j == sock_auto_count)
+		return;
+	sock_auto_count = j;
+	sock_auto_recount();
+	sock_index_hash();
+	sock_index_slots();
 }
 
 /*****************************************************************************
- * Finds element of array %sockets_la% corresponding to socket name %name%.
- * If successful, returns pointer to found name. Otherwise returns NULL.
+ * Counts watched and hidden discovered sockets.
  *****************************************************************************/
-int sock_get(char *name) {
+void sock_auto_recount() {
 	int i;
 
-	for (i=0; i < sockets_count; i++) {
-		if (strcmp(sockets_la[i].var, name))
-			continue;
-		return(i);
-	}
-	return(-1);
+	sock_auto_watched = sock_auto_hidden = 0;
+	for (i = 0; i < sock_auto_count; i++)
+		if (sock_auto[i].f_hidden)
+			sock_auto_hidden++;
+		else
+			sock_auto_watched++;
 }
 
-#define ENTRIES(n) (sizeof(n)/sizeof(n[0]))
+#ifdef __linux__
+/* Structure for state of socket statistics update passed to
+   sock_diag_found() */
+struct sock_diag_state {
+	int	type;
+	char	*sockmask;
+	int	*typemask;
+};
 
 /*****************************************************************************
- * Adds new element to array %sockets_la% with socket name %var%. If
- * successful, returns new element number. Otherwise returns -1.
+ * Updates statistics of socket with address %addr% and inode number %inode%
+ * reported by the kernel with queue length %qlen% and its limit %qlimit%.
+ * %st% is state of the update.
  *****************************************************************************/
-int sock_add(char *name) {
-	if (sockets_count == SOCKET_MAXN)
-		return(-1);
+void sock_diag_set(struct sock_diag_state *st, void *addr, u_int inode,
+    int qlen, int qlimit) {
+	int socknum;
 
-	bzero(&sockets_la[sockets_count], sizeof(sockets_la[0]));
-	strcpy(sockets_la[sockets_count].var, name);
-	memset(sockets_la[sockets_count].qlen, -1, sizeof(sockets_la[sockets_count].qlen));
-	return(sockets_count ++);
+	if (!st->typemask[st->type])
+		return;
+	if ((socknum = sock_lookup(st->type, addr, inode)) < 0)
+		return;
+	/* skip already updated sockets */
+	if (st->sockmask[socknum])
+		return;
+	st->typemask[st->type] --;
+	st->sockmask[socknum] = 1;
+	sock_update(socknum, qlen, -1, qlimit);
 }
 
 /*****************************************************************************
- * Update element %socknum% in array %sockets_la%.
+ * Updates statistics of TCP or UDP socket %msg% reported by the kernel.
+ * %arg% points to structure sock_diag_state.
  *****************************************************************************/
-void sock_update(int socknum, int qlen, int incqlen, int qlimit) {
-	struct socket_la *socket = &sockets_la[socknum];
-	int lastqlen = 0;
-
-	if (socket->last_ptr == socket->first_ptr) {
-		socket->first_ptr ++;
-		if (socket->first_ptr >= ENTRIES(sockets_la[0].qlen))
-			socket->first_ptr -= ENTRIES(sockets_la[0].qlen);
-		if ((lastqlen = socket->qlen[socket->first_ptr]) >= 0) {
-			socket->entries--;
-			socket->sum -= lastqlen;
-		}
-	}
-	socket->last_ptr ++;
-	if (socket->last_ptr >= ENTRIES(sockets_la[0].qlen))
-		socket->last_ptr -= ENTRIES(sockets_la[0].qlen);
-	if (qlen >= 0) {
-		socket->entries ++;
-		socket->sum += qlen;
+void sock_diag_found(const struct inet_diag_msg *msg, void *arg) {
+	struct sockaddr_in sin;
+	struct sockaddr_in6 sin6;
+	struct sock_diag_state *st = arg;
+
+	/* for listening TCP socket the kernel reports length of accept queue
+	   and its limit, for UDP socket - bytes in receive and send buffers */
+	if (st->type < 2) {
+		bzero(&sin, sizeof(sin));
+		sin.sin_port = msg->id.idiag_sport;
+		sin.sin_addr.s_addr = msg->id.idiag_src[0];
+		sock_diag_set(st, &sin, msg->idiag_inode, msg->idiag_rqueue,
+		    msg->idiag_wqueue);
+	} else {
+		bzero(&sin6, sizeof(sin6));
+		sin6.sin6_port = msg->id.idiag_sport;
+		memcpy(&sin6.sin6_addr, msg->id.idiag_src, sizeof(sin6.sin6_addr));
+		sock_diag_set(st, &sin6, msg->idiag_inode, msg->idiag_rqueue,
+		    msg->idiag_wqueue);
 	}
-	socket->qlen[socket->last_ptr] = qlen;
-	if (incqlen >= 0)
-		socket->incqlen = incqlen;
-	if (qlimit >= 0)
-		socket->qlimit = qlimit;
 }
 
 /*****************************************************************************
- * Deletes unused elements from %sockets_la% array.
+ * Updates statistics of listening unix domain socket with path %path%,
+ * inode number %inode% and queue lengths %rqlen% reported by the kernel.
+ * %arg% points to structure sock_diag_state.
  *****************************************************************************/
-void sock_pack() {
-	int i, j, d;
-	char sockmask[sockets_count];
+void sock_diag_unix_found(const char *path, u_int inode,
+    const struct unix_diag_rqlen *rqlen, void *arg) {
+	/* old kernels don't report queue lengths */
+	if (rqlen)
+		sock_diag_set(arg, (void *)path, inode, rqlen->udiag_rqueue,
+		    rqlen->udiag_wqueue);
+	else
+		sock_diag_set(arg, (void *)path, inode, 0, -1);
+}
 
-	for (i = 0; i < sockets_count; i++) {
-		sockmask[i] = 1;
-		d = sockets_la[i].last_ptr - sockets_la[i].first_ptr;
-		if (d <= 0)
-			d += ENTRIES(sockets_la[0].qlen);
-		if (d - sockets_la[i].entries > ENTRIES(sockets_la[0].qlen) / 2) {
-			d = 0;
-			if (sockets_la[i].qlen[sockets_la[i].last_ptr] < 0)
-				d++;
-			else
-				continue;
-			for (j = sockets_la[i].last_ptr - 1; j != (int) sockets_la[i].first_ptr; j--, d++) {
-				if (j < 0)
-					j += ENTRIES(sockets_la[0].qlen);
-				if (sockets_la[i].qlen[j] >= 0)
-					break;
-			}
-			if (d > (int) ENTRIES(sockets_la[0].qlen) / 2)
-				sockmask[i] = 0;
+/*****************************************************************************
+ * Updates statistics of sockets of type %type% using NETLINK_SOCK_DIAG, so
+ * only listening sockets (on configured ports and ports of discovery for
+ * TCP and UDP) are reported by the kernel instead of all sockets of the
+ * system. %sockmask%
+ * and %typemask% are the same as in update_socket_counters(). If the kernel
+ * doesn't support such requests, returns zero. Otherwise returns non-zero.
+ *****************************************************************************/
+int sock_diag_update(int type, char *sockmask, int *typemask) {
+	const struct socket_conf *sc;
+	const struct socket_discover_conf *sd;
+	struct sock_diag_state st;
+	uint16_t ports[SOCK_DIAG_PORTS_MAXN][2];
+	int i, n, nports, f_all;
+
+	st.type = type;
+	st.sockmask = sockmask;
+	st.typemask = typemask;
+	if (type == 4)
+		return(sock_diag_unix(1 << TCP_LISTEN, sock_diag_unix_found,
+		    &st));
+
+	nports = 0;
+	f_all = 0;
+	for (i = 0; i < SOCK_COUNT; i++) {
+		sc = SOCK_CONF(i);
+		if (sc->type != type)
+			continue;
+		/* only ports of sockets in burst are sampled between regular
+		   samples, discovered sockets are covered by ranges below */
+		if (sock_fast ? ((n = sock_slot[i]) < 0 ||
+		    !sockets_la[n].burst.f_active) : i >= conf.socket_count)
+			continue;
+		if (nports == SOCK_DIAG_PORTS_MAXN) {
+			f_all = 1;
+			break;
 		}
+		ports[nports][0] = ports[nports][1] = ntohs((type < 2) ?
+		    sc->sockaddr.sin.sin_port : sc->sockaddr.sin6.sin6_port);
+		nports++;
 	}
-	for (i = 0, j = 0; i < sockets_count; i++) {
-		if (sockmask[i] && (i > j)) {
-			sockets_la[j] = sockets_la[i];
-			sockmask[i] = 0;
+	for (i = 0; !sock_fast && i < conf.socket_discover_count; i++) {
+		sd = &conf.socket_discover[i];
+		if (sd->type != type)
+			continue;
+		if (nports == SOCK_DIAG_PORTS_MAXN) {
+			f_all = 1;
+			break;
 		}
-		if (sockmask[j])
-			sockmask[j++] = 0;
+		ports[nports][0] = sd->port_min;
+		ports[nports][1] = sd->port_max;
+		nports++;
 	}
-	sockets_count = j;
+	/* unfiltered dump if there are too many ports for the filter */
+	if (f_all)
+		nports = 0;
+
+	return(sock_diag_inet((type < 2) ? AF_INET : AF_INET6,
+	    (type & 1) ? IPPROTO_UDP : IPPROTO_TCP,
+	    (type & 1) ? (1 << TCP_CLOSE) : (1 << TCP_LISTEN),
+	    ports, nports, sock_diag_found, &st));
 }
+#endif
 
 /*****************************************************************************
  * Updates socket statistics.
  *****************************************************************************/
-void update_socket_counters(char force) {
+void update_socket_counters() {
+	sock_sample(0);
+	sock_burst_plan();
+}
+
+/*****************************************************************************
+ * Updates statistics of sockets in burst between regular samples.
+ *****************************************************************************/
+void update_socket_bursts() {
+	sock_sample(1);
+	sock_burst_plan();
+}
+
+/*****************************************************************************
+ * Samples all configured sockets or only sockets in burst if %f_fast% is
+ * non-zero.
+ *****************************************************************************/
+void sock_sample(int f_fast) {
 	int proto, type, socknum = 0;
-	int i;
 	uint j;
-	char sockmask[SOCKET_MAXN];
+	char *sockmask = sock_mask;
 	int typemask[5];
-	char *name, *sockname;
+	char *name;
 	size_t len;
-	struct timespec ts;
-	float dtime;
 #ifndef __linux__
+	int i;
 	char unixmibs[][28] = {
 		"net.local.stream.pcblist",	"net.local.dgram.pcblist",
 		"net.local.raw.pcblist",	"net.local.rdm.pcblist",
@@ -923,72 +2659,54 @@ void update_socket_counters(char force) {
 		{ "/proc/net/udp6",	3 },
 		{ "/proc/net/unix",	4 }
 	};
-	char buf[1024];
-	char f_line_too_long;
-	FILE *fp = 0;
+	struct proc_net_sock ps;
 	char *p;
-	struct sockaddr_in sin;
-	struct sockaddr_in6 sin6;
-	char * path;
 	void * inp;
-	unsigned state, tx_queue, rx_queue;
-	char hexchar[]="0123456789aAbBcCdDeEfF";
 #endif
 
-	if (!conf.socket_count) {
-		if (sockets_count)
-			sockets_count = 0;
+	/* statistics of sockets which aren't configured anymore are dropped
+	   by sock_index_build() */
+	if (!conf.socket_count && !conf.socket_discover_count)
 		return;
-	}
-#ifdef CLOCK_MONOTONIC
-	if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
-#else
-	if (clock_gettime(CLOCK_REALTIME, &ts) == 0)
-#endif
-		dtime = (ts.tv_sec - sockets_ltime.tv_sec) + (ts.tv_nsec - sockets_ltime.tv_nsec) * 0.000000001;
-	else {
-		msg_syserr(0, "clock_gettime()");
-#ifdef SELECT_TIMEOUT
-		dtime = SELECT_TIMEOUT;
-#else
-		dtime = 1;
-#endif
-	}
-	if (!force && dtime < conf.socket_interval)
-		return;
-	sockets_ltime = ts;
-	bzero(sockmask, sizeof(sockmask));
 	bzero(typemask, sizeof(typemask));
-	for (j = 0; (int) j < conf.socket_count; j++)
-		typemask[conf.socket_conf[j].type] ++;
+	if (f_fast) {
+		/* sockets not in burst are treated as already updated */
+		memset(sockmask, 1, sock_index_size);
+		for (j = 0; (int) j < sockets_count; j++) {
+			if (!sockets_la[j].burst.f_active)
+				continue;
+			sockmask[j] = 0;
+			typemask[SOCK_CONF(sockets_la[j].conf)->type] ++;
+		}
+		/* UDP sockets never burst */
+		if (!typemask[0] && !typemask[2] && !typemask[4])
+			return;
+	} else {
+		sock_sample_tm = time(NULL);
+		sock_sample_seq++;
+		sock_auto_overflow = 0;
+		bzero(sockmask, sock_index_size);
+		for (j = 0; (int) j < conf.socket_count; j++)
+			typemask[conf.socket_conf[j].type] ++;
+		/* negative number of sockets never reaches zero, so all
+		   sockets of discovered types are looked at */
+		for (j = 0; (int) j < conf.socket_discover_count; j++)
+			typemask[conf.socket_discover[j].type] = -1;
+	}
+	sock_fast = f_fast;
+	sock_sample_ms = sched_now() / 1000;
 #ifndef __linux__
 	/* Check cached KVM entries */
 	bzero(&kvm_unp, sizeof(kvm_unp));
 	if ((kvmd=kvm_openfiles(NULL, NULL, NULL, O_RDONLY, errbuf)) != NULL) {
-#endif
 		for (j = 0; (int) j < sockets_count; j++) {
-			sockname = sockets_la[j].var;
-			socknum = -1;
-			for (i = 0; i < conf.socket_count; i++)
-				if (!strcmp(sockname, conf.socket_conf[i].var)) {
-					socknum = i;
-					break;
-				}
-			/* First of all we're need to purge old data */
-			if (socknum == -1) {
-				if ((int) j != sockets_count)
-					sockets_la[j] = sockets_la[sockets_count-1];
-				sockets_count --;
-				j --;
+			if (sockmask[j])
 				continue;
-			}
-#ifdef __linux__
-		}
-#else
+			socknum = sockets_la[j].conf;
 			/* we're can't update sockets w/o cached address */
 			if (sockets_la[j].pcb == NULL || sockets_la[j].so == NULL)
 				continue;
-			if (conf.socket_conf[socknum].type < 4) {
+			if (SOCK_CONF(socknum)->type < 4) {
 				if ((i = kvm_read(kvmd, (uintptr_t) sockets_la[j].pcb, &kvm_inp, sizeof(kvm_inp))) != sizeof(kvm_inp)) {
 					msg_syserr(0, "kvm_read(): read %d bytes while %d expected, error %s", i, sizeof(kvm_inp), kvm_geterr(kvmd));
 					continue;
@@ -1000,15 +2718,15 @@ void update_socket_counters(char force) {
 				if (kvm_inp.inp_socket != sockets_la[j].so)
 					continue;
 				/* Check addresses */
-				if (conf.socket_conf[socknum].type < 2) {
-					if (kvm_inp.inp_lport != conf.socket_conf[socknum].sockaddr.sin.sin_port)
+				if (SOCK_CONF(socknum)->type < 2) {
+					if (kvm_inp.inp_lport != SOCK_CONF(socknum)->sockaddr.sin.sin_port)
 						continue;
-					if (kvm_inp.inp_laddr.s_addr != conf.socket_conf[socknum].sockaddr.sin.sin_addr.s_addr)
+					if (kvm_inp.inp_laddr.s_addr != SOCK_CONF(socknum)->sockaddr.sin.sin_addr.s_addr)
 						continue;
 				} else {
-					if (kvm_inp.inp_lport != conf.socket_conf[socknum].sockaddr.sin6.sin6_port)
+					if (kvm_inp.inp_lport != SOCK_CONF(socknum)->sockaddr.sin6.sin6_port)
 						continue;
-					if(memcmp(&kvm_inp.in6p_laddr, &conf.socket_conf[socknum].sockaddr.sin6.sin6_addr, sizeof(kvm_inp.in6p_laddr)))
+					if(memcmp(&kvm_inp.in6p_laddr, &SOCK_CONF(socknum)->sockaddr.sin6.sin6_addr, sizeof(kvm_inp.in6p_laddr)))
 						continue;
 				}
 			} else {
@@ -1032,7 +2750,7 @@ void update_socket_counters(char force) {
 				continue;
 			sock_update(j, kvm_so.so_qlen, kvm_so.so_incqlen, kvm_so.so_qlimit);
 			sockmask[j] = 1;
-			typemask[conf.socket_conf[socknum].type] --;
+			typemask[SOCK_CONF(socknum)->type] --;
 		}
 		kvm_close(kvmd);
 	} else
@@ -1050,13 +2768,15 @@ void update_socket_counters(char force) {
 #else
 		if (!typemask[(type = ipmibs[j].type)])
 			continue;
+		/* /proc is read only if the kernel can't filter sockets */
+		if (sock_diag_update(type, sockmask, typemask))
+			continue;
 #endif
 		name = ipmibs[j].mib;
 #ifdef __linux__
-		if ((fp=fopen(name, "r")) == NULL)
+		if ((p = proc_net_read(j, name)) == NULL)
 			continue;
-		f_line_too_long = 0;
-		while(fgets(buf, sizeof(buf), fp)) {
+		while (proc_net_next(&p, type, &ps)) {
 #else
 		proto = ipmibs[j].proto;
 		if (sysctlbyname(name, NULL, &len, NULL, 0) == -1)
@@ -1091,76 +2811,21 @@ void update_socket_counters(char force) {
 #endif
 
 #ifdef __linux__
-			parse_chomp(buf);
-			if (strlen(buf) == (sizeof(buf) - 1)) {
-				f_line_too_long = 1;
-				continue;
-			}
-			if (f_line_too_long) {
-				f_line_too_long = 0;
-				continue;
-			}
-			parse_rtrim(buf);
-			switch (type) {
-			case 0:
-			case 1:
-				if (sscanf(buf,
-				           "%*d: %x:%hx %*x:%*x %x %x:%x %*x",
-				           &sin.sin_addr.s_addr, &sin.sin_port,
-				           &state, &tx_queue, &rx_queue) < 5)
-					continue;
-				sin.sin_port = htons(sin.sin_port);
-				inp = &sin;
-				break;
-			case 2:
-			case 3:
-				if (sscanf(buf,
-				           "%*d: %08x%08x%08x%08x:%hx %*08x%*08x%*08x%*08x:%*x %x %x:%x %*x",
-				           &sin6.sin6_addr.s6_addr32[0],
-				           &sin6.sin6_addr.s6_addr32[1],
-				           &sin6.sin6_addr.s6_addr32[2],
-				           &sin6.sin6_addr.s6_addr32[3],
-				           &sin6.sin6_port,
-				           &state, &tx_queue, &rx_queue) < 8)
-					continue;
-				sin6.sin6_port = htons(sin6.sin6_port);
-				inp = &sin6;
-				break;
-			case 4:
-				if (parse_get_chset(buf, &path, hexchar, -16) &&
-				    parse_get_ch(path, &path, ':') &&
-				    parse_get_wspace(path, &path) &&
-				    parse_get_chset(path, &path, hexchar, -8) &&
-				    parse_get_wspace(path, &path) &&
-				    parse_get_chset(path, &path, hexchar, -8) &&
-				    parse_get_wspace(path, &path) &&
-				    parse_get_chset(path, &path, hexchar, -8) &&
-				    parse_get_wspace(path, &path) &&
-				    parse_get_chset(path, &path, hexchar, -4) &&
-				    parse_get_wspace(path, &path) &&
-				    parse_get_chset(path, &path, hexchar, -2) &&
-				    parse_get_wspace(path, &path) &&
-				    parse_get_chset(path, &path, hexchar, -8) &&
-				    parse_get_wspace(path, &path) && *path) {
-					tx_queue = 0;
-					rx_queue = 0;
-					inp = path;
-				} else
-					continue;
-				break;
-			}
-			if ((type == 0 || type == 2) && state != 10)
-				continue;
-			if ((type == 1 || type == 3) && state != 7)
-				continue;
+			if (type < 2)
+				inp = &ps.sin;
+			else if (type < 4)
+				inp = &ps.sin6;
+			else
+				inp = ps.path;
 #endif
 
 			if (!typemask[type])
 				continue;
-			if ((sockname = sockname_get(type, inp)) == NULL)
-				continue;
-			if (((socknum = sock_get(sockname)) < 0) &&
-			    ((socknum = sock_add(sockname)) < 0))
+#ifndef __linux__
+			if ((socknum = sock_lookup(type, inp, 0)) < 0)
+#else
+			if ((socknum = sock_lookup(type, inp, ps.inode)) < 0)
+#endif
 				continue;
 			/* skip already updated sockets */
 			if (sockmask[socknum])
@@ -1173,12 +2838,9 @@ void update_socket_counters(char force) {
 			sockets_la[socknum].so = inp->inp_socket;
 			sockets_la[socknum].pcb = so->so_pcb;
 #else
-			sock_update(socknum, rx_queue, -1, tx_queue);
+			sock_update(socknum, ps.rx_queue, -1, ps.tx_queue);
 #endif
 		}
-#ifdef __linux__
-		fclose(fp);
-#endif
 	}
 #ifndef __linux__
 	type = 4;
@@ -1212,10 +2874,7 @@ void update_socket_counters(char force) {
 			if (!so->so_qlimit)
 				continue;
 
-			if ((sockname = sockname_get(type, xunp)) == NULL)
-				continue;
-			if (((socknum = sock_get(sockname)) < 0) &&
-			    ((socknum = sock_add(sockname)) < 0))
+			if ((socknum = sock_lookup(type, xunp, 0)) < 0)
 				continue;
 			if (sockmask[socknum])
 				continue;
@@ -1241,7 +2900,11 @@ void update_socket_counters(char force) {
 #endif
 
 	}
-	sock_pack();
+	if (!f_fast) {
+		sock_pack();
+		sock_discover();
+	}
+	sock_fast = 0;
 }
 
 /*****************************************************************************
@@ -1370,12 +3033,13 @@ void terminate_pgroup(int signo) {
 
 /*****************************************************************************/
 void do_help() {
-	printf("ussd version %u.%u.%u\n", (u_int)MAJOR_VERSION, (u_int)MINOR_VERSION,
+	out_printf("ussd version %u.%u.%u\n", (u_int)MAJOR_VERSION, (u_int)MINOR_VERSION,
 	    (u_int)REVISION);
-	printf(
+	out_printf(
 	    "Valid commands are:\n"
 	    "        ACPI_TEMPERATURE\n"
 	    "        APACHE\n"
+	    "        CACHE\n"
 	    "        DEBUG\n"
 	    "        DF\n"
 	    "        EXEC\n"
@@ -1390,8 +3054,11 @@ void do_help() {
 	    "        QUIT\n"
 	    "        RAID\n"
 	    "        RAID_LIST\n"
+	    "        SAMPLERS\n"
+	    "        SESSION\n"
 	    "        SMART [<attribute>|ALL]\n"
 	    "        SMBIOS\n"
+	    "        SUBSCRIBE <command> <interval>\n"
 	    "        SWAP\n"
 	    "        SYSCTL <variable>\n"
 	    "        TIME <time>\n"
@@ -1410,8 +3077,8 @@ void do_time() {
 
 	tm = get_remote_tm();
 	local_tm = time(NULL);
-	printf("%lu time %lu\n",	(u_long)tm, (u_long)local_tm);
-	printf("%lu timediff %ld\n",	(u_long)tm, (long)(local_tm - tm));
+	out_printf("%lu time %lu\n",	(u_long)tm, (u_long)local_tm);
+	out_printf("%lu timediff %ld\n",	(u_long)tm, (long)(local_tm - tm));
 
 	msg_debug(1, "Processing of TIME command finished");
 }
@@ -1430,21 +3097,21 @@ void do_uname() {
 	mib[0] = CTL_HW;
 	mib[1] = HW_MACHINE;
 	if (sysctl_get_alloc(mib, 2, (void *)&buf, "HW_MACHINE")) {
-		printf("%lu machine %s\n", 	(u_long)tm, buf);
+		out_printf("%lu machine %s\n", 	(u_long)tm, buf);
 		free(buf);
 	}
 
 	mib[0] = CTL_KERN;
 	mib[1] = KERN_OSTYPE;
 	if (sysctl_get_alloc(mib, 2, (void *)&buf, "KERN_OSTYPE")) {
-		printf("%lu os_name %s\n", 	(u_long)tm, buf);
+		out_printf("%lu os_name %s\n", 	(u_long)tm, buf);
 		free(buf);
 	}
 
 	mib[0] = CTL_KERN;
 	mib[1] = KERN_OSRELEASE;
 	if (sysctl_get_alloc(mib, 2, (void *)&buf, "KERN_OSRELEASE")) {
-		printf("%lu os_release %s\n", 	(u_long)tm, buf);
+		out_printf("%lu os_release %s\n", 	(u_long)tm, buf);
 		free(buf);
 	}
 
@@ -1454,7 +3121,7 @@ void do_uname() {
 		for (i = 0; i < strlen(buf); i++)
 			if (buf[i] == '\n')
 				buf[i] = ' ';
-		printf("%lu os_version %s\n", 	(u_long)tm, buf);
+		out_printf("%lu os_version %s\n", 	(u_long)tm, buf);
 		free(buf);
 	}
 
@@ -1476,38 +3143,72 @@ void do_uptime() {
 	mib[1] = KERN_BOOTTIME;
 	if (sysctl_get(mib, 2, &boot_tm, sizeof(boot_tm), "KERN_BOOTTIME")) {
 		uptime = time(NULL) - boot_tm.tv_sec;
-		printf("%lu uptime %lu\n",	(u_long)tm, (uptime > 0 ? uptime : 0));
+		out_printf("%lu uptime %lu\n",	(u_long)tm, (uptime > 0 ? uptime : 0));
 	}
 
 	mib[0] = CTL_VM;
 	mib[1] = VM_LOADAVG;
 	if (sysctl_get(mib, 2, &load, sizeof(load), "VM_LOADAVG")) {
-		printf("%lu load1 %.2f\n",	(u_long)tm, (double)load.ldavg[0] / (double)load.fscale);
-		printf("%lu load5 %.2f\n",	(u_long)tm, (double)load.ldavg[1] / (double)load.fscale);
-		printf("%lu load15 %.2f\n",	(u_long)tm, (double)load.ldavg[2] / (double)load.fscale);
+		out_printf("%lu load1 %.2f\n",	(u_long)tm, (double)load.ldavg[0] / (double)load.fscale);
+		out_printf("%lu load5 %.2f\n",	(u_long)tm, (double)load.ldavg[1] / (double)load.fscale);
+		out_printf("%lu load15 %.2f\n",	(u_long)tm, (double)load.ldavg[2] / (double)load.fscale);
 	}
 
 	msg_debug(1, "Processing of UPTIME command finished");
 }
 
+#endif //__linux__
+
 /*****************************************************************************/
 void do_netstat() {
+	const struct stats_snapshot *snap;
+	const struct iface_stats *ifs;
+	char name[64];
 	time_t tm;
-	struct if_stats *ifs;
-	int i;
+	int i, j, k;
 
 	msg_debug(1, "Processing of NETSTAT command started");
 
+	if ((snap = stats_get()) == NULL) {
+		msg_debug(1, "Processing of NETSTAT command finished");
+		return;
+	}
 	tm = get_remote_tm();
-	for (i = 0; i < iface_count; i++) {
-		ifs = &iface_stats[i];
-		printf("%lu interface_packets_in:%s %llu\n",	(u_long)tm, ifs->ifname, ifs->cur.ipackets);
-		printf("%lu interface_bytes_in:%s %llu\n",	(u_long)tm, ifs->ifname, ifs->cur.ibytes);
-		printf("%lu interface_errors_in:%s %llu\n",	(u_long)tm, ifs->ifname, ifs->cur.ierrors);
-		printf("%lu interface_packets_out:%s %llu\n",	(u_long)tm, ifs->ifname, ifs->cur.opackets);
-		printf("%lu interface_bytes_out:%s %llu\n",	(u_long)tm, ifs->ifname, ifs->cur.obytes);
-		printf("%lu interface_errors_out:%s %llu\n",	(u_long)tm, ifs->ifname, ifs->cur.oerrors);
-		printf("%lu interface_collisions:%s %llu\n",	(u_long)tm, ifs->ifname, ifs->cur.collisions);
+	for (i = 0; i < snap->iface_count; i++) {
+		ifs = &snap->ifaces[i];
+		out_u64(tm, out_key("interface_packets_in", ifs->ifname),	ifs->cur.ipackets);
+		out_u64(tm, out_key("interface_bytes_in", ifs->ifname),		ifs->cur.ibytes);
+		out_u64(tm, out_key("interface_errors_in", ifs->ifname),	ifs->cur.ierrors);
+		out_u64(tm, out_key("interface_packets_out", ifs->ifname),	ifs->cur.opackets);
+		out_u64(tm, out_key("interface_bytes_out", ifs->ifname),	ifs->cur.obytes);
+		out_u64(tm, out_key("interface_errors_out", ifs->ifname),	ifs->cur.oerrors);
+		out_u64(tm, out_key("interface_collisions", ifs->ifname),	ifs->cur.collisions);
+#ifdef __linux__
+		out_u64(tm, out_key("interface_drops_in", ifs->ifname),		ifs->cur.idrops);
+		out_u64(tm, out_key("interface_drops_out", ifs->ifname),	ifs->cur.odrops);
+		out_u64(tm, out_key("interface_fifo_errors_in", ifs->ifname),	ifs->cur.ififo);
+		out_u64(tm, out_key("interface_fifo_errors_out", ifs->ifname),	ifs->cur.ofifo);
+		out_u64(tm, out_key("interface_multicast_in", ifs->ifname),	ifs->cur.imcasts);
+#endif
+		if (!ifs->f_rates)
+			continue;
+		for (j = 0; j < IF_RATE_MAXN; j++) {
+			snprintf(name, sizeof(name), "interface_%s_rate",
+			    if_rate_names[j]);
+			out_double(tm, out_key(name, ifs->ifname), ifs->rate[j], 2);
+			for (k = 0; k < IF_RATE_PERIODS; k++) {
+				snprintf(name, sizeof(name), "interface_%s_rate%d",
+				    if_rate_names[j], if_rate_periods[k]);
+				out_double(tm, out_key(name, ifs->ifname),
+				    ifs->rate_avg[j][k], 2);
+			}
+			for (k = 0; k < IF_RATE_PERIODS; k++) {
+				snprintf(name, sizeof(name), "interface_%s_peak%d",
+				    if_rate_names[j], if_rate_periods[k]);
+				out_double(tm, out_key(name, ifs->ifname),
+				    ifs->rate_peak[j][k], 2);
+			}
+		}
 	}
 
 	msg_debug(1, "Processing of NETSTAT command finished");
@@ -1515,22 +3216,44 @@ void do_netstat() {
 
 /*****************************************************************************/
 void do_hdd_load() {
-#if __FreeBSD_version >= 500000
+#if defined(__linux__) || __FreeBSD_version >= 500000
+	const struct stats_snapshot *snap;
+	const struct hdd_stats *hdd;
 	time_t tm;
 	int i;
-	double load5, load15;
 
 	msg_debug(1, "Processing of HDDLOAD command started");
+	if ((snap = stats_get()) == NULL)
+		return;
 	tm = get_remote_tm();
-	for (i = 0; i < hdds_count; i++) {
-		load5 = hdds_la[i].sum_5min / 300.0;
-		load15 = hdds_la[i].sum_15min / 900.0;
-		printf("%lu hdd_load5:%s%d %.2f\n",	(u_long)tm, hdds_la[i].device_name, hdds_la[i].unit_number, load5);
-		printf("%lu hdd_load15:%s%d %.2f\n",	(u_long)tm, hdds_la[i].device_name, hdds_la[i].unit_number, load15);
+	for (i = 0; i < snap->hdds_count; i++) {
+		hdd = &snap->hdds[i];
+		out_double(tm, out_key("hdd_load1", hdd->device_name),	hdd->load1, 2);
+		out_double(tm, out_key("hdd_load5", hdd->device_name),	hdd->load5, 2);
+		out_double(tm, out_key("hdd_load15", hdd->device_name),	hdd->load15, 2);
+		out_double(tm, out_key("hdd_load60", hdd->device_name),	hdd->load60, 2);
+		out_i64(tm, out_key("hdd_queue_p50", hdd->device_name),	hdd->p50);
+		out_i64(tm, out_key("hdd_queue_p95", hdd->device_name),	hdd->p95);
+		out_i64(tm, out_key("hdd_queue_p99", hdd->device_name),	hdd->p99);
+#ifdef __linux__
+		if (!hdd->f_rates)
+			continue;
+		out_double(tm, out_key("hdd_utilization", hdd->device_name),
+		    hdd->util, 2);
+		out_double(tm, out_key("hdd_iops_read", hdd->device_name),
+		    hdd->iops_read, 2);
+		out_double(tm, out_key("hdd_iops_written", hdd->device_name),
+		    hdd->iops_written, 2);
+		out_double(tm, out_key("hdd_await_read", hdd->device_name),
+		    hdd->await_read, 2);
+		out_double(tm, out_key("hdd_await_written", hdd->device_name),
+		    hdd->await_written, 2);
+#endif
 	}
 #endif
 }
 
+#ifndef __linux__
 /*****************************************************************************/
 void do_vmstat() {
 	time_t tm;
@@ -1554,12 +3277,12 @@ void do_vmstat() {
 	cp_total = 0;
 	for (i = 0; i < CPUSTATES; i++)
 		cp_total += cp_time[i];
-	printf("%lu cp_user %lu\n",	(u_long)tm, cp_time[CP_USER]);
-	printf("%lu cp_nice %lu\n",	(u_long)tm, cp_time[CP_NICE]);
-	printf("%lu cp_sys %lu\n",	(u_long)tm, cp_time[CP_SYS]);
-	printf("%lu cp_intr %lu\n",	(u_long)tm, cp_time[CP_INTR]);
-	printf("%lu cp_idle %lu\n",	(u_long)tm, cp_time[CP_IDLE]);
-	printf("%lu cp_total %lu\n",	(u_long)tm, cp_total);
+	out_printf("%lu cp_user %lu\n",	(u_long)tm, cp_time[CP_USER]);
+	out_printf("%lu cp_nice %lu\n",	(u_long)tm, cp_time[CP_NICE]);
+	out_printf("%lu cp_sys %lu\n",	(u_long)tm, cp_time[CP_SYS]);
+	out_printf("%lu cp_intr %lu\n",	(u_long)tm, cp_time[CP_INTR]);
+	out_printf("%lu cp_idle %lu\n",	(u_long)tm, cp_time[CP_IDLE]);
+	out_printf("%lu cp_total %lu\n",	(u_long)tm, cp_total);
 
 	msg_debug(1, "Processing of VMSTAT command finished");
 }
@@ -1603,14 +3326,14 @@ void do_ifaddrs() {
 					strncpy(addr_buf1, "_0.0.0.0", sizeof(addr_buf1));
 				else
 					strncpy(addr_buf1, inet_ntoa(sin->sin_addr), sizeof(addr_buf1));
-				printf("%lu interface_inet:%s %s -> %s\n", (u_long)tm, ifa->ifa_name, addr_buf, addr_buf1);
+				out_printf("%lu interface_inet:%s %s -> %s\n", (u_long)tm, ifa->ifa_name, addr_buf, addr_buf1);
 			} else {
 				sin = (struct sockaddr_in *) ifa->ifa_netmask;
 				if (sin == NULL)
 					strncpy(addr_buf1, "_0.0.0.0", sizeof(addr_buf1));
 				else
 					strncpy(addr_buf1, inet_ntoa(sin->sin_addr), sizeof(addr_buf1));
-				printf("%lu interface_inet:%s %s/%s\n", (u_long)tm, ifa->ifa_name, addr_buf, addr_buf1);
+				out_printf("%lu interface_inet:%s %s/%s\n", (u_long)tm, ifa->ifa_name, addr_buf, addr_buf1);
 			}
 			break;
 #ifndef __linux__
@@ -1624,7 +3347,7 @@ void do_ifaddrs() {
 #endif
 			))
 				break;
-			printf("%lu interface_ether:%s %s\n",
+			out_printf("%lu interface_ether:%s %s\n",
 			       (u_long)tm, ifa->ifa_name,
 			       ether_ntoa((struct ether_addr *)LLADDR(sdl)));
 #else
@@ -1633,7 +3356,7 @@ void do_ifaddrs() {
 			if (sll == NULL || sll->sll_protocol != 0 || sll->sll_hatype != 1 ||
 			    sll->sll_pkttype != 0 || sll->sll_halen != 6)
 				break;
-			printf("%lu interface_ether:%s %02x:%02x:%02x:%02x:%02x:%02x\n",
+			out_printf("%lu interface_ether:%s %02x:%02x:%02x:%02x:%02x:%02x\n",
 			       (u_long)tm, ifa->ifa_name,
 			       sll->sll_addr[0], sll->sll_addr[1], sll->sll_addr[2],
 			       sll->sll_addr[3], sll->sll_addr[4], sll->sll_addr[5]);
@@ -1660,7 +3383,7 @@ void do_ifaddrs() {
 					if (getnameinfo((struct sockaddr *) sin6, sizeof(addr_buf1), addr_buf1, sizeof(addr_buf1), NULL, 0, 0) != 0)
 #endif
 						inet_ntop(AF_INET6, &sin6->sin6_addr, addr_buf1, sizeof(addr_buf));
-					printf("%lu interface_inet6:%s %s -> %s\n", (u_long)tm, ifa->ifa_name, addr_buf, addr_buf1);
+					out_printf("%lu interface_inet6:%s %s -> %s\n", (u_long)tm, ifa->ifa_name, addr_buf, addr_buf1);
 				}
 			} else {
 				sin6 = (struct sockaddr_in6 *)ifa->ifa_netmask;
@@ -1677,7 +3400,7 @@ void do_ifaddrs() {
 							break;
 					for(; i != 0; i--)
 						if (*ptr & (1 << i)) {
-							printf ("prefixlen=%d\n", prefixlen);
+							out_printf("prefixlen=%d\n", prefixlen);
 							prefixlen = -1;
 							break;
 						}
@@ -1690,7 +3413,7 @@ void do_ifaddrs() {
 							}
 					}
 				}
-				printf("%lu interface_inet6:%s %s/%d\n", (u_long)tm, ifa->ifa_name, addr_buf, prefixlen);
+				out_printf("%lu interface_inet6:%s %s/%d\n", (u_long)tm, ifa->ifa_name, addr_buf, prefixlen);
 			}
 			break;
 		}
@@ -1725,7 +3448,7 @@ void do_acpi_temperature() {
 			msg_debug(1, "Processing of ACPI_TEMPERATURE command finished");
 			return;
 		}
-		printf("%lu acpi_temperature:tz%d %.0f\n", (u_long)tm, i,
+		out_printf("%lu acpi_temperature:tz%d %.0f\n", (u_long)tm, i,
 		    ((double)temp - 2731.5) / 10);
 #else
 	for (i=0; i < sizeof(mibs)/sizeof(mibs[0]); i++) {
@@ -1752,7 +3475,7 @@ void do_acpi_temperature() {
 				temp = strtol(buf, &p, 10);
 				if ((p == buf) || *p)
 					continue;
-				printf("%lu acpi_temperature:%s%d %.3f\n", (u_long)tm, mibs[i][1], j, temp / 1000.0);
+				out_printf("%lu acpi_temperature:%s%d %.3f\n", (u_long)tm, mibs[i][1], j, temp / 1000.0);
 				break;
 			case 'h':
 				/* this functional is slightly like do_cputemp in linux,
@@ -1805,7 +3528,7 @@ void do_acpi_temperature() {
 					for (p=buf; *p; p++)
 						if (index(VAR_CHSET, *p) == NULL)
 							*p = '_';
-					printf("%lu acpi_temperature:%s %.3f\n", (u_long)tm, buf, temp / 1000.0);
+					out_printf("%lu acpi_temperature:%s %.3f\n", (u_long)tm, buf, temp / 1000.0);
 				}
 				closedir(dev);
 				break;
@@ -1820,35 +3543,54 @@ void do_acpi_temperature() {
 
 /*****************************************************************************/
 void do_socket() {
+	const struct stats_snapshot *snap;
+	const struct socket_stats *sock;
 	time_t tm;
-	int i, j, maxq;
-	double load;
+	int i;
 
 	msg_debug(1, "Processing of SOCKET command started");
-	/* We're must update socket counters! */
-	if (conf.socket_interval < 0)
-		update_socket_counters(1);
+	/* counters are updated on demand by client process in its own copy,
+	   the main process has them updated by sampler thread. Copy taken
+	   while sampler ran may be inconsistent, and workers have no copy
+	   at all, the last published counters are returned then */
+	if (conf.socket_interval < 0 && !sched_is_owner() &&
+	    !sched_is_torn() && stats_shared == NULL) {
+		update_socket_counters();
+		stats_publish();
+	}
+	if ((snap = stats_get()) == NULL)
+		return;
 	tm = get_remote_tm();
-	for (i = 0; i < sockets_count; i++) {
-		load = 0;
-		maxq = sockets_la[i].qlen[sockets_la[i].last_ptr];
-		for (j = sockets_la[i].last_ptr - 1; j != (int) sockets_la[i].first_ptr; j--) {
-			if (j < 0)
-				j += ENTRIES(sockets_la[0].qlen);
-			if (maxq < sockets_la[i].qlen[j])
-				maxq = sockets_la[i].qlen[j];
-		}
-		if (sockets_la[i].entries)
-			load = sockets_la[i].sum / sockets_la[i].entries;
-		printf("%lu socket_exist:%s %d\n", (u_long) tm, sockets_la[i].var, (sockets_la[i].qlen[sockets_la[i].last_ptr] >= 0));
-		printf("%lu socket_queue_receive_limit:%s %d\n", (u_long) tm, sockets_la[i].var, sockets_la[i].qlimit);
-		if (sockets_la[i].qlen[sockets_la[i].last_ptr] >= 0)
-			printf("%lu socket_queue_receive_length:%s %d\n", (u_long) tm, sockets_la[i].var, sockets_la[i].qlen[sockets_la[i].last_ptr]);
+	if (conf.socket_discover_count) {
+		out_i64(tm, out_key("socket_discovered", NULL),	snap->sockets_auto);
+		out_i64(tm, out_key("socket_discover_overflow", NULL),	snap->sockets_overflow);
+	}
+	for (i = 0; i < snap->sockets_count; i++) {
+		sock = &snap->sockets[i];
+		out_i64(tm, out_key("socket_exist", sock->var),			sock->qlen >= 0);
+		out_i64(tm, out_key("socket_queue_receive_limit", sock->var),	sock->qlimit);
+		if (sock->qlen >= 0)
+			out_i64(tm, out_key("socket_queue_receive_length", sock->var),	sock->qlen);
 #ifndef __linux__
-		printf("%lu socket_queue_receive_inclength:%s %d\n", (u_long) tm, sockets_la[i].var, sockets_la[i].incqlen);
+		out_i64(tm, out_key("socket_queue_receive_inclength", sock->var),	sock->incqlen);
 #endif
-		printf("%lu socket_queue_receive_load_average:%s %f\n", (u_long) tm, sockets_la[i].var, load);
-		printf("%lu socket_queue_receive_peak_max:%s %d\n", (u_long) tm, sockets_la[i].var, maxq);
+		out_double(tm, out_key("socket_queue_receive_load_average", sock->var), sock->load, 6);
+		out_i64(tm, out_key("socket_queue_receive_peak_max", sock->var),	sock->peak);
+		out_i64(tm, out_key("socket_queue_receive_p50", sock->var),	sock->p50);
+		out_i64(tm, out_key("socket_queue_receive_p95", sock->var),	sock->p95);
+		out_i64(tm, out_key("socket_queue_receive_p99", sock->var),	sock->p99);
+		out_double(tm, out_key("socket_queue_receive_load1", sock->var), sock->load1, 6);
+		out_double(tm, out_key("socket_queue_receive_load5", sock->var), sock->load5, 6);
+		out_double(tm, out_key("socket_queue_receive_load15", sock->var), sock->load15, 6);
+		out_double(tm, out_key("socket_queue_receive_load60", sock->var), sock->load60, 6);
+		out_i64(tm, out_key("socket_queue_receive_peak60", sock->var),	sock->peak60);
+		if (conf.socket_burst <= 0)
+			continue;
+		out_i64(tm, out_key("socket_queue_receive_bursts", sock->var),	sock->burst.count);
+		out_i64(tm, out_key("socket_queue_receive_burst_time", sock->var),	sock->burst.time);
+		out_i64(tm, out_key("socket_queue_receive_burst_duration", sock->var),	sock->burst.duration);
+		out_i64(tm, out_key("socket_queue_receive_burst_peak", sock->var),	sock->burst.peak);
+		out_i64(tm, out_key("socket_queue_receive_burst_active", sock->var),	sock->burst.f_active);
 	}
 }
 
@@ -1937,21 +3679,21 @@ void get_apache_stats(struct apache_conf *apache) {
 		/* process HTTP body */
 		if (       parse_get_str(line, &p, "Total Accesses: ") &&
 		    parse_get_ullint(p, &p, &n) && !*p) {
-			printf("%lu apache_total_accesses:%s %llu\n", (u_long)tm, apache->var, n);
+			out_printf("%lu apache_total_accesses:%s %llu\n", (u_long)tm, apache->var, n);
 		} else if (parse_get_str(line, &p, "Total kBytes: ") &&
 		    parse_get_ullint(p, &p, &n) && !*p) {
-			printf("%lu apache_total_kbytes:%s %llu\n", (u_long)tm, apache->var, n);
+			out_printf("%lu apache_total_kbytes:%s %llu\n", (u_long)tm, apache->var, n);
 		} else if ((parse_get_str(line, &p, "BusyServers: ") ||
 		    parse_get_str(line, &p, "BusyWorkers: ")) &&
 		    parse_get_ullint(p, &p, &n) && !*p) {
-			printf("%lu apache_busy_servers:%s %llu\n", (u_long)tm, apache->var, n);
+			out_printf("%lu apache_busy_servers:%s %llu\n", (u_long)tm, apache->var, n);
 		} else if ((parse_get_str(line, &p, "IdleServers: ") ||
 		    parse_get_str(line, &p, "IdleWorkers: ")) &&
 		    parse_get_ullint(p, &p, &n) && !*p) {
-			printf("%lu apache_idle_servers:%s %llu\n", (u_long)tm, apache->var, n);
+			out_printf("%lu apache_idle_servers:%s %llu\n", (u_long)tm, apache->var, n);
 		} else if (parse_get_str(line, &p, "Uptime: ") &&
 		    parse_get_ullint(p, &p, &n) && !*p) {
-			printf("%lu apache_uptime:%s %llu\n", (u_long)tm, apache->var, n);
+			out_printf("%lu apache_uptime:%s %llu\n", (u_long)tm, apache->var, n);
 		}
 	}
 	fclose(f);
@@ -1968,6 +3710,7 @@ void do_apache() {
 	for (i = 0; i < conf.apache_count; i++) {
 		tm = get_remote_tm();
 		if ((pid = fork()) == 0) { /* child */
+			out_child();
 			alarm(CHILD_TIMEOUT);
 			init_remote_tm(tm);
 			get_apache_stats(&conf.apache_conf[i]);
@@ -2064,21 +3807,21 @@ void get_nginx_stats(struct nginx_conf *nginx) {
 		/* process HTTP body */
 		if (parse_get_str(line, &p, "Active connections: ") &&
 		    parse_get_ullint(p, &p, &n)) {
-			printf("%lu nginx_active:%s %llu\n", (u_long)tm, nginx->var, n);
+			out_printf("%lu nginx_active:%s %llu\n", (u_long)tm, nginx->var, n);
 		} else if (parse_get_wspace(line, &p) && parse_get_ullint(p, &p, &n1) &&
 		    parse_get_wspace(p, &p) && parse_get_ullint(p, &p, &n2) &&
 		    parse_get_wspace(p, &p) && parse_get_ullint(p, &p, &n3)) {
-			printf("%lu nginx_accepts:%s %llu\n", (u_long)tm, nginx->var, n1);
-			printf("%lu nginx_handled:%s %llu\n", (u_long)tm, nginx->var, n2);
-			printf("%lu nginx_requests:%s %llu\n", (u_long)tm, nginx->var, n3);
+			out_printf("%lu nginx_accepts:%s %llu\n", (u_long)tm, nginx->var, n1);
+			out_printf("%lu nginx_handled:%s %llu\n", (u_long)tm, nginx->var, n2);
+			out_printf("%lu nginx_requests:%s %llu\n", (u_long)tm, nginx->var, n3);
 		} else if (parse_get_str(line, &p, "Reading: ") &&
 		    parse_get_ullint(p, &p, &n1) && parse_get_wspace(p, &p) &&
 		    parse_get_str(p, &p, "Writing: ") && parse_get_ullint(p, &p, &n2) &&
 		    parse_get_wspace(p, &p) && parse_get_str(p, &p, "Waiting: ") &&
 		    parse_get_ullint(p, &p, &n3)) {
-			printf("%lu nginx_reading:%s %llu\n", (u_long)tm, nginx->var, n1);
-			printf("%lu nginx_writing:%s %llu\n", (u_long)tm, nginx->var, n2);
-			printf("%lu nginx_waiting:%s %llu\n", (u_long)tm, nginx->var, n3);
+			out_printf("%lu nginx_reading:%s %llu\n", (u_long)tm, nginx->var, n1);
+			out_printf("%lu nginx_writing:%s %llu\n", (u_long)tm, nginx->var, n2);
+			out_printf("%lu nginx_waiting:%s %llu\n", (u_long)tm, nginx->var, n3);
 		}
 	}
 	fclose(f);
@@ -2095,6 +3838,7 @@ void do_nginx() {
 	for (i = 0; i < conf.nginx_count; i++) {
 		tm = get_remote_tm();
 		if ((pid = fork()) == 0) { /* child */
+			out_child();
 			alarm(CHILD_TIMEOUT);
 			init_remote_tm(tm);
 			get_nginx_stats(&conf.nginx_conf[i]);
@@ -2154,7 +3898,7 @@ void get_memcache_stats(struct memcache_conf *memcache) {
 				strncpy(var, var_b, var_e - var_b);
 				var[var_e - var_b] = 0;
 				parse_tolower(var);
-				printf("%lu memcache_%s:%s %s\n", (u_long)tm, var, memcache->var, rest);
+				out_printf("%lu memcache_%s:%s %s\n", (u_long)tm, var, memcache->var, rest);
 			}
 		} else if (parse_get_str(line, &p, "END") && !*p) {
 			break;
@@ -2174,6 +3918,7 @@ void do_memcache() {
 	for (i = 0; i < conf.memcache_count; i++) {
 		tm = get_remote_tm();
 		if ((pid = fork()) == 0) { /* child */
+			out_child();
 			alarm(CHILD_TIMEOUT);
 			init_remote_tm(tm);
 			get_memcache_stats(&conf.memcache_conf[i]);
@@ -2238,7 +3983,7 @@ void get_exec_stats(struct exec_conf *exec) {
 			strncpy(var, var_b, var_e - var_b);
 			var[var_e - var_b] = 0;
 			parse_tolower(var);
-			printf("%lu exec_%s %s\n", (u_long)tm, var, rest);
+			out_printf("%lu exec_%s %s\n", (u_long)tm, var, rest);
 		}
 	}
 	pclose(f);
@@ -2255,6 +4000,7 @@ void do_exec() {
 	for (i = 0; i < conf.exec_count; i++) {
 		tm = get_remote_tm();
 		if ((pid = fork()) == 0) { /* child */
+			out_child();
 			alarm(CHILD_TIMEOUT);
 			init_remote_tm(tm);
 			setpgid(0, getpid());
@@ -2270,7 +4016,135 @@ void do_exec() {
 	msg_debug(1, "Processing of EXEC command finished");
 }
 #ifdef __linux__
+/*****************************************************************************
+ * Updates interfaces statistics. Counters of all interfaces are taken from
+ * one netlink dump.
+ *****************************************************************************/
+void update_iface_counters() {
+	u_llong now_ms;
+
+	now_ms = sched_now() / 1000;
+	if (rtnl_links(iface_link, &now_ms))
+		/* delete unused elements from %ifaces% table */
+		ifaces_pack();
+}
+
+/*****************************************************************************
+ * Stores 64-bit counters %st% of interface with index %index%, name
+ * %ifname% and IFF_* flags %flags% into %ifaces% table and updates its
+ * rates, %arg% points to monotonic time of the sample in milliseconds.
+ * Called by rtnl_links() for every interface.
+ *****************************************************************************/
+void iface_link(u_int index, const char *ifname, u_int flags,
+    const struct rtnl_link_stats64 *st, void *arg) {
+	struct if_stats *ifs;
+
+	/* skip loopback and down interfaces */
+	if ((flags & IFF_LOOPBACK) || !(flags & IFF_UP))
+		return;
+	/* skip point-point interfaces if needed */
+	if ((flags & IFF_POINTOPOINT) && conf.f_skip_p2p_interfaces)
+		return;
+
+	/* find element of %ifaces% table corresponding to interface index */
+	if (!(ifs = iface_get(index, ifname)))
+		if (!(ifs = iface_add(index, ifname)))
+			return;
+
+	ifs->f_used = 1;
+
+	ifs->cur.ipackets	= st->rx_packets;
+	ifs->cur.ibytes		= st->rx_bytes;
+	ifs->cur.ierrors	= st->rx_errors;
+	ifs->cur.opackets	= st->tx_packets;
+	ifs->cur.obytes		= st->tx_bytes;
+	ifs->cur.oerrors	= st->tx_errors;
+	ifs->cur.collisions	= st->collisions;
+	ifs->cur.idrops		= st->rx_dropped;
+	ifs->cur.odrops		= st->tx_dropped;
+	ifs->cur.ififo		= st->rx_fifo_errors;
+	ifs->cur.ofifo		= st->tx_fifo_errors;
+	ifs->cur.imcasts	= st->multicast;
+
+	iface_rates(ifs, *(u_llong *)arg);
+}
+
+/*****************************************************************************
+ * Updates HDD's statistics.
+ *****************************************************************************/
 void update_hdds_counters() {
+	struct diskstats_dev d;
+	struct hdd_la *hdd;
+	time_t tm;
+	u_llong now_ms;
+	char *p;
+
 	stat_hdd(1);
+
+	if (conf.f_disable_hdds_la)
+		return;
+	/* all devices are taken from one read of /proc/diskstats */
+	if ((p = diskstats_read()) == NULL)
+		return;
+	tm = time(NULL);
+	now_ms = sched_now() / 1000;
+	while (diskstats_next(&p, &d)) {
+		if (!hdd_is_disk(&d))
+			continue;
+		if ((hdd = hdd_get(d.name)) == NULL)
+			if ((hdd = hdd_add(d.name)) == NULL)
+				continue;
+		hdd_update(hdd, tm, d.val[DISKSTATS_IN_FLIGHT]);
+		hdd_rates(hdd, &d, now_ms);
+	}
+	hdds_pack();
+}
+
+/*****************************************************************************
+ * Checks whether block device %d% is disk worth reporting: partitions share
+ * queue of their disks, and devices which have never done I/O are unused
+ * loop and ram disks. If so, returns non-zero. Otherwise returns zero.
+ *****************************************************************************/
+int hdd_is_disk(const struct diskstats_dev *d) {
+	return(!d->f_partition && (d->val[DISKSTATS_READS] ||
+	    d->val[DISKSTATS_WRITES]));
+}
+
+/*****************************************************************************
+ * Calculates utilization, IOPS and latency of HDD %hdd% from counters %d%
+ * sampled at monotonic time %now_ms% once per %HDD_RATE_PERIOD%.
+ *****************************************************************************/
+void hdd_rates(struct hdd_la *hdd, const struct diskstats_dev *d,
+    u_llong now_ms) {
+	const u_llong *base = hdd->rate_base;
+	u_llong dt, reads, writes;
+
+	if (hdd->rate_base_ms) {
+		if ((dt = now_ms - hdd->rate_base_ms) < HDD_RATE_PERIOD * 1000)
+			return;
+		/* counters are reset if device is replaced */
+		if (d->val[DISKSTATS_READS] >= base[DISKSTATS_READS] &&
+		    d->val[DISKSTATS_WRITES] >= base[DISKSTATS_WRITES] &&
+		    d->val[DISKSTATS_IO_TICKS] >= base[DISKSTATS_IO_TICKS]) {
+			reads = d->val[DISKSTATS_READS] - base[DISKSTATS_READS];
+			writes = d->val[DISKSTATS_WRITES] -
+			    base[DISKSTATS_WRITES];
+			hdd->util = (d->val[DISKSTATS_IO_TICKS] -
+			    base[DISKSTATS_IO_TICKS]) * 100.0 / dt;
+			if (hdd->util > 100)
+				hdd->util = 100;
+			hdd->iops_read = reads * 1000.0 / dt;
+			hdd->iops_written = writes * 1000.0 / dt;
+			hdd->await_read = reads ?
+			    (double)(d->val[DISKSTATS_READ_TICKS] -
+			    base[DISKSTATS_READ_TICKS]) / reads : 0;
+			hdd->await_written = writes ?
+			    (double)(d->val[DISKSTATS_WRITE_TICKS] -
+			    base[DISKSTATS_WRITE_TICKS]) / writes : 0;
+			hdd->f_rates = 1;
+		}
+	}
+	memcpy(hdd->rate_base, d->val, sizeof(hdd->rate_base));
+	hdd->rate_base_ms = now_ms;
 }
 #endif
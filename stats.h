@@ -4,8 +4,128 @@
  * 	$Id: stats.h 112401 2012-01-12 12:57:01Z dark $
  */
 
+/* Commands in order of their processing. stat_hdd() and do_df()/stat_fs()
+   should be processed last because they sometimes hang */
+enum {
+	CMD_TIME,
+	CMD_UNAME,
+	CMD_VERSION,
+	CMD_UPTIME,
+	CMD_NETSTAT,
+	CMD_IFADDRS,
+	CMD_SMBIOS,
+	CMD_VMSTAT,
+	CMD_SYSCTL,
+	CMD_SWAP,
+	CMD_ACPI_TEMPERATURE,
+	CMD_RAID,
+	CMD_APACHE,
+	CMD_NGINX,
+	CMD_MEMCACHE,
+	CMD_SOCKET,
+	CMD_EXEC,
+	CMD_CPUTEMP,
+	CMD_HDDLOAD,
+	CMD_PKGINFO,
+	CMD_HDD,
+#ifdef __linux__
+	CMD_SMART,
+	CMD_HDD_LIST,
+#endif
+	CMD_DF,
+	CMD_FS,
+	CMD_CACHE,
+	CMD_SAMPLERS,
+	CMD_MAXN
+};
+
+/* Command can be processed inside the main process because it only reads
+   in-memory counters or does quick system calls and never hangs */
+#define CMD_F_INLINE		0x01
+
+/* Maximum time in seconds to serve each client connection or each batch of
+   session */
+#define CLIENT_TIMEOUT		20
+
+/* Maximum time in seconds available for each child process */
+#define CHILD_TIMEOUT		15
+
+/* Maximum idle time in seconds between batches of session */
+#define SESSION_TIMEOUT		300
+
+/* Line finishing response to each batch of session */
+#define SESSION_END_MARKER	"END"
+
+/* Results of req_parse() */
+#define REQ_MORE		0
+#define REQ_GO			1
+#define REQ_QUIT		2
+
+/* Structure for command */
+struct command {
+	/* command name */
+	const char	*name;
+	/* function processing the command */
+	void		(*func)(void);
+	/* CMD_F_* flags */
+	int		flags;
+};
+
+/* Structure for parsed client request */
+struct request {
+	/* flags of requested commands indexed by CMD_* constants */
+	char	f_cmd[CMD_MAXN];
+	/* subcommand flags, see stat.h */
+	int	f_fs_command_fs;
+	int	f_fs_command_fs_list;
+	int	f_hdd_command_hdd;
+	int	f_hdd_command_hdd_list;
+	int	f_hdd_command_smart;
+	int	f_hdd_smart_attrs_requested;
+	char	hdd_smart_attrs[256];
+	int	f_raid_command_raid;
+	int	f_raid_command_raid_list;
+	/* requested sysctl variables */
+	char	*sysctl_vars[SYSCTL_MAXN];
+	u_int	sysctl_n;
+	/* remote time and local time at the moment when it was given */
+	time_t	remote_tm;
+	time_t	local_tm;
+	/* debug level given by DEBUG command or -1 */
+	int	debug_level;
+	/* connection is kept after GO, set by SESSION command */
+	int	f_session;
+	/* push intervals in seconds of commands given by SUBSCRIBE command
+	   indexed by CMD_* constants or 0 */
+	u_int	sub_interval[CMD_MAXN];
+	/* This flag shows whether SUBSCRIBE command was given */
+	int	f_subscribe;
+};
+
+
+extern struct command commands[CMD_MAXN];
+
+
 void process_connection(int);
+void process_request(int, struct request *, const char *, size_t);
+void req_init(struct request *);
+void req_free(struct request *);
+void req_reset(struct request *);
+int req_parse(struct request *, char *);
+int req_is_inline(const struct request *);
+u_int req_args_hash(const struct request *, int);
+void req_run(struct request *);
+void req_run_cmd(struct request *, int);
+void command_name(int, char *, size_t);
+void wait_for_children(void);
+void init_remote_tm(time_t);
+time_t get_remote_tm(void);
+void stats_publish(void);
+void stats_quiescent(void);
+int stats_share(void);
+void stats_import(void);
 void update_iface_counters(void);
 void update_hdds_counters(void);
+void sock_index_build(void);
 void update_socket_counters(void);
-
+void update_socket_bursts(void);
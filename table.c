@@ -0,0 +1,146 @@
+/*
+ * Written by Vadim Guchenko <yhw@rambler-co.ru>
+ *
+ * 	$Id$
+ */
+
+#include <sys/types.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "conf.h"
+#include "table.h"
+
+
+static int table_grow(struct table *);
+static void table_unlink(struct table *, int);
+
+
+/*****************************************************************************
+ * Returns number of the first element of table %t% with key %key% or -1 if
+ * there is no such element.
+ *****************************************************************************/
+int table_first(const struct table *t, u_int key) {
+	int i;
+
+	if (t->hash_size == 0)
+		return(-1);
+	for (i = t->head[key & (t->hash_size - 1)]; i >= 0; i = t->next[i])
+		if (t->keys[i] == key)
+			return(i);
+	return(-1);
+}
+
+/*****************************************************************************
+ * Returns number of the next element of table %t% after element %i% with the
+ * same key or -1 if there is no such element.
+ *****************************************************************************/
+int table_next(const struct table *t, int i) {
+	u_int key = t->keys[i];
+
+	for (i = t->next[i]; i >= 0; i = t->next[i])
+		if (t->keys[i] == key)
+			return(i);
+	return(-1);
+}
+
+/*****************************************************************************
+ * Adds zeroed element with key %key% to the end of table %t%. If successful,
+ * returns number of new element. Otherwise returns -1.
+ *****************************************************************************/
+int table_add(struct table *t, u_int key) {
+	u_int h;
+	int i;
+
+	if (t->count == t->size && !table_grow(t))
+		return(-1);
+	i = t->count++;
+	bzero(TABLE_ELEM(t, i), t->elem_size);
+	t->keys[i] = key;
+	h = key & (t->hash_size - 1);
+	t->next[i] = t->head[h];
+	t->head[h] = i;
+	return(i);
+}
+
+/*****************************************************************************
+ * Deletes element %i% of table %t%. The last element takes its place, so
+ * elements before %i% aren't moved.
+ *****************************************************************************/
+void table_del(struct table *t, int i) {
+	int last, *p;
+
+	table_unlink(t, i);
+	last = --t->count;
+	if (i == last)
+		return;
+
+	/* chain of the last element points to its new place */
+	for (p = &t->head[t->keys[last] & (t->hash_size - 1)]; *p != last;
+	    p = &t->next[*p])
+		;
+	*p = i;
+	t->next[i] = t->next[last];
+	t->keys[i] = t->keys[last];
+	memcpy(TABLE_ELEM(t, i), TABLE_ELEM(t, last), t->elem_size);
+}
+
+/*****************************************************************************
+ * Doubles number of elements of table %t% and rebuilds hash index, which
+ * has twice as many hash values as elements. If successful, returns
+ * non-zero. Otherwise returns zero and the table is left unchanged.
+ *****************************************************************************/
+static int table_grow(struct table *t) {
+	char *elems;
+	u_int *keys, hash_size, h;
+	int *next, *head, size, i;
+
+	size = t->size ? t->size * 2 : TABLE_MIN_SIZE;
+	hash_size = size * 2;
+	if ((elems = realloc(t->elems, size * t->elem_size)) == NULL) {
+		msg_syserr(0, "%s: realloc", __FUNCTION__);
+		return(0);
+	}
+	t->elems = elems;
+	if ((keys = realloc(t->keys, size * sizeof(*keys))) == NULL) {
+		msg_syserr(0, "%s: realloc", __FUNCTION__);
+		return(0);
+	}
+	t->keys = keys;
+	if ((next = realloc(t->next, size * sizeof(*next))) == NULL) {
+		msg_syserr(0, "%s: realloc", __FUNCTION__);
+		return(0);
+	}
+	t->next = next;
+	if ((head = malloc(hash_size * sizeof(*head))) == NULL) {
+		msg_syserr(0, "%s: malloc", __FUNCTION__);
+		return(0);
+	}
+	free(t->head);
+	t->head = head;
+	t->hash_size = hash_size;
+	t->size = size;
+
+	for (h = 0; h < hash_size; h++)
+		head[h] = -1;
+	for (i = 0; i < t->count; i++) {
+		h = keys[i] & (hash_size - 1);
+		next[i] = head[h];
+		head[h] = i;
+	}
+	return(1);
+}
+
+/*****************************************************************************
+ * Removes element %i% of table %t% from its chain.
+ *****************************************************************************/
+static void table_unlink(struct table *t, int i) {
+	int *p;
+
+	for (p = &t->head[t->keys[i] & (t->hash_size - 1)]; *p != i;
+	    p = &t->next[*p])
+		;
+	*p = t->next[i];
+}
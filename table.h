@@ -0,0 +1,38 @@
+/*
+ * Written by Vadim Guchenko <yhw@rambler-co.ru>
+ *
+ * 	$Id$
+ */
+
+/* Initial number of elements of table */
+#define TABLE_MIN_SIZE		16
+
+
+/* Structure for growable array of elements with hash index by key. Elements
+   are moved when table grows or some element is deleted, so pointers to
+   elements are valid only until the next change of table. Empty table has
+   only %elem_size% set, memory is allocated by the first table_add() */
+struct table {
+	/* %size% elements of %elem_size% bytes, first %count% are used */
+	char	*elems;
+	size_t	elem_size;
+	int	count;
+	int	size;
+	/* key of every element and the next element in chain or -1 */
+	u_int	*keys;
+	int	*next;
+	/* the first element in chain for every hash value or -1, number of
+	   hash values is power of 2 */
+	int	*head;
+	u_int	hash_size;
+};
+
+
+/* Returns pointer to element %i% of table %t% */
+#define TABLE_ELEM(t, i)	((void *)((t)->elems + (size_t)(i) * (t)->elem_size))
+
+
+int table_first(const struct table *, u_int);
+int table_next(const struct table *, int);
+int table_add(struct table *, u_int);
+void table_del(struct table *, int);
@@ -12,6 +12,7 @@
 #include <sys/resource.h>
 #include <sys/stat.h>
 #include <sys/param.h>
+#include <poll.h>
 
 #include <netinet/in.h>
 #include <arpa/inet.h>
@@ -28,22 +29,108 @@
 #include <ctype.h>
 #include <pwd.h>
 #include <grp.h>
+#include <signal.h>
+#include <time.h>
 #include <tcpd.h>
 
 #include "vg_lib/vg_signals.h"
 #include "conf.h"
 #include "stats.h"
+#include "output.h"
+#include "event.h"
+#include "cache.h"
+#include "sched.h"
 
 
 /* Connection queue length (backlog parameter of listen(2) function) */
 #define LISTEN_QUEUE		64
 
-/* Timeout in seconds for select(2) function. Should be small enough to call
-   periodic functions between select(2) calls */
+/* Timeout in seconds for event_wait() function. Should be small enough to
+   push counters to subscribed clients in time */
 #define SELECT_TIMEOUT		1
 
-/* Maximum time in seconds to serve each client connection */
-#define CLIENT_TIMEOUT		20
+/* Interval in milliseconds between samples of interface and HDD counters.
+   Load averages of HDDs assume exactly one sample per second */
+#define SAMPLER_INTERVAL	1000
+
+/* Maximum random delay in milliseconds of the first sample, so samplers of
+   different processes don't run simultaneously */
+#define SAMPLER_JITTER		250
+
+/* Minimum time in seconds between starts of the same worker process */
+#define WORKER_RESPAWN_DELAY	1
+
+/* Maximum length of response buffered for subscribed client. Slower
+   clients are disconnected */
+#define SUBSCRIBE_OUTBUF_MAXLEN	(1024 * 1024)
+
+/* Types of event sources */
+#define SRC_SIGNALS		1
+#define SRC_LISTEN		2
+#define SRC_CONN		3
+#define SRC_PIPE		4
+
+
+/* Structure for source of events passed to event_set() */
+struct evsrc {
+	/* SRC_* type of the source */
+	int		type;
+	/* client connection for SRC_CONN and SRC_PIPE sources */
+	struct conn	*conn;
+};
+
+/* Structure for client connection served from the event loop */
+struct conn {
+	/* connection descriptor */
+	int	fd;
+	/* watched events */
+	int	events;
+	/* client address */
+	char	addr[16];
+	/* local time when connection accepted or last batch of session
+	   finished */
+	time_t	start_tm;
+	/* event sources of connection descriptor and child pipe */
+	struct evsrc src_conn;
+	struct evsrc src_pipe;
+	/* descriptor of pipe from child processing the current batch of
+	   session or -1 */
+	int	pipe_fd;
+	/* process ID of child processing the current batch of session or 0 */
+	pid_t	pid;
+	/* unparsed input */
+	char	in[INPUT_LINE_MAXLEN + 1];
+	/* length of unparsed input */
+	size_t	in_len;
+	/* parsed request */
+	struct request req;
+	/* response */
+	struct outbuf out;
+	/* number of already written bytes of response */
+	size_t	out_off;
+	/* This flag shows whether connection should be closed after the
+	   response is written */
+	int	f_close;
+	/* This flag shows whether subscribed commands are pushed to the
+	   client */
+	int	f_stream;
+	/* local time of the next push of subscribed commands indexed by
+	   CMD_* constants */
+	time_t	sub_tm[CMD_MAXN];
+	/* list of connections */
+	struct conn *prev, *next;
+};
+
+
+/* Structure for worker process */
+struct worker {
+	/* listening socket descriptor of the worker */
+	int	listen_fd;
+	/* process ID of the worker or 0 if the worker isn't running */
+	pid_t	pid;
+	/* local time when the worker was started last time */
+	time_t	start_tm;
+};
 
 
 /* This flag shows whether pid file created or not */
@@ -56,22 +143,70 @@ int f_started = 0;
    process */
 int f_client = 0;
 
+/* This flag shows whether current process is worker process or not */
+int f_worker = 0;
+
+/* This flag shows whether current process is sampler process of workers
+   or not */
+int f_sampler = 0;
+
+/* This flag shows whether counters are taken by sampler process and passed
+   to workers through shared memory or not */
+int f_shared = 0;
+
+/* Listening socket descriptor */
+int listen_fd = -1;
+
+/* Worker processes */
+struct worker workers[WORKER_MAXN];
+
+/* Sampler process of workers, its listening socket isn't used */
+struct worker sampler = { -1, 0, 0 };
+
+/* List of connections served from the event loop */
+struct conn *conns = NULL;
+
+/* List of closed connections which may still have events returned by the
+   last event_wait() and are freed after they are dispatched */
+struct conn *conns_closed = NULL;
+
+/* Event sources of signal pipe and listening socket */
+struct evsrc src_signals = { SRC_SIGNALS, NULL };
+struct evsrc src_listen = { SRC_LISTEN, NULL };
+
 
 void set_uid_gid(void);
 int create_listening_socket(void);
 void write_pid(void);
 void reap_children(void);
 void terminate(void);
+void serve(void);
+void sample(void);
+void register_samplers(void);
+void supervise_workers(void);
+void start_workers(void);
+void signal_workers(int);
+void reap_workers(void);
+void accept_connections(void);
+void fork_connection(int, const char *);
+void conn_new(int, const char *);
+void conn_free(struct conn *);
+void conn_read(struct conn *);
+void conn_parse(struct conn *);
+int conn_process(struct conn *);
+void conn_child_init(struct conn *);
+void conn_fork(struct conn *);
+int conn_fork_pipe(struct conn *);
+void conn_read_pipe(struct conn *);
+void conn_write(struct conn *);
+void conn_update_events(struct conn *);
+void conns_expire(void);
+void conns_purge(void);
+void conns_push(void);
 
 /*****************************************************************************/
 int main(int argc, char **argv) {
-	int listen_fd, conn_fd, max_fd, nready;
-	struct sockaddr_in client_addr;
-	socklen_t client_addr_size;
-	fd_set all_fdset, read_fdset;
-	struct timeval timeout;
-	struct request_info request;
-	pid_t pid;
+	int i;
 
 	/* tune messages */
 	strcpy(msg_debug_prefix, "DEBUG");
@@ -94,6 +229,15 @@ int main(int argc, char **argv) {
 
 	/* read configuration file */
 	read_config_file();
+	sock_index_build();
+
+	/* allocate counters of cached commands shared by all processes */
+	cache_init();
+
+	/* workers get counters from one sampler process, otherwise every
+	   worker takes them itself */
+	if (conf.workers)
+		f_shared = stats_share();
 
 	/* block all signals */
 	sig_block();
@@ -106,8 +250,17 @@ int main(int argc, char **argv) {
 	sig_catch(SIGHUP);
 	sig_catch(SIGTERM);
 
-	/* create listening socket */
-	listen_fd = create_listening_socket();
+	/* writing to closed client connection shouldn't kill the main
+	   process */
+	signal(SIGPIPE, SIG_IGN);
+
+	/* create listening sockets: one for every worker process or one for
+	   the main process */
+	if (conf.workers)
+		for (i = 0; i < conf.workers; i++)
+			workers[i].listen_fd = create_listening_socket();
+	else
+		listen_fd = create_listening_socket();
 
 	/* become a daemon */
 	if (daemon(0, 0) < 0)
@@ -127,112 +280,925 @@ int main(int argc, char **argv) {
 	/* clear file mode creation mask */
 	umask(0);
 
+	/* create private directory of cached snapshots */
+	cache_dir_init();
+
 	/* write the process ID to pid file */
 	write_pid();
 
-	FD_ZERO(&all_fdset);
-	FD_SET(sig_pipe[0], &all_fdset);
-	FD_SET(listen_fd, &all_fdset);
-	max_fd = VG_MAX(sig_pipe[0], listen_fd);
-	bzero(&timeout, sizeof(timeout));
+	if (conf.workers)
+		supervise_workers();
+	else
+		serve();
+
+	return(EXIT_SUCCESS);
+}
+
+/*****************************************************************************
+ * Serves client connections on listening socket %listen_fd% and calls
+ * periodic functions. Never returns.
+ *****************************************************************************/
+void serve() {
+	int nready, i;
+	struct event evs[EVENT_MAXN];
+	struct evsrc *src;
+
+	/* kqueue(2) descriptors aren't inherited by children, so events should
+	   be initialized after fork(2) */
+	event_init();
+	if (!event_set(sig_pipe[0], 0, EVENT_READ, &src_signals) ||
+	    !event_set(listen_fd, 0, EVENT_READ, &src_listen))
+		exit(EXIT_FAILURE);
+
+	/* periodic functions run by sampler thread on their own schedule
+	   regardless of client traffic */
+	if (!f_shared) {
+		sched_init();
+		register_samplers();
+		sched_start(stats_publish);
+	}
 
 	for (;;) {
 		/* unblock all signals */
 		sig_unblock();
 
-		/* wait for a new connection, signal or timeout */
-		read_fdset = all_fdset;
-	    timeout.tv_sec = SELECT_TIMEOUT;
-		nready = select(max_fd + 1, &read_fdset, NULL, NULL, &timeout);
+		/* snapshot of counters got by previous round isn't used */
+		stats_quiescent();
+
+		/* wait for a new connection, client data, signal or timeout */
+		nready = event_wait(evs, EVENT_MAXN, SELECT_TIMEOUT * 1000);
 		if (nready < 0) {
 			if (errno == EINTR)
 				continue;
 			else
-				msg_syserr(1, "%s: select", __FUNCTION__);
+				msg_syserr(1, "%s: event_wait", __FUNCTION__);
 		}
 
 		/* block all signals */
 		sig_block();
+
+		/* take counters published by sampler process */
+		if (f_shared)
+			stats_import();
+
+		/* push fresh counters to subscribed clients */
+		conns_push();
+
+		/* forget output keys of instances which are gone */
+		out_key_expire();
+
+		for (i = 0; i < nready; i++) {
+			src = evs[i].data;
+			/* skip events of connection closed in this round */
+			if (src->conn && src->conn->fd < 0)
+				continue;
+			switch (src->type) {
+			case SRC_SIGNALS:
+				/* some signals received */
+				if (f_sig[SIGCHLD]) {
+					reap_children();
+				} else if (f_sig[SIGHUP]) {
+					/* samplers use configuration */
+					sched_lock();
+					read_config_file();
+					sock_index_build();
+					if (!f_shared)
+						register_samplers();
+					sched_unlock();
+				} else if (f_sig[SIGTERM]) {
+					exit(EXIT_SUCCESS);
+				}
+				/* clear signals */
+				sig_clear();
+				break;
+			case SRC_LISTEN:
+				/* new connections available */
+				accept_connections();
+				break;
+			case SRC_CONN:
+				/* client connection is ready */
+				if (evs[i].events & EVENT_WRITE)
+					conn_write(src->conn);
+				else if (evs[i].events & EVENT_READ)
+					conn_read(src->conn);
+				break;
+			case SRC_PIPE:
+				/* child processing batch of session is ready */
+				conn_read_pipe(src->conn);
+				break;
+			}
+		}
+
+		/* close connections served too long */
+		conns_expire();
+
+		/* free closed connections */
+		conns_purge();
+	}
+}
+
+/*****************************************************************************
+ * Takes counters for all workers and passes them through shared memory.
+ * Never returns.
+ *****************************************************************************/
+void sample() {
+	struct pollfd pfd;
+	int nready;
+
+	sched_init();
+	register_samplers();
+	sched_start(stats_publish);
+
+	for (;;) {
+		/* unblock all signals */
+		sig_unblock();
+
+		/* wait for a signal or timeout */
+		pfd.fd = sig_pipe[0];
+		pfd.events = POLLIN;
+		nready = poll(&pfd, 1, SELECT_TIMEOUT * 1000);
+		if (nready < 0) {
+			if (errno == EINTR)
+				continue;
+			else
+				msg_syserr(1, "%s: poll", __FUNCTION__);
+		}
+
+		/* block all signals */
+		sig_block();
+
+		/* poll() timeout */
+		if (nready == 0)
+			continue;
+
+		/* process signals */
+		if (f_sig[SIGHUP]) {
+			/* samplers use configuration */
+			sched_lock();
+			read_config_file();
+			sock_index_build();
+			register_samplers();
+			sched_unlock();
+		} else if (f_sig[SIGTERM]) {
+			exit(EXIT_SUCCESS);
+		}
+		/* clear signals */
+		sig_clear();
+	}
+}
+
+/*****************************************************************************
+ * Registers periodic functions or updates their intervals after
+ * configuration is changed.
+ *****************************************************************************/
+void register_samplers() {
+	sched_add("iface", update_iface_counters, SAMPLER_INTERVAL,
+	    SAMPLER_JITTER);
 #ifndef __linux__
-		/* call periodic functions */
-		update_iface_counters();
 #if __FreeBSD_version >= 500000
-		update_hdds_counters();
+	sched_add("hdd", update_hdds_counters, SAMPLER_INTERVAL,
+	    SAMPLER_JITTER);
 #endif
 #else
-//#define DEBUG printf("Here: %s:%d\n", __FILE__, __LINE__);
-		update_hdds_counters();
+	sched_add("hdd", update_hdds_counters, SAMPLER_INTERVAL,
+	    SAMPLER_JITTER);
 #endif // __linux__
-		update_socket_counters();
-		/* select() timeout */
+	sched_add("socket", update_socket_counters,
+	    (conf.socket_interval > 0) ? conf.socket_interval * 1000 :
+	    SAMPLER_INTERVAL, SAMPLER_JITTER);
+	/* the sampler sets its own interval depending on sockets in burst */
+	if (conf.socket_burst > 0)
+		sched_add("socket_burst", update_socket_bursts,
+		    SAMPLER_INTERVAL, 0);
+	else
+		sched_del(update_socket_bursts);
+}
+
+/*****************************************************************************
+ * Supervises worker processes: starts them, respawns died ones and passes
+ * signals to them. Never returns.
+ *****************************************************************************/
+void supervise_workers() {
+	struct pollfd pfd;
+	int nready;
+
+	for (;;) {
+		/* start workers which aren't running */
+		start_workers();
+
+		/* unblock all signals */
+		sig_unblock();
+
+		/* wait for a signal or timeout */
+		pfd.fd = sig_pipe[0];
+		pfd.events = POLLIN;
+		nready = poll(&pfd, 1, SELECT_TIMEOUT * 1000);
+		if (nready < 0) {
+			if (errno == EINTR)
+				continue;
+			else
+				msg_syserr(1, "%s: poll", __FUNCTION__);
+		}
+
+		/* block all signals */
+		sig_block();
+
+		/* poll() timeout */
 		if (nready == 0)
 			continue;
 
-		/* some signals received */
-		if (FD_ISSET(sig_pipe[0], &read_fdset)) {
-			/* process signals */
-			if (f_sig[SIGCHLD]) {
-				reap_children();
-			} else if (f_sig[SIGHUP]) {
-				read_config_file();
-			} else if (f_sig[SIGTERM]) {
-				exit(EXIT_SUCCESS);
-			}
-			/* clear signals */
-			sig_clear();
+		/* process signals */
+		if (f_sig[SIGCHLD]) {
+			reap_workers();
+		} else if (f_sig[SIGHUP]) {
+			read_config_file();
+			signal_workers(SIGHUP);
+		} else if (f_sig[SIGTERM]) {
+			signal_workers(SIGTERM);
+			exit(EXIT_SUCCESS);
+		}
+		/* clear signals */
+		sig_clear();
+	}
+}
+
+/*****************************************************************************
+ * Starts sampler and worker processes which aren't running. Process which
+ * was started less than WORKER_RESPAWN_DELAY seconds ago is started later.
+ *****************************************************************************/
+void start_workers() {
+	int i, j;
+	pid_t pid;
+	time_t tm;
+
+	tm = time(NULL);
+	if (f_shared && !sampler.pid &&
+	    tm - sampler.start_tm >= WORKER_RESPAWN_DELAY) {
+		sampler.start_tm = tm;
+		if ((pid = fork()) == 0) { /* child */
+			f_sampler = 1;
+			/* sampler doesn't serve clients */
+			for (j = 0; j < conf.workers; j++)
+				close(workers[j].listen_fd);
+			/* sampler needs its own signal pipe */
+			sig_pipe_close();
+			sig_pipe_open();
+			msg_notice("sampler started");
+			sample();
+		} else if (pid > 0) { /* parent */
+			sampler.pid = pid;
+		} else {
+			msg_syserr(0, "%s: can't fork sampler", __FUNCTION__);
 		}
+	}
+	for (i = 0; i < conf.workers; i++) {
+		if (workers[i].pid || tm - workers[i].start_tm < WORKER_RESPAWN_DELAY)
+			continue;
+		workers[i].start_tm = tm;
+		if ((pid = fork()) == 0) { /* child */
+			f_worker = 1;
+			/* close listening sockets of other workers */
+			for (j = 0; j < conf.workers; j++)
+				if (j != i)
+					close(workers[j].listen_fd);
+			listen_fd = workers[i].listen_fd;
+			/* worker needs its own signal pipe */
+			sig_pipe_close();
+			sig_pipe_open();
+			msg_notice("worker %d started", i);
+			serve();
+		} else if (pid > 0) { /* parent */
+			workers[i].pid = pid;
+		} else {
+			msg_syserr(0, "%s: can't fork worker %d", __FUNCTION__, i);
+		}
+	}
+}
+
+/*****************************************************************************
+ * Sends signal %signo% to running sampler and worker processes.
+ *****************************************************************************/
+void signal_workers(int signo) {
+	int i;
 
-		/* new connection available */
-		if (FD_ISSET(listen_fd, &read_fdset)) {
-			/* accept client connection */
-			client_addr_size = sizeof(client_addr);
-			if ((conn_fd = accept(listen_fd, (struct sockaddr *)&client_addr,
-			    &client_addr_size)) < 0) {
-				msg_syserr(0, "%s: accept", __FUNCTION__);
-				sleep(1);
+	if (sampler.pid && kill(sampler.pid, signo) < 0)
+		msg_syswarn("can't send signal %d to sampler", signo);
+	for (i = 0; i < conf.workers; i++)
+		if (workers[i].pid && kill(workers[i].pid, signo) < 0)
+			msg_syswarn("can't send signal %d to worker %d", signo, i);
+}
+
+/*****************************************************************************
+ * Reaps any already terminated sampler and worker processes. They will be
+ * restarted by start_workers().
+ *****************************************************************************/
+void reap_workers() {
+	char name[32];
+	pid_t pid;
+	int status, i;
+
+	while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+		if (sampler.pid && sampler.pid == pid) {
+			sampler.pid = 0;
+			strcpy(name, "sampler");
+		} else {
+			for (i = 0; i < conf.workers; i++)
+				if (workers[i].pid == pid)
+					break;
+			if (i == conf.workers)
 				continue;
-			}
-			/* check hosts access control files before serving client
-			   connection */
-			if (conf.f_hosts_access) {
-				request_init(&request, RQ_DAEMON, "ussd", RQ_FILE, conn_fd, 0);
-				fromhost(&request);
-				if (!hosts_access(&request)) {
-					msg_warn("connection from %s (%s) rejected",
-					    eval_hostaddr(request.client),
-					    eval_hostname(request.client));
-					close(conn_fd);
-					continue;
-				}
-			}
-			/* do fork to serve client connection */
-			if ((pid = fork()) == 0) { /* child */
-				f_client = 1;
-				/* close all parent descriptors */
-				close(listen_fd);
-				sig_pipe_close();
-				/* set default action for all modified signals */
-				sig_default(SIGCHLD);
-				sig_default(SIGHUP);
-				sig_default(SIGTERM);
-				/* unblock all signals */
-				sig_unblock();
-				/* set timeout */
-				alarm(CLIENT_TIMEOUT);
-				/* process client connection */
-				process_connection(conn_fd);
-				exit(EXIT_SUCCESS);
-			} else if (pid > 0) { /* parent */
-				msg_info("[%d] connection started from %s",
-				    pid, inet_ntoa(client_addr.sin_addr));
-				close(conn_fd);
-			} else {
-				msg_syserr(0, "%s: can't fork", __FUNCTION__);
+			workers[i].pid = 0;
+			snprintf(name, sizeof(name), "worker %d", i);
+		}
+		if (WIFEXITED(status))
+			msg_warn("[%d] %s exited with status %d",
+			    pid, name, WEXITSTATUS(status));
+		else if (WIFSIGNALED(status))
+			msg_warn("[%d] %s killed by signal %d",
+			    pid, name, WTERMSIG(status));
+		else
+			msg_warn("[%d] %s finished", pid, name);
+	}
+}
+
+/*****************************************************************************
+ * Accepts all pending connections on listening socket %listen_fd%.
+ *****************************************************************************/
+void accept_connections() {
+	int conn_fd, flags;
+	struct sockaddr_in client_addr;
+	socklen_t client_addr_size;
+	struct request_info request;
+	char addr[16];
+
+	for (;;) {
+		/* accept client connection */
+		client_addr_size = sizeof(client_addr);
+		if ((conn_fd = accept(listen_fd, (struct sockaddr *)&client_addr,
+		    &client_addr_size)) < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK ||
+			    errno == EINTR || errno == ECONNABORTED)
+				return;
+			msg_syserr(0, "%s: accept", __FUNCTION__);
+			sleep(1);
+			return;
+		}
+		/* check hosts access control files before serving client
+		   connection */
+		if (conf.f_hosts_access) {
+			request_init(&request, RQ_DAEMON, "ussd", RQ_FILE, conn_fd, 0);
+			fromhost(&request);
+			if (!hosts_access(&request)) {
+				msg_warn("connection from %s (%s) rejected",
+				    eval_hostaddr(request.client),
+				    eval_hostname(request.client));
 				close(conn_fd);
-				sleep(1);
 				continue;
 			}
 		}
+		snprintf(addr, sizeof(addr), "%s", inet_ntoa(client_addr.sin_addr));
+
+		/* accepted socket may inherit non-blocking mode of listening
+		   socket, so set the needed mode explicitly */
+		if ((flags = fcntl(conn_fd, F_GETFL)) < 0 ||
+		    fcntl(conn_fd, F_SETFL, conf.f_event_loop ?
+		    flags | O_NONBLOCK : flags & ~O_NONBLOCK) < 0) {
+			msg_syserr(0, "%s: fcntl", __FUNCTION__);
+			close(conn_fd);
+			continue;
+		}
+
+		if (conf.f_event_loop)
+			conn_new(conn_fd, addr);
+		else
+			fork_connection(conn_fd, addr);
+	}
+}
+
+/*****************************************************************************
+ * Forks a child to serve client connection %conn_fd% from address %addr%.
+ *****************************************************************************/
+void fork_connection(int conn_fd, const char *addr) {
+	pid_t pid;
+
+	/* do fork to serve client connection */
+	if ((pid = fork()) == 0) { /* child */
+		f_client = 1;
+		/* close all parent descriptors */
+		close(listen_fd);
+		sig_pipe_close();
+		event_close();
+		/* set default action for all modified signals */
+		sig_default(SIGCHLD);
+		sig_default(SIGHUP);
+		sig_default(SIGTERM);
+		signal(SIGPIPE, SIG_DFL);
+		/* unblock all signals */
+		sig_unblock();
+		/* set timeout */
+		alarm(CLIENT_TIMEOUT);
+		/* process client connection */
+		process_connection(conn_fd);
+		exit(EXIT_SUCCESS);
+	} else if (pid > 0) { /* parent */
+		msg_info("[%d] connection started from %s", pid, addr);
+		close(conn_fd);
+	} else {
+		msg_syserr(0, "%s: can't fork", __FUNCTION__);
+		close(conn_fd);
+		sleep(1);
+	}
+}
+
+/*****************************************************************************
+ * Starts serving client connection %fd% from address %addr% in the event
+ * loop.
+ *****************************************************************************/
+void conn_new(int fd, const char *addr) {
+	struct conn *c;
+
+	if ((c = calloc(1, sizeof(*c))) == NULL) {
+		msg_syserr(0, "%s: calloc", __FUNCTION__);
+		close(fd);
+		return;
+	}
+	c->fd = fd;
+	snprintf(c->addr, sizeof(c->addr), "%s", addr);
+	c->start_tm = time(NULL);
+	c->src_conn.type = SRC_CONN;
+	c->src_conn.conn = c;
+	c->src_pipe.type = SRC_PIPE;
+	c->src_pipe.conn = c;
+	c->pipe_fd = -1;
+	req_init(&c->req);
+	if (!event_set(fd, 0, EVENT_READ, &c->src_conn)) {
+		close(fd);
+		free(c);
+		return;
+	}
+	c->events = EVENT_READ;
+
+	/* add connection to the list */
+	c->next = conns;
+	if (conns)
+		conns->prev = c;
+	conns = c;
+
+	msg_info("[fd %d] connection started from %s", fd, addr);
+}
+
+/*****************************************************************************
+ * Closes client connection %c%. Child processing the current batch of session
+ * is killed.
+ *****************************************************************************/
+void conn_free(struct conn *c) {
+	if (c->events)
+		event_del(c->fd, c->events);
+	close(c->fd);
+	if (c->pipe_fd >= 0) {
+		event_del(c->pipe_fd, EVENT_READ);
+		close(c->pipe_fd);
+	}
+	if (c->pid)
+		kill(c->pid, SIGKILL);
+
+	/* delete connection from the list */
+	if (c->prev)
+		c->prev->next = c->next;
+	else
+		conns = c->next;
+	if (c->next)
+		c->next->prev = c->prev;
+
+	req_free(&c->req);
+	outbuf_free(&c->out);
+
+	/* connection is freed later by conns_purge() */
+	c->fd = -1;
+	c->next = conns_closed;
+	conns_closed = c;
+}
+
+/*****************************************************************************
+ * Sets watched events of client connection %c% according to its state:
+ * pending response is written first, new directives are read only when
+ * nothing is being processed.
+ *****************************************************************************/
+void conn_update_events(struct conn *c) {
+	int events;
+
+	events = 0;
+	if (c->out_off < c->out.len)
+		events = EVENT_WRITE;
+	else if (!c->pid && !c->f_close)
+		events = EVENT_READ;
+	if (c->events == events)
+		return;
+	if (events)
+		event_set(c->fd, c->events, events, &c->src_conn);
+	else
+		event_del(c->fd, c->events);
+	c->events = events;
+}
+
+/*****************************************************************************
+ * Reads available data from client connection %c% and processes complete
+ * directives.
+ *****************************************************************************/
+void conn_read(struct conn *c) {
+	ssize_t n;
+
+	n = read(c->fd, c->in + c->in_len, sizeof(c->in) - 1 - c->in_len);
+	if (n < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+			return;
+		msg_syswarn("[fd %d] read", c->fd);
+		conn_free(c);
+		return;
+	}
+
+	if (n == 0) {
+		/* connection closed by client before GO. It's the normal way
+		   to finish session or subscription */
+		if (!c->req.f_session && !c->f_stream) {
+			out_buf = &c->out;
+			out_error("Incomplete directives: no GO");
+			out_buf = NULL;
+		}
+		c->f_close = 1;
+		conn_write(c);
+		return;
+	}
+	c->in_len += n;
+
+	conn_parse(c);
+}
+
+/*****************************************************************************
+ * Parses complete directives read from client connection %c% and processes
+ * complete requests. Parsing stops while a batch of session is processed
+ * by child.
+ *****************************************************************************/
+void conn_parse(struct conn *c) {
+	char *line, *eol, *p;
+	size_t pos;
+	int res;
+
+	pos = 0;
+	while (!c->pid && !c->f_close &&
+	    (eol = memchr(c->in + pos, '\n', c->in_len - pos)) != NULL) {
+		line = c->in + pos;
+		*eol = 0;
+		pos = eol + 1 - c->in;
+		parse_chomp(line);
+
+		if (c->f_stream) {
+			/* only QUIT is accepted from subscribed client */
+			if (parse_get_str(line, &p, "QUIT") && !*p) {
+				c->f_close = 1;
+			} else {
+				out_buf = &c->out;
+				out_error("Unexpected directive in subscription "
+				    "'%s'", line);
+				out_buf = NULL;
+			}
+			continue;
+		}
+
+		out_buf = &c->out;
+		res = req_parse(&c->req, line);
+		out_buf = NULL;
+
+		if (res == REQ_GO) {
+			/* keep unparsed directives of the next batches */
+			c->in_len -= pos;
+			memmove(c->in, c->in + pos, c->in_len);
+			pos = 0;
+			if (!conn_process(c))
+				return;
+		} else if (res == REQ_QUIT) {
+			c->f_close = 1;
+		}
+	}
+
+	/* keep incomplete line */
+	c->in_len -= pos;
+	memmove(c->in, c->in + pos, c->in_len);
+	if (!c->f_close && c->in_len == sizeof(c->in) - 1) {
+		c->in[c->in_len] = 0;
+		out_buf = &c->out;
+		out_error("Input line is too long: '%s'", c->in);
+		out_buf = NULL;
+		c->f_close = 1;
+	}
+	conn_write(c);
+}
+
+/*****************************************************************************
+ * Processes complete request of client connection %c%. Request is processed
+ * inside the main process if possible. Otherwise child is forked. Returns
+ * zero if connection was passed to child and freed, non-zero otherwise.
+ *****************************************************************************/
+int conn_process(struct conn *c) {
+	time_t tm;
+	int i;
+
+	if (c->req.f_subscribe) {
+		if (!req_is_inline(&c->req)) {
+			out_buf = &c->out;
+			out_error("SUBSCRIBE can't be used with commands processed "
+			    "by child");
+			out_buf = NULL;
+			c->f_close = 1;
+			return(1);
+		}
+		/* the first response contains all requested commands, the
+		   next ones are pushed by conns_push() */
+		tm = time(NULL);
+		for (i = 0; i < CMD_MAXN; i++)
+			if (c->req.sub_interval[i])
+				c->sub_tm[i] = tm + c->req.sub_interval[i];
+		c->f_stream = 1;
+		out_buf = &c->out;
+		req_run(&c->req);
+		out_printf("%s\n", SESSION_END_MARKER);
+		out_buf = NULL;
+		return(1);
+	}
+
+	if (!req_is_inline(&c->req)) {
+		if (c->req.f_session)
+			return(conn_fork_pipe(c));
+		conn_fork(c);
+		return(0);
+	}
+	out_buf = &c->out;
+	req_run(&c->req);
+	if (c->req.f_session) {
+		out_printf("%s\n", SESSION_END_MARKER);
+		req_reset(&c->req);
+		c->start_tm = time(NULL);
+	} else {
+		c->f_close = 1;
+	}
+	out_buf = NULL;
+	return(1);
+}
+
+/*****************************************************************************
+ * Prepares just forked child for processing request of client connection %c%:
+ * closes all descriptors of the main process except connection descriptor
+ * and restores signal handling.
+ *****************************************************************************/
+void conn_child_init(struct conn *c) {
+	struct conn *p;
+
+	f_client = 1;
+	/* close all parent descriptors */
+	close(listen_fd);
+	sig_pipe_close();
+	event_close();
+	for (p = conns; p; p = p->next) {
+		if (p->pipe_fd >= 0)
+			close(p->pipe_fd);
+		if (p != c)
+			close(p->fd);
+	}
+	/* set default action for all modified signals */
+	sig_default(SIGCHLD);
+	sig_default(SIGHUP);
+	sig_default(SIGTERM);
+	signal(SIGPIPE, SIG_DFL);
+	/* unblock all signals */
+	sig_unblock();
+	/* set timeout */
+	alarm(CLIENT_TIMEOUT);
+}
+
+/*****************************************************************************
+ * Forks a child to process request of client connection %c% which can't be
+ * processed inside the main process. Client connection is closed in the
+ * main process.
+ *****************************************************************************/
+void conn_fork(struct conn *c) {
+	pid_t pid;
+	int flags;
+
+	if ((pid = fork()) == 0) { /* child */
+		conn_child_init(c);
+		/* process client request */
+		if ((flags = fcntl(c->fd, F_GETFL)) >= 0)
+			fcntl(c->fd, F_SETFL, flags & ~O_NONBLOCK);
+		process_request(c->fd, &c->req, c->out.buf + c->out_off,
+		    c->out.len - c->out_off);
+		exit(EXIT_SUCCESS);
+	} else if (pid > 0) { /* parent */
+		msg_info("[%d] request from %s passed to child", pid, c->addr);
+	} else {
+		msg_syserr(0, "%s: can't fork", __FUNCTION__);
+	}
+	conn_free(c);
+}
+
+/*****************************************************************************
+ * Forks a child to process the current batch of session of client
+ * connection %c% which can't be processed inside the main process. Child
+ * writes response to the pipe, main process passes it to the client and
+ * keeps the session. Returns zero if connection was freed, non-zero
+ * otherwise.
+ *****************************************************************************/
+int conn_fork_pipe(struct conn *c) {
+	int pfd[2];
+	pid_t pid;
+
+	if (pipe(pfd) < 0) {
+		msg_syserr(0, "%s: pipe", __FUNCTION__);
+		conn_free(c);
+		return(0);
+	}
+	if ((pid = fork()) == 0) { /* child */
+		close(pfd[0]);
+		conn_child_init(c);
+		close(c->fd);
+		process_request(pfd[1], &c->req, NULL, 0);
+		exit(EXIT_SUCCESS);
+	} else if (pid < 0) {
+		msg_syserr(0, "%s: can't fork", __FUNCTION__);
+		close(pfd[0]);
+		close(pfd[1]);
+		conn_free(c);
+		return(0);
+	}
+
+	/* parent */
+	close(pfd[1]);
+	fcntl(pfd[0], F_SETFL, fcntl(pfd[0], F_GETFL) | O_NONBLOCK);
+	c->pipe_fd = pfd[0];
+	c->pid = pid;
+	if (!event_set(c->pipe_fd, 0, EVENT_READ, &c->src_pipe)) {
+		conn_free(c);
+		return(0);
+	}
+	msg_debug(1, "[%d] batch of session from %s passed to child", pid, c->addr);
+	return(1);
+}
+
+/*****************************************************************************
+ * Reads response of child processing the current batch of session of client
+ * connection %c%. When child finishes, the batch is completed and the next
+ * batches are processed.
+ *****************************************************************************/
+void conn_read_pipe(struct conn *c) {
+	char buf[BUFSIZ];
+	ssize_t n;
+
+	n = read(c->pipe_fd, buf, sizeof(buf));
+	if (n < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+			return;
+		msg_syswarn("[fd %d] read from child", c->fd);
+		n = 0;
+	}
+	if (n > 0) {
+		outbuf_append(&c->out, buf, n);
+		conn_write(c);
+		return;
+	}
+
+	/* child finished the batch */
+	event_del(c->pipe_fd, EVENT_READ);
+	close(c->pipe_fd);
+	c->pipe_fd = -1;
+	c->pid = 0;
+	outbuf_append(&c->out, SESSION_END_MARKER "\n",
+	    sizeof(SESSION_END_MARKER "\n") - 1);
+	req_reset(&c->req);
+	c->start_tm = time(NULL);
+
+	/* process pipelined batches */
+	conn_parse(c);
+}
+
+/*****************************************************************************
+ * Writes buffered response to client connection %c%. Closes connection when
+ * whole response is written and %c->f_close% flag is set.
+ *****************************************************************************/
+void conn_write(struct conn *c) {
+	ssize_t n;
+
+	while (c->out_off < c->out.len) {
+		n = write(c->fd, c->out.buf + c->out_off, c->out.len - c->out_off);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			msg_syswarn("[fd %d] write", c->fd);
+			conn_free(c);
+			return;
+		}
+		c->out_off += n;
+	}
+	if (c->out_off == c->out.len) {
+		c->out_off = 0;
+		c->out.len = 0;
+
+		if (c->f_close) {
+			msg_info("[fd %d] connection finished", c->fd);
+			conn_free(c);
+			return;
+		}
+
+		/* directives read while response was written */
+		if (!c->pid && memchr(c->in, '\n', c->in_len)) {
+			conn_parse(c);
+			return;
+		}
+	}
+	conn_update_events(c);
+}
+
+/*****************************************************************************
+ * Pushes subscribed commands which are due to clients. Each push is finished
+ * by SESSION_END_MARKER line.
+ *****************************************************************************/
+void conns_push() {
+	struct conn *c, *next;
+	struct request req;
+	time_t tm;
+	int i, n;
+
+	tm = time(NULL);
+	for (c = conns; c; c = next) {
+		next = c->next;
+		if (!c->f_stream || c->f_close)
+			continue;
+
+		/* request of due commands only */
+		req = c->req;
+		bzero(req.f_cmd, sizeof(req.f_cmd));
+		n = 0;
+		for (i = 0; i < CMD_MAXN; i++) {
+			if (!c->req.sub_interval[i] || c->sub_tm[i] > tm)
+				continue;
+			req.f_cmd[i] = 1;
+			n++;
+			/* keep the phase unless we are late for the whole
+			   interval */
+			c->sub_tm[i] += c->req.sub_interval[i];
+			if (c->sub_tm[i] <= tm)
+				c->sub_tm[i] = tm + c->req.sub_interval[i];
+		}
+		if (!n)
+			continue;
+
+		if (c->out.len - c->out_off > SUBSCRIBE_OUTBUF_MAXLEN) {
+			msg_warn("[fd %d] subscribed client %s is too slow",
+			    c->fd, c->addr);
+			conn_free(c);
+			continue;
+		}
+
+		out_buf = &c->out;
+		req_run(&req);
+		out_printf("%s\n", SESSION_END_MARKER);
+		out_buf = NULL;
+		conn_write(c);
+	}
+}
+
+/*****************************************************************************
+ * Frees connections closed by conn_free().
+ *****************************************************************************/
+void conns_purge() {
+	struct conn *c;
+
+	while ((c = conns_closed) != NULL) {
+		conns_closed = c->next;
+		free(c);
+	}
+}
+
+/*****************************************************************************
+ * Closes connections which are served longer than CLIENT_TIMEOUT seconds
+ * and sessions which are idle longer than SESSION_TIMEOUT seconds.
+ *****************************************************************************/
+void conns_expire() {
+	struct conn *c, *next;
+	time_t tm;
+
+	tm = time(NULL);
+	for (c = conns; c; c = next) {
+		next = c->next;
+		/* subscribed clients are disconnected only if they are too
+		   slow to read pushed counters */
+		if (c->f_stream)
+			continue;
+		if (tm - c->start_tm >= (c->req.f_session ? SESSION_TIMEOUT :
+		    CLIENT_TIMEOUT)) {
+			msg_info("[fd %d] connection from %s timed out", c->fd, c->addr);
+			conn_free(c);
+		}
 	}
 }
 
@@ -311,7 +1277,7 @@ void set_uid_gid() {
  * Creates listening socket. Returns descriptor of created socket.
  *****************************************************************************/
 int create_listening_socket() {
-	int fd, optval;
+	int fd, optval, flags;
 	struct sockaddr_in addr;
 
 	/* create socket */
@@ -323,6 +1289,20 @@ int create_listening_socket() {
 	if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval)) < 0)
 		msg_syserr(1, "%s: setsockopt(SO_REUSEADDR)", __FUNCTION__);
 
+	/* every worker process has its own listening socket bound to the same
+	   port, kernel balances incoming connections between them */
+	if (conf.workers) {
+#if defined(SO_REUSEPORT_LB)
+		if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT_LB, &optval, sizeof(optval)) < 0)
+			msg_syserr(1, "%s: setsockopt(SO_REUSEPORT_LB)", __FUNCTION__);
+#elif defined(SO_REUSEPORT)
+		if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(optval)) < 0)
+			msg_syserr(1, "%s: setsockopt(SO_REUSEPORT)", __FUNCTION__);
+#else
+		msg_err(1, "%s: worker processes require SO_REUSEPORT", __FUNCTION__);
+#endif
+	}
+
 	/* bind socket */
 	bzero(&addr, sizeof(addr));
 	addr.sin_family 	= AF_INET;
@@ -335,6 +1315,12 @@ int create_listening_socket() {
 	if (listen(fd, LISTEN_QUEUE) < 0)
 		msg_syserr(1, "%s: listen", __FUNCTION__);
 
+	/* all pending connections are accepted at once, so accept(2) shouldn't
+	   block when queue becomes empty */
+	if ((flags = fcntl(fd, F_GETFL)) < 0 ||
+	    fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+		msg_syserr(1, "%s: fcntl(O_NONBLOCK)", __FUNCTION__);
+
 	return(fd);
 }
 
@@ -390,6 +1376,12 @@ void terminate() {
 	if (f_client)
 		return;
 
+	/* pid file belongs to the main process */
+	if (f_worker || f_sampler) {
+		msg_notice(f_sampler ? "sampler stopped" : "worker stopped");
+		return;
+	}
+
 	/* delete pid file if it was created */
 	if (f_pidfile)
 		if (unlink(conf.pidfile) < 0)
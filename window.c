@@ -0,0 +1,121 @@
+/*
+ * Written by Vadim Guchenko <yhw@rambler-co.ru>
+ *
+ * 	$Id$
+ */
+
+#include <sys/types.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "conf.h"
+#include "sketch.h"
+#include "window.h"
+
+
+/*****************************************************************************
+ * Initializes window %w% of %size% samples. If successful, returns non-zero.
+ * Otherwise returns zero.
+ *****************************************************************************/
+int window_init(struct window *w, u_int size) {
+	bzero(w, sizeof(*w));
+	if (size == 0)
+		size = 1;
+	/* one allocation for all rings */
+	if ((w->max_seq = malloc(size * (sizeof(*w->max_seq) +
+	    sizeof(*w->samples) + sizeof(*w->max_val)))) == NULL) {
+		msg_syserr(0, "%s: malloc", __FUNCTION__);
+		return(0);
+	}
+	w->samples = (int *)(w->max_seq + size);
+	w->max_val = w->samples + size;
+	w->size = size;
+	return(1);
+}
+
+/*****************************************************************************
+ * Frees memory used by window %w%.
+ *****************************************************************************/
+void window_free(struct window *w) {
+	free(w->max_seq);
+	bzero(w, sizeof(*w));
+}
+
+/*****************************************************************************
+ * Adds sample %value% to window %w%. The oldest sample leaves the window if
+ * it's full.
+ *****************************************************************************/
+void window_push(struct window *w, int value) {
+	u_int i;
+
+	i = w->seq % w->size;
+	if (w->seq >= w->size && w->samples[i] >= 0) {
+		w->count--;
+		w->sum -= w->samples[i];
+		sketch_del(&w->quantiles, w->samples[i]);
+	}
+	w->samples[i] = value;
+
+	/* only one candidate can leave the window per sample */
+	if (w->max_len && w->max_seq[w->max_head] + w->size <= w->seq) {
+		w->max_head = (w->max_head + 1) % w->size;
+		w->max_len--;
+	}
+
+	if (value >= 0) {
+		w->count++;
+		w->sum += value;
+		w->missing = 0;
+		sketch_add(&w->quantiles, value);
+		/* older samples not greater than the new one never become
+		   maximum again */
+		while (w->max_len && w->max_val[(w->max_head + w->max_len - 1) %
+		    w->size] <= value)
+			w->max_len--;
+		i = (w->max_head + w->max_len) % w->size;
+		w->max_val[i] = value;
+		w->max_seq[i] = w->seq;
+		w->max_len++;
+	} else
+		w->missing++;
+	w->seq++;
+}
+
+/*****************************************************************************
+ * Returns the last sample of window %w% or -1 if there are no samples.
+ *****************************************************************************/
+int window_last(const struct window *w) {
+	if (w->seq == 0)
+		return(-1);
+	return(w->samples[(w->seq - 1) % w->size]);
+}
+
+/*****************************************************************************
+ * Returns maximum of known samples in window %w% or -1 if all samples are
+ * unknown.
+ *****************************************************************************/
+int window_max(const struct window *w) {
+	if (w->max_len == 0)
+		return(-1);
+	return(w->max_val[w->max_head]);
+}
+
+/*****************************************************************************
+ * Returns average of known samples in window %w% or 0 if all samples are
+ * unknown.
+ *****************************************************************************/
+double window_avg(const struct window *w) {
+	if (w->count == 0)
+		return(0);
+	return((double)w->sum / w->count);
+}
+
+/*****************************************************************************
+ * Returns estimation of quantile %q% (0 <= %q% <= 1) of known samples in
+ * window %w% or -1 if all samples are unknown.
+ *****************************************************************************/
+int window_quantile(const struct window *w, double q) {
+	return(sketch_quantile(&w->quantiles, q));
+}
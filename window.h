@@ -0,0 +1,41 @@
+/*
+ * Written by Vadim Guchenko <yhw@rambler-co.ru>
+ *
+ * 	$Id$
+ */
+
+/* Structure for sliding window of the last samples. Negative sample means
+   that value is unknown. Sum, number of known samples, maximum and quantile
+   sketch are kept up to date on every sample, so they are available without
+   walking through samples */
+struct window {
+	/* length of window in samples */
+	u_int	size;
+	/* number of samples taken so far */
+	u_long	seq;
+	/* samples, ring of %size% elements indexed by sample number */
+	int	*samples;
+	/* candidates for maximum in decreasing order of values and increasing
+	   order of sample numbers, ring of %size% elements */
+	int	*max_val;
+	u_long	*max_seq;
+	/* the first candidate and number of candidates */
+	u_int	max_head;
+	u_int	max_len;
+	/* number of known samples in window and their sum */
+	u_int	count;
+	u_llong	sum;
+	/* number of unknown samples taken since the last known one */
+	u_long	missing;
+	/* distribution of known samples in window */
+	struct sketch quantiles;
+};
+
+
+int window_init(struct window *, u_int);
+void window_free(struct window *);
+void window_push(struct window *, int);
+int window_last(const struct window *);
+int window_max(const struct window *);
+double window_avg(const struct window *);
+int window_quantile(const struct window *, double);